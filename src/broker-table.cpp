@@ -0,0 +1,273 @@
+#ifndef BROKER_TABLE_CPP
+#define BROKER_TABLE_CPP
+
+#include <stdint.h>
+#include <string.h>
+#include "./types/mqtt-server.h"
+
+#ifndef MAX_MQTT_SERVERS
+#define MAX_MQTT_SERVERS 8
+#endif
+
+/**
+ * Class for MQTT broker table and health scored failover.
+ *
+ * Broker urls are parsed once at boot. Every connection attempt is recorded so that selection can prefer the
+ * broker with the lowest connect latency. A failing broker is backed off exponentially and only retried before
+ * the backoff has expired when every broker is backed off, in which case the one whose backoff ends first is
+ * taken. Brokers with equal scores are taken in turn starting after the current one.
+ *
+ * Resolved addresses are cached for dnsTtlMs so that reconnects skip the DNS lookup. Cached address of a broker
+ * is dropped when connecting to it fails, as the broker may have moved.
+ */
+class BrokerTable {
+
+  public:
+
+    const static uint32_t dnsTtlMs = 600000;
+
+  private:
+
+    // Score of a broker that has not connected yet, known good brokers are preferred over untried ones
+    const static uint32_t unknownLatencyMs = 2000;
+    const static uint32_t failurePenaltyMs = 5000;
+    const static uint32_t backedOffPenalty = 1000000;
+    const static uint32_t minBackoffMs = 5000;
+    const static uint32_t maxBackoffMs = 300000;
+
+    MqttServer servers[MAX_MQTT_SERVERS];
+    uint8_t serverCount = 0;
+    uint8_t current = 0;
+
+    /**
+     * Parses single mqtt server url of form protocol://host[:port]
+     *
+     * @param url url start
+     * @param length url length
+     * @param server parsed server
+     * @return whether url was valid
+     */
+    static bool parseUrl(const char *url, size_t length, MqttServer *server) {
+      memset(server, 0, sizeof(MqttServer));
+
+      const char *end = url + length;
+      const char *separator = NULL;
+      for (const char *c = url; c + 2 < end; c++) {
+        if (c[0] == ':' && c[1] == '/' && c[2] == '/') {
+          separator = c;
+          break;
+        }
+      }
+      if (separator == NULL || separator == url || (size_t) (separator - url) >= sizeof(server->protocol)) {
+        return false;
+      }
+      memcpy(server->protocol, url, separator - url);
+
+      const char *host = separator + 3;
+      const char *hostEnd = host;
+      while (hostEnd < end && *hostEnd != ':' && *hostEnd != '/') {
+        hostEnd++;
+      }
+      if (hostEnd == host || (size_t) (hostEnd - host) >= sizeof(server->host)) {
+        return false;
+      }
+      memcpy(server->host, host, hostEnd - host);
+
+      server->port = strcmp(server->protocol, "mqtts") == 0 ? 8883 : 1883;
+      if (hostEnd < end && *hostEnd == ':') {
+        uint32_t port = 0;
+        const char *digit = hostEnd + 1;
+        for (; digit < end && *digit >= '0' && *digit <= '9'; digit++) {
+          port = port * 10 + (*digit - '0');
+          if (port > 65535) {
+            return false;
+          }
+        }
+        if (digit == hostEnd + 1 || port == 0) {
+          return false;
+        }
+        server->port = port;
+      }
+      return true;
+    }
+
+    /**
+     * Returns backoff of a broker after its consecutive failures
+     *
+     * @param server broker
+     * @return backoff in milliseconds
+     */
+    static uint32_t getBackoff(const MqttServer &server) {
+      uint8_t shift = server.consecutiveFailures - 1;
+      if (shift > 6) {
+        shift = 6;
+      }
+      uint32_t backoff = minBackoffMs << shift;
+      return backoff > maxBackoffMs ? maxBackoffMs : backoff;
+    }
+
+  public:
+
+    /**
+     * Parses comma separated mqtt server urls. Invalid urls are skipped
+     *
+     * @param urls comma separated urls of form protocol://host[:port]
+     * @param maxCount maximum number of urls to read
+     * @return number of valid servers
+     */
+    uint8_t parse(const char *urls, uint8_t maxCount) {
+      serverCount = 0;
+      const char *start = urls;
+      for (uint8_t i = 0; i < maxCount && *start != '\0' && serverCount < MAX_MQTT_SERVERS; i++) {
+        const char *end = strchr(start, ',');
+        if (end == NULL) {
+          end = start + strlen(start);
+        }
+
+        const char *urlStart = start;
+        const char *urlEnd = end;
+        while (urlStart < urlEnd && *urlStart == ' ') {
+          urlStart++;
+        }
+        while (urlEnd > urlStart && urlEnd[-1] == ' ') {
+          urlEnd--;
+        }
+        if (parseUrl(urlStart, urlEnd - urlStart, &servers[serverCount])) {
+          serverCount++;
+        }
+
+        start = *end == ',' ? end + 1 : end;
+      }
+
+      // First selection starts from the first server
+      current = serverCount > 0 ? serverCount - 1 : 0;
+      return serverCount;
+    }
+
+    /**
+     * Returns selection score of a broker, lower is better
+     *
+     * @param index broker index
+     * @param now current time in milliseconds
+     * @return score
+     */
+    uint32_t getScore(uint8_t index, unsigned long now) {
+      const MqttServer &server = servers[index];
+      uint32_t score = server.succeeded ? server.latencyMs : unknownLatencyMs;
+      if (server.consecutiveFailures == 0) {
+        return score;
+      }
+
+      score += server.consecutiveFailures * failurePenaltyMs;
+      uint32_t sinceFailure = now - server.lastFailure;
+      uint32_t backoff = getBackoff(server);
+      if (sinceFailure < backoff) {
+        score += backedOffPenalty + backoff - sinceFailure;
+      }
+      return score;
+    }
+
+    /**
+     * Selects broker for next connection attempt
+     *
+     * @param now current time in milliseconds
+     * @return selected broker index or -1 if table is empty
+     */
+    int8_t select(unsigned long now) {
+      if (serverCount == 0) {
+        return -1;
+      }
+
+      uint8_t best = 0;
+      uint32_t bestScore = 0;
+      for (uint8_t offset = 1; offset <= serverCount; offset++) {
+        uint8_t index = (current + offset) % serverCount;
+        uint32_t score = getScore(index, now);
+        if (offset == 1 || score < bestScore) {
+          best = index;
+          bestScore = score;
+        }
+      }
+
+      current = best;
+      return best;
+    }
+
+    /**
+     * Records successful connection
+     *
+     * @param index broker index
+     * @param now current time in milliseconds
+     * @param latencyMs time taken to connect in milliseconds
+     */
+    void recordSuccess(uint8_t index, unsigned long now, uint32_t latencyMs) {
+      MqttServer &server = servers[index];
+      server.latencyMs = server.succeeded ? (server.latencyMs * 3 + latencyMs) / 4 : latencyMs;
+      server.succeeded = true;
+      server.consecutiveFailures = 0;
+      server.lastSuccess = now;
+    }
+
+    /**
+     * Records failed connection attempt and drops cached address of the broker
+     *
+     * @param index broker index
+     * @param now current time in milliseconds
+     */
+    void recordFailure(uint8_t index, unsigned long now) {
+      MqttServer &server = servers[index];
+      if (server.consecutiveFailures < UINT8_MAX) {
+        server.consecutiveFailures++;
+      }
+      server.totalFailures++;
+      server.lastFailure = now;
+      server.address = 0;
+    }
+
+    /**
+     * Returns cached address of a broker if it was resolved within DNS TTL
+     *
+     * @param index broker index
+     * @param now current time in milliseconds
+     * @param address cached IPv4 address
+     * @return whether fresh address was found
+     */
+    bool getCachedAddress(uint8_t index, unsigned long now, uint32_t *address) {
+      const MqttServer &server = servers[index];
+      if (server.address == 0 || now - server.addressResolved >= dnsTtlMs) {
+        return false;
+      }
+      *address = server.address;
+      return true;
+    }
+
+    /**
+     * Caches resolved address of a broker
+     *
+     * @param index broker index
+     * @param now current time in milliseconds
+     * @param address resolved IPv4 address
+     */
+    void setCachedAddress(uint8_t index, unsigned long now, uint32_t address) {
+      servers[index].address = address;
+      servers[index].addressResolved = now;
+    }
+
+    /**
+     * Returns broker by index
+     *
+     * @param index broker index
+     */
+    const MqttServer &getServer(uint8_t index) {
+      return servers[index];
+    }
+
+    /**
+     * Returns number of brokers in table
+     */
+    uint8_t getCount() {
+      return serverCount;
+    }
+};
+
+#endif // BROKER_TABLE_CPP
@@ -0,0 +1,267 @@
+#ifndef DELTA_PATCH_CPP
+#define DELTA_PATCH_CPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Enum for delta patch operations
+ */
+enum DeltaPatchOperation {
+  // End of patch
+  DELTA_PATCH_END = 0x00,
+  // Copy bytes from source image: source offset (u32), length (u32)
+  DELTA_PATCH_COPY = 0x01,
+  // Add bytes from patch: length (u32), bytes
+  DELTA_PATCH_ADD = 0x02
+};
+
+/**
+ * Class for applying delta patches to firmware images while the patch is streamed.
+ *
+ * Patch starts with magic "MDP1", source image length (u32) and target image length (u32),
+ * followed by COPY and ADD operations and a terminating END. Integers are little endian.
+ * Patch bytes can be fed in chunks of any size. Target image is produced in order, so it
+ * can be written directly to the inactive OTA partition. Source reader and target writer
+ * are passed to feed as callables:
+ *
+ * bool readSource(uint32_t offset, uint8_t *buffer, size_t length)
+ * bool writeTarget(const uint8_t *buffer, size_t length)
+ */
+class DeltaPatchApplier {
+
+  private:
+
+    const static size_t headerLength = 12;
+    const static size_t copyBufferSize = 256;
+
+    enum State {
+      HEADER,
+      OPERATION,
+      COPY_ARGUMENTS,
+      ADD_LENGTH,
+      ADD_DATA,
+      FINISHED,
+      FAILED
+    };
+
+    State state = HEADER;
+    bool headerRead = false;
+    uint8_t fieldBuffer[headerLength];
+    size_t fieldLength = 0;
+    uint32_t sourceLength = 0;
+    uint32_t targetLength = 0;
+    uint32_t written = 0;
+    uint32_t addRemaining = 0;
+    const char *error = NULL;
+    uint8_t copyBuffer[copyBufferSize];
+
+    /**
+     * Reads little endian 32-bit integer
+     *
+     * @param data data
+     * @return integer
+     */
+    static uint32_t readUint32(const uint8_t *data) {
+      return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+    }
+
+    /**
+     * Marks patch as failed
+     *
+     * @param message error message
+     * @return false
+     */
+    bool fail(const char *message) {
+      state = FAILED;
+      error = message;
+      return false;
+    }
+
+    /**
+     * Collects bytes of fixed length field into field buffer
+     *
+     * @param data patch data, advanced past consumed bytes
+     * @param length remaining patch data length, decreased by consumed bytes
+     * @param fieldSize field length
+     * @return whether field is complete
+     */
+    bool collectField(const uint8_t *&data, size_t &length, size_t fieldSize) {
+      size_t count = fieldSize - fieldLength;
+      if (count > length) {
+        count = length;
+      }
+      memcpy(fieldBuffer + fieldLength, data, count);
+      fieldLength += count;
+      data += count;
+      length -= count;
+
+      if (fieldLength < fieldSize) {
+        return false;
+      }
+      fieldLength = 0;
+      return true;
+    }
+
+    /**
+     * Copies bytes from source image to target image
+     *
+     * @param offset source offset
+     * @param length number of bytes
+     * @param readSource source reader
+     * @param writeTarget target writer
+     * @return whether copy succeeded
+     */
+    template <typename SourceReader, typename TargetWriter>
+    bool copy(uint32_t offset, uint32_t length, SourceReader &readSource, TargetWriter &writeTarget) {
+      if (offset > sourceLength || length > sourceLength - offset) {
+        return fail("Copy outside source image");
+      }
+      if (length > targetLength - written) {
+        return fail("Copy past target image end");
+      }
+
+      while (length > 0) {
+        size_t chunkLength = length < copyBufferSize ? length : copyBufferSize;
+        if (!readSource(offset, copyBuffer, chunkLength)) {
+          return fail("Failed to read source image");
+        }
+        if (!writeTarget(copyBuffer, chunkLength)) {
+          return fail("Failed to write target image");
+        }
+        offset += chunkLength;
+        length -= chunkLength;
+        written += chunkLength;
+      }
+      return true;
+    }
+
+  public:
+
+    /**
+     * Feeds patch bytes to the applier
+     *
+     * @param data patch data
+     * @param length patch data length
+     * @param readSource source reader
+     * @param writeTarget target writer
+     * @return false if patch is invalid or reading or writing failed
+     */
+    template <typename SourceReader, typename TargetWriter>
+    bool feed(const uint8_t *data, size_t length, SourceReader readSource, TargetWriter writeTarget) {
+      while (length > 0) {
+        switch (state) {
+        case HEADER:
+          if (collectField(data, length, headerLength)) {
+            if (memcmp(fieldBuffer, "MDP1", 4) != 0) {
+              return fail("Invalid patch header");
+            }
+            sourceLength = readUint32(fieldBuffer + 4);
+            targetLength = readUint32(fieldBuffer + 8);
+            headerRead = true;
+            state = OPERATION;
+          }
+          break;
+        case OPERATION: {
+          uint8_t operation = *data;
+          data++;
+          length--;
+          if (operation == DELTA_PATCH_END) {
+            if (written != targetLength) {
+              return fail("Patch ended before target image end");
+            }
+            state = FINISHED;
+          } else if (operation == DELTA_PATCH_COPY) {
+            state = COPY_ARGUMENTS;
+          } else if (operation == DELTA_PATCH_ADD) {
+            state = ADD_LENGTH;
+          } else {
+            return fail("Unknown patch operation");
+          }
+          break;
+        }
+        case COPY_ARGUMENTS:
+          if (collectField(data, length, 8)) {
+            if (!copy(readUint32(fieldBuffer), readUint32(fieldBuffer + 4), readSource, writeTarget)) {
+              return false;
+            }
+            state = OPERATION;
+          }
+          break;
+        case ADD_LENGTH:
+          if (collectField(data, length, 4)) {
+            addRemaining = readUint32(fieldBuffer);
+            if (addRemaining > targetLength - written) {
+              return fail("Add past target image end");
+            }
+            state = addRemaining > 0 ? ADD_DATA : OPERATION;
+          }
+          break;
+        case ADD_DATA: {
+          size_t count = addRemaining < length ? addRemaining : length;
+          if (!writeTarget(data, count)) {
+            return fail("Failed to write target image");
+          }
+          data += count;
+          length -= count;
+          written += count;
+          addRemaining -= count;
+          if (addRemaining == 0) {
+            state = OPERATION;
+          }
+          break;
+        }
+        case FINISHED:
+          return fail("Data after patch end");
+        case FAILED:
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Returns whether header has been read and image lengths are known
+     */
+    bool hasHeader() {
+      return headerRead;
+    }
+
+    /**
+     * Returns source image length declared in the patch
+     */
+    uint32_t getSourceLength() {
+      return sourceLength;
+    }
+
+    /**
+     * Returns target image length declared in the patch
+     */
+    uint32_t getTargetLength() {
+      return targetLength;
+    }
+
+    /**
+     * Returns number of target bytes written
+     */
+    uint32_t getWritten() {
+      return written;
+    }
+
+    /**
+     * Returns whether whole patch has been applied
+     */
+    bool isFinished() {
+      return state == FINISHED;
+    }
+
+    /**
+     * Returns error message or NULL if patch has not failed
+     */
+    const char *getError() {
+      return error;
+    }
+};
+
+#endif // DELTA_PATCH_CPP
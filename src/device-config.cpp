@@ -0,0 +1,300 @@
+#include <Preferences.h>
+#include "device-config.h"
+#include "logger.h"
+
+#define DEVICE_CONFIG_NAMESPACE "config"
+#define DEVICE_CONFIG_KEY "json"
+// Keys are copied from the payload, so every field takes its key length on top of the slot
+#define DEVICE_CONFIG_DOCUMENT_SIZE 1024
+
+/**
+ * Returns default configuration
+ */
+DeviceConfig getDefaultDeviceConfig() {
+  DeviceConfig config = {};
+  config.version = DEVICE_CONFIG_SCHEMA_VERSION;
+  config.flushIntervalMs = MQTT_FLUSH_INTERVAL_MS;
+  config.tagDisappearedTimeoutMs = TAG_DISAPPEARED_TIMEOUT_MS;
+  config.antennaIdleTimeMs = ANTENNA_IDLE_TIME_MS;
+  config.antennaMask = ANTENNA_MASK;
+  config.inventoryMode = INVENTORY_MODE;
+  config.timeFrameWindowMs = TIME_FRAME_INVENTORY_WINDOW_MS;
+  config.reportMode = REPORT_MODE;
+  config.zoneHysteresis = ZONE_HYSTERESIS;
+  config.publishWindow = MQTT_PUBLISH_WINDOW;
+  config.readTid = READ_TID;
+  config.readStatistics = READ_STATISTICS;
+  config.internTags = INTERN_TAGS;
+  config.adaptiveTimeout = ADAPTIVE_TIMEOUT;
+  config.minTagDisappearedTimeoutMs = MIN_TAG_DISAPPEARED_TIMEOUT_MS;
+  config.maxTagDisappearedTimeoutMs = MAX_TAG_DISAPPEARED_TIMEOUT_MS;
+  config.localStreamPort = LOCAL_STREAM_PORT;
+  return config;
+}
+
+/**
+ * Returns inventory mode name used in configuration messages
+ *
+ * @param mode inventory mode
+ */
+static const char *getInventoryModeName(uint8_t mode) {
+  return mode == TIME_FRAME_INVENTORY_MODE ? "time-frame" : "continuous";
+}
+
+/**
+ * Returns report mode name used in configuration messages
+ *
+ * @param mode report mode
+ */
+static const char *getReportModeName(uint8_t mode) {
+  return mode == ZONE_REPORT_MODE ? "zone" : "antenna";
+}
+
+/**
+ * Validates configuration
+ *
+ * @param config configuration
+ * @return error message or NULL if configuration is valid
+ */
+static const char *validateDeviceConfig(const DeviceConfig &config) {
+  if (config.flushIntervalMs < 10 || config.flushIntervalMs > 10000) {
+    return "flushIntervalMs must be between 10 and 10000";
+  }
+  if (config.tagDisappearedTimeoutMs < 200 || config.tagDisappearedTimeoutMs > 60000) {
+    return "tagDisappearedTimeoutMs must be between 200 and 60000";
+  }
+  if (config.tagDisappearedTimeoutMs <= config.flushIntervalMs) {
+    return "tagDisappearedTimeoutMs must be longer than flushIntervalMs";
+  }
+  if (config.minTagDisappearedTimeoutMs < 50 || config.minTagDisappearedTimeoutMs > 60000) {
+    return "minTagDisappearedTimeoutMs must be between 50 and 60000";
+  }
+  if (config.maxTagDisappearedTimeoutMs < config.minTagDisappearedTimeoutMs || config.maxTagDisappearedTimeoutMs > 60000) {
+    return "maxTagDisappearedTimeoutMs must be between minTagDisappearedTimeoutMs and 60000";
+  }
+  if (config.antennaMask == 0) {
+    return "antennaMask must enable at least one antenna";
+  }
+  if (config.timeFrameWindowMs < 50 || config.timeFrameWindowMs > 10000) {
+    return "timeFrameWindowMs must be between 50 and 10000";
+  }
+  if (config.inventoryMode == TIME_FRAME_INVENTORY_MODE && config.timeFrameWindowMs >= config.tagDisappearedTimeoutMs) {
+    return "timeFrameWindowMs must be shorter than tagDisappearedTimeoutMs";
+  }
+  if (config.reportMode != ANTENNA_REPORT_MODE && config.reportMode != ZONE_REPORT_MODE) {
+    return "reportMode must be antenna or zone";
+  }
+  if (config.zoneHysteresis > 50) {
+    return "zoneHysteresis must be between 0 and 50";
+  }
+  if (config.publishWindow > 32) {
+    return "publishWindow must be between 0 and 32";
+  }
+  return NULL;
+}
+
+/**
+ * Reads configuration field from message. Field missing from the message keeps its value
+ *
+ * @param doc configuration message
+ * @param key field name
+ * @param value field value, updated if the field is present
+ * @return false if the field is present but has wrong type or does not fit the value
+ */
+template <typename T>
+static bool readConfigField(JsonDocument &doc, const char *key, T *value) {
+  JsonVariant field = doc[key];
+  if (field.isNull()) {
+    return true;
+  }
+  if (!field.is<T>()) {
+    LOG_WARNING("Invalid configuration: %s has wrong type or is out of range", key);
+    return false;
+  }
+  *value = field.as<T>();
+  return true;
+}
+
+/**
+ * Parses configuration message. Fields missing from the message keep their current values. Example payload:
+ * { "version": 1, "flushIntervalMs": 100, "tagDisappearedTimeoutMs": 1500, "antennaIdleTimeMs": 50,
+ *   "antennaMask": 15, "inventoryMode": "continuous", "timeFrameWindowMs": 500, "reportMode": "zone",
+ *   "zoneHysteresis": 6, "publishWindow": 16, "readTid": false, "readStatistics": true,
+ *   "internTags": true, "adaptiveTimeout": true, "minTagDisappearedTimeoutMs": 300, "maxTagDisappearedTimeoutMs": 5000,
+ *   "localStreamPort": 8080 }
+ *
+ * @param payload MQTT message payload
+ * Message is rejected if a field has wrong type or a value that does not fit the field.
+ *
+ * @param config current configuration, updated only if the message is valid
+ * @return whether configuration was valid
+ */
+bool parseDeviceConfig(const String &payload, DeviceConfig *config) {
+  StaticJsonDocument<DEVICE_CONFIG_DOCUMENT_SIZE> doc;
+  if (deserializeJson(doc, payload)) {
+    LOG_WARNING("Invalid configuration message");
+    return false;
+  }
+
+  uint16_t version = doc["version"] | 0;
+  if (version != DEVICE_CONFIG_SCHEMA_VERSION) {
+    LOG_WARNING("Unsupported configuration version: %u", version);
+    return false;
+  }
+
+  DeviceConfig result = *config;
+  result.version = version;
+  const char *inventoryMode = getInventoryModeName(result.inventoryMode);
+  const char *reportMode = getReportModeName(result.reportMode);
+  bool typesValid = (
+    readConfigField(doc, "flushIntervalMs", &result.flushIntervalMs) &&
+    readConfigField(doc, "tagDisappearedTimeoutMs", &result.tagDisappearedTimeoutMs) &&
+    readConfigField(doc, "antennaIdleTimeMs", &result.antennaIdleTimeMs) &&
+    readConfigField(doc, "antennaMask", &result.antennaMask) &&
+    readConfigField(doc, "timeFrameWindowMs", &result.timeFrameWindowMs) &&
+    readConfigField(doc, "zoneHysteresis", &result.zoneHysteresis) &&
+    readConfigField(doc, "publishWindow", &result.publishWindow) &&
+    readConfigField(doc, "readTid", &result.readTid) &&
+    readConfigField(doc, "readStatistics", &result.readStatistics) &&
+    readConfigField(doc, "internTags", &result.internTags) &&
+    readConfigField(doc, "adaptiveTimeout", &result.adaptiveTimeout) &&
+    readConfigField(doc, "minTagDisappearedTimeoutMs", &result.minTagDisappearedTimeoutMs) &&
+    readConfigField(doc, "maxTagDisappearedTimeoutMs", &result.maxTagDisappearedTimeoutMs) &&
+    readConfigField(doc, "localStreamPort", &result.localStreamPort) &&
+    readConfigField(doc, "inventoryMode", &inventoryMode) &&
+    readConfigField(doc, "reportMode", &reportMode)
+  );
+  if (!typesValid) {
+    return false;
+  }
+
+  if (strcmp(inventoryMode, "continuous") == 0) {
+    result.inventoryMode = CONTINUOUS_INVENTORY_MODE;
+  } else if (strcmp(inventoryMode, "time-frame") == 0) {
+    result.inventoryMode = TIME_FRAME_INVENTORY_MODE;
+  } else {
+    LOG_WARNING("Invalid configuration: unknown inventoryMode");
+    return false;
+  }
+
+  if (strcmp(reportMode, "antenna") == 0) {
+    result.reportMode = ANTENNA_REPORT_MODE;
+  } else if (strcmp(reportMode, "zone") == 0) {
+    result.reportMode = ZONE_REPORT_MODE;
+  } else {
+    LOG_WARNING("Invalid configuration: unknown reportMode");
+    return false;
+  }
+
+  const char *error = validateDeviceConfig(result);
+  if (error != NULL) {
+    LOG_WARNING("Invalid configuration: %s", error);
+    return false;
+  }
+
+  *config = result;
+  return true;
+}
+
+/**
+ * Checks whether configuration change requires reader to be reinitialized
+ *
+ * @param current current configuration
+ * @param updated updated configuration
+ */
+bool readerSettingsChanged(const DeviceConfig &current, const DeviceConfig &updated) {
+  return (
+    current.antennaIdleTimeMs != updated.antennaIdleTimeMs ||
+    current.antennaMask != updated.antennaMask ||
+    current.inventoryMode != updated.inventoryMode ||
+    current.timeFrameWindowMs != updated.timeFrameWindowMs ||
+    current.readTid != updated.readTid
+  );
+}
+
+/**
+ * Checks whether configurations differ in any field
+ *
+ * @param current current configuration
+ * @param updated updated configuration
+ */
+bool deviceConfigChanged(const DeviceConfig &current, const DeviceConfig &updated) {
+  return (
+    current.version != updated.version ||
+    current.flushIntervalMs != updated.flushIntervalMs ||
+    current.tagDisappearedTimeoutMs != updated.tagDisappearedTimeoutMs ||
+    readerSettingsChanged(current, updated) ||
+    current.reportMode != updated.reportMode ||
+    current.zoneHysteresis != updated.zoneHysteresis ||
+    current.publishWindow != updated.publishWindow ||
+    current.readStatistics != updated.readStatistics ||
+    current.internTags != updated.internTags ||
+    current.adaptiveTimeout != updated.adaptiveTimeout ||
+    current.minTagDisappearedTimeoutMs != updated.minTagDisappearedTimeoutMs ||
+    current.maxTagDisappearedTimeoutMs != updated.maxTagDisappearedTimeoutMs ||
+    current.localStreamPort != updated.localStreamPort
+  );
+}
+
+/**
+ * Serializes configuration to JSON object
+ *
+ * @param config configuration
+ * @param object target JSON object
+ */
+void serializeDeviceConfig(const DeviceConfig &config, JsonObject object) {
+  object["version"] = config.version;
+  object["flushIntervalMs"] = config.flushIntervalMs;
+  object["tagDisappearedTimeoutMs"] = config.tagDisappearedTimeoutMs;
+  object["antennaIdleTimeMs"] = config.antennaIdleTimeMs;
+  object["antennaMask"] = config.antennaMask;
+  object["inventoryMode"] = getInventoryModeName(config.inventoryMode);
+  object["timeFrameWindowMs"] = config.timeFrameWindowMs;
+  object["reportMode"] = getReportModeName(config.reportMode);
+  object["zoneHysteresis"] = config.zoneHysteresis;
+  object["publishWindow"] = config.publishWindow;
+  object["readTid"] = config.readTid;
+  object["readStatistics"] = config.readStatistics;
+  object["internTags"] = config.internTags;
+  object["adaptiveTimeout"] = config.adaptiveTimeout;
+  object["minTagDisappearedTimeoutMs"] = config.minTagDisappearedTimeoutMs;
+  object["maxTagDisappearedTimeoutMs"] = config.maxTagDisappearedTimeoutMs;
+  object["localStreamPort"] = config.localStreamPort;
+}
+
+/**
+ * Loads configuration from NVS. Configuration is stored as the JSON sent in configuration messages, so
+ * fields added by newer firmware keep their default values. Defaults are used if nothing valid has been stored
+ *
+ * @param config loaded configuration
+ */
+void loadDeviceConfig(DeviceConfig *config) {
+  Preferences preferences;
+  *config = getDefaultDeviceConfig();
+
+  preferences.begin(DEVICE_CONFIG_NAMESPACE, true);
+  String stored = preferences.getString(DEVICE_CONFIG_KEY);
+  preferences.end();
+
+  DeviceConfig parsed = getDefaultDeviceConfig();
+  if (stored.length() > 0 && parseDeviceConfig(stored, &parsed)) {
+    *config = parsed;
+  }
+}
+
+/**
+ * Stores configuration to NVS as JSON
+ *
+ * @param config configuration to store
+ */
+void saveDeviceConfig(const DeviceConfig &config) {
+  StaticJsonDocument<DEVICE_CONFIG_DOCUMENT_SIZE> doc;
+  serializeDeviceConfig(config, doc.to<JsonObject>());
+  String payload;
+  serializeJson(doc, payload);
+
+  Preferences preferences;
+  preferences.begin(DEVICE_CONFIG_NAMESPACE, false);
+  preferences.putString(DEVICE_CONFIG_KEY, payload);
+  preferences.end();
+}
@@ -0,0 +1,91 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define DEVICE_CONFIG_SCHEMA_VERSION 1
+
+// Defaults used until configuration is received over MQTT
+#define MQTT_FLUSH_INTERVAL_MS 100
+#define TAG_DISAPPEARED_TIMEOUT_MS 1500
+// Bounds of per tag timeout derived from read interval, disappeared timeout is used until enough reads are seen
+#define ADAPTIVE_TIMEOUT true
+#define MIN_TAG_DISAPPEARED_TIMEOUT_MS 300
+#define MAX_TAG_DISAPPEARED_TIMEOUT_MS 5000
+#define TIME_FRAME_INVENTORY_WINDOW_MS 500
+#define ANTENNA_IDLE_TIME_MS 50
+#define ANTENNA_MASK 0x000F
+// Strength difference (0-100 scale, 2 per dB) needed to move tag zone to another antenna
+#define ZONE_HYSTERESIS 6
+// Antenna messages waiting for PUBACK at once, 0 publishes them with QoS 0
+#define MQTT_PUBLISH_WINDOW 16
+// Whether reader reports TID of every tag with its EPC
+#define READ_TID false
+// Whether strength updates carry statistics of the reads coalesced into them
+#define READ_STATISTICS false
+// Whether antenna messages identify tags with session ids instead of EPC
+#define INTERN_TAGS false
+// TCP port of local event stream for clients on the same network, 0 turns the stream off
+#define LOCAL_STREAM_PORT 0
+
+/**
+ * Enum for reader inventory modes
+ */
+enum InventoryMode {
+  // Reader streams a frame for every tag read
+  CONTINUOUS_INVENTORY_MODE,
+  // Reader deduplicates reads within a time frame and results are fetched in bulk
+  TIME_FRAME_INVENTORY_MODE
+};
+
+#ifndef INVENTORY_MODE
+#define INVENTORY_MODE CONTINUOUS_INVENTORY_MODE
+#endif
+
+/**
+ * Enum for tag report modes
+ */
+enum ReportMode {
+  // Tags are reported on every antenna that sees them
+  ANTENNA_REPORT_MODE,
+  // Tags are reported only on the antenna that sees them strongest, with hysteresis
+  ZONE_REPORT_MODE
+};
+
+#ifndef REPORT_MODE
+#define REPORT_MODE ANTENNA_REPORT_MODE
+#endif
+
+/**
+ * Struct for runtime configuration
+ */
+struct DeviceConfig {
+  uint16_t version;
+  uint32_t flushIntervalMs;
+  uint32_t tagDisappearedTimeoutMs;
+  uint16_t antennaIdleTimeMs;
+  uint16_t antennaMask;
+  uint8_t inventoryMode;
+  uint16_t timeFrameWindowMs;
+  uint8_t reportMode;
+  uint8_t zoneHysteresis;
+  uint8_t publishWindow;
+  bool readTid;
+  bool readStatistics;
+  bool internTags;
+  bool adaptiveTimeout;
+  uint32_t minTagDisappearedTimeoutMs;
+  uint32_t maxTagDisappearedTimeoutMs;
+  uint16_t localStreamPort;
+};
+
+DeviceConfig getDefaultDeviceConfig();
+bool parseDeviceConfig(const String &payload, DeviceConfig *config);
+bool readerSettingsChanged(const DeviceConfig &current, const DeviceConfig &updated);
+bool deviceConfigChanged(const DeviceConfig &current, const DeviceConfig &updated);
+void serializeDeviceConfig(const DeviceConfig &config, JsonObject object);
+void loadDeviceConfig(DeviceConfig *config);
+void saveDeviceConfig(const DeviceConfig &config);
+
+#endif // DEVICE_CONFIG_H
@@ -0,0 +1,330 @@
+#ifndef EPC_FILTER_CPP
+#define EPC_FILTER_CPP
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "./types/tag-id.h"
+
+/**
+ * Enum for EPC filter modes
+ */
+enum EpcFilterMode {
+  // Every tag is accepted
+  EPC_FILTER_DISABLED,
+  // Only listed tags are accepted
+  EPC_FILTER_ALLOW,
+  // Listed tags are rejected
+  EPC_FILTER_DENY
+};
+
+/**
+ * Class for on-device EPC allow/deny set.
+ *
+ * EPCs are stored as 32-bit fingerprints split into 256 buckets by their top byte. Each bucket keeps
+ * the low 24 bits of its fingerprints sorted, 3 bytes per EPC, and membership is checked with a binary
+ * search inside the bucket. Unlisted EPC shares a fingerprint with a listed one with probability of
+ * size / 2^32, so 1000 EPCs fit in about 3.5 KB and 10k EPCs in about 30 KB with a collision chance
+ * of 2.3e-6 per distinct tag. Set is encoded to the same layout for storing it to NVS.
+ */
+class EpcFilter {
+
+  public:
+
+    const static uint16_t bucketCount = 256;
+    const static uint16_t maxSize = 65535;
+    const static uint8_t entryLength = 3;
+    const static size_t encodedHeaderLength = 1 + (bucketCount + 1) * sizeof(uint16_t);
+
+  private:
+
+    EpcFilterMode mode = EPC_FILTER_DISABLED;
+    // Index of the first entry of every bucket, last value is the number of entries
+    uint16_t bucketStarts[bucketCount + 1] = {};
+    std::vector<uint8_t> entries;
+
+    /**
+     * Returns low 24 bits of fingerprint stored in given entry
+     *
+     * @param index entry index
+     * @return stored fingerprint bits
+     */
+    uint32_t getEntry(uint32_t index) {
+      const uint8_t *entry = &entries[index * entryLength];
+      return ((uint32_t) entry[0] << 16) | ((uint32_t) entry[1] << 8) | entry[2];
+    }
+
+    /**
+     * Checks fingerprint from the set
+     *
+     * @param value EPC fingerprint
+     * @return whether fingerprint is in the set
+     */
+    bool containsFingerprint(uint32_t value) {
+      uint32_t bucket = value >> 24;
+      uint32_t remainder = value & 0xFFFFFF;
+      uint32_t low = bucketStarts[bucket];
+      uint32_t high = bucketStarts[bucket + 1];
+      while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        uint32_t entry = getEntry(middle);
+        if (entry == remainder) {
+          return true;
+        }
+        if (entry < remainder) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * Checks whether fingerprint passes the filter
+     *
+     * @param value EPC fingerprint
+     * @return whether tag should be processed
+     */
+    bool acceptsFingerprint(uint32_t value) {
+      switch (mode) {
+      case EPC_FILTER_ALLOW:
+        return containsFingerprint(value);
+      case EPC_FILTER_DENY:
+        return !containsFingerprint(value);
+      default:
+        return true;
+      }
+    }
+
+    /**
+     * Returns every fingerprint of the set in sorted order
+     *
+     * @param fingerprints vector to fill
+     */
+    void getFingerprints(std::vector<uint32_t> &fingerprints) {
+      fingerprints.clear();
+      fingerprints.reserve(size());
+      for (uint32_t bucket = 0; bucket < bucketCount; bucket++) {
+        for (uint32_t i = bucketStarts[bucket]; i < bucketStarts[bucket + 1]; i++) {
+          fingerprints.push_back((bucket << 24) | getEntry(i));
+        }
+      }
+    }
+
+    /**
+     * Replaces the set with given sorted and unique fingerprints
+     *
+     * @param fingerprints fingerprints, at most maxSize
+     */
+    void setFingerprints(const std::vector<uint32_t> &fingerprints) {
+      entries.assign(fingerprints.size() * entryLength, 0);
+      entries.shrink_to_fit();
+      uint32_t bucket = 0;
+      for (uint32_t i = 0; i < fingerprints.size(); i++) {
+        while (bucket <= fingerprints[i] >> 24) {
+          bucketStarts[bucket++] = i;
+        }
+        entries[i * entryLength] = fingerprints[i] >> 16;
+        entries[i * entryLength + 1] = fingerprints[i] >> 8;
+        entries[i * entryLength + 2] = fingerprints[i];
+      }
+      while (bucket <= bucketCount) {
+        bucketStarts[bucket++] = fingerprints.size();
+      }
+    }
+
+  public:
+
+    /**
+     * Calculates fingerprint of hex EPC by folding its 64-bit FNV-1a hash. Hex digits are case insensitive
+     *
+     * @param epc EPC as hex string
+     * @return EPC fingerprint
+     */
+    static uint32_t fingerprint(const std::string &epc) {
+      uint64_t hash = 0xcbf29ce484222325ULL;
+      for (char c : epc) {
+        if (c >= 'A' && c <= 'F') {
+          c = c - 'A' + 'a';
+        }
+        hash ^= (uint8_t) c;
+        hash *= 0x100000001b3ULL;
+      }
+      return (uint32_t) (hash ^ (hash >> 32));
+    }
+
+    /**
+     * Calculates fingerprint of tag EPC. Hash is taken over the lowercase hex digits of the EPC bytes,
+     * so it matches the fingerprint of the same EPC given as hex string. TID is not part of the fingerprint
+     *
+     * @param id tag id
+     * @return EPC fingerprint
+     */
+    static uint32_t fingerprint(const TagId &id) {
+      static const char digits[] = "0123456789abcdef";
+      uint64_t hash = 0xcbf29ce484222325ULL;
+      for (uint8_t i = 0; i < id.epcLength; i++) {
+        hash ^= (uint8_t) digits[id.epc[i] >> 4];
+        hash *= 0x100000001b3ULL;
+        hash ^= (uint8_t) digits[id.epc[i] & 0x0F];
+        hash *= 0x100000001b3ULL;
+      }
+      return (uint32_t) (hash ^ (hash >> 32));
+    }
+
+    /**
+     * Sets filter mode
+     *
+     * @param value filter mode
+     */
+    void setMode(EpcFilterMode value) {
+      mode = value;
+    }
+
+    /**
+     * Returns filter mode
+     */
+    EpcFilterMode getMode() {
+      return mode;
+    }
+
+    /**
+     * Returns number of EPCs in the set
+     */
+    size_t size() {
+      return bucketStarts[bucketCount];
+    }
+
+    /**
+     * Returns memory used by the set in bytes
+     */
+    size_t memoryUsage() {
+      return sizeof(bucketStarts) + entries.capacity();
+    }
+
+    /**
+     * Removes all EPCs from the set
+     */
+    void clear() {
+      setFingerprints({});
+    }
+
+    /**
+     * Applies batch of additions and removals to the set. Set is left unchanged if it would grow
+     * over maxSize EPCs
+     *
+     * @param added EPCs to add
+     * @param removed EPCs to remove
+     * @param clear whether the batch replaces the set instead of changing it
+     * @return whether batch was applied
+     */
+    bool update(const std::vector<std::string> &added, const std::vector<std::string> &removed, bool clear = false) {
+      std::vector<uint32_t> fingerprints;
+      if (!clear) {
+        getFingerprints(fingerprints);
+      }
+      for (const std::string &epc : added) {
+        fingerprints.push_back(fingerprint(epc));
+      }
+
+      std::sort(fingerprints.begin(), fingerprints.end());
+      fingerprints.erase(std::unique(fingerprints.begin(), fingerprints.end()), fingerprints.end());
+
+      for (const std::string &epc : removed) {
+        uint32_t value = fingerprint(epc);
+        auto found = std::lower_bound(fingerprints.begin(), fingerprints.end(), value);
+        if (found != fingerprints.end() && *found == value) {
+          fingerprints.erase(found);
+        }
+      }
+
+      if (fingerprints.size() > maxSize) {
+        return false;
+      }
+      setFingerprints(fingerprints);
+      return true;
+    }
+
+    /**
+     * Encodes mode and the set for storing. Encoded set is the mode byte, big endian bucket starts
+     * and the entries as they are kept in memory
+     *
+     * @param buffer buffer to fill
+     */
+    void encode(std::vector<uint8_t> &buffer) {
+      buffer.assign(encodedHeaderLength + entries.size(), 0);
+      buffer[0] = mode;
+      for (uint16_t i = 0; i <= bucketCount; i++) {
+        buffer[1 + i * 2] = bucketStarts[i] >> 8;
+        buffer[2 + i * 2] = bucketStarts[i] & 0xFF;
+      }
+      if (!entries.empty()) {
+        memcpy(&buffer[encodedHeaderLength], entries.data(), entries.size());
+      }
+    }
+
+    /**
+     * Restores mode and the set from encoded buffer. Filter is left unchanged if buffer is not valid
+     *
+     * @param buffer encoded filter
+     * @param length buffer length
+     * @return whether filter was restored
+     */
+    bool decode(const uint8_t *buffer, size_t length) {
+      if (length < encodedHeaderLength || buffer[0] > EPC_FILTER_DENY) {
+        return false;
+      }
+
+      uint16_t starts[bucketCount + 1];
+      for (uint16_t i = 0; i <= bucketCount; i++) {
+        starts[i] = (buffer[1 + i * 2] << 8) | buffer[2 + i * 2];
+        if (i == 0 ? starts[i] != 0 : starts[i] < starts[i - 1]) {
+          return false;
+        }
+      }
+      if ((size_t) starts[bucketCount] * entryLength != length - encodedHeaderLength) {
+        return false;
+      }
+
+      mode = (EpcFilterMode) buffer[0];
+      memcpy(bucketStarts, starts, sizeof(bucketStarts));
+      entries.assign(buffer + encodedHeaderLength, buffer + length);
+      entries.shrink_to_fit();
+      return true;
+    }
+
+    /**
+     * Checks whether EPC is in the set
+     *
+     * @param epc EPC as hex string
+     * @return whether EPC is in the set
+     */
+    bool contains(const std::string &epc) {
+      return containsFingerprint(fingerprint(epc));
+    }
+
+    /**
+     * Checks whether tag with given EPC passes the filter
+     *
+     * @param epc EPC as hex string
+     * @return whether tag should be processed
+     */
+    bool accepts(const std::string &epc) {
+      return mode == EPC_FILTER_DISABLED || acceptsFingerprint(fingerprint(epc));
+    }
+
+    /**
+     * Checks whether tag passes the filter by its EPC
+     *
+     * @param id tag id
+     * @return whether tag should be processed
+     */
+    bool accepts(const TagId &id) {
+      return mode == EPC_FILTER_DISABLED || acceptsFingerprint(fingerprint(id));
+    }
+};
+
+#endif // EPC_FILTER_CPP
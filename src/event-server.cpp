@@ -0,0 +1,162 @@
+#include <lwip/sockets.h>
+#include <errno.h>
+#include "event-server.h"
+#include "event-stream.cpp"
+#include "logger.h"
+
+#define EVENT_SERVER_BACKLOG 2
+#define EVENT_SERVER_READ_CHUNK_SIZE 256
+
+static EventStream eventStream;
+static int serverSocket = -1;
+// Socket of each client slot of the event stream
+static int clientSockets[EventStream::maxClients];
+
+/**
+ * Sets socket non-blocking so that a slow or silent client never blocks the main loop
+ *
+ * @param socket socket
+ */
+static void setNonBlocking(int socket) {
+  int flags = fcntl(socket, F_GETFL, 0);
+  fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Closes client connection and frees its socket slot
+ *
+ * @param connection client socket
+ */
+static void closeClient(int connection) {
+  for (uint8_t i = 0; i < EventStream::maxClients; i++) {
+    if (clientSockets[i] == connection) {
+      clientSockets[i] = -1;
+    }
+  }
+  close(connection);
+}
+
+/**
+ * Starts listening for event stream clients on all interfaces
+ *
+ * @param port TCP port
+ */
+void startEventServer(uint16_t port) {
+  stopEventServer();
+
+  serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (serverSocket < 0) {
+    LOG_WARNING("Could not create event server socket");
+    return;
+  }
+
+  int reuse = 1;
+  setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(serverSocket, (sockaddr *) &address, sizeof(address)) != 0 || listen(serverSocket, EVENT_SERVER_BACKLOG) != 0) {
+    LOG_WARNING("Could not listen on event server port %u", port);
+    close(serverSocket);
+    serverSocket = -1;
+    return;
+  }
+  setNonBlocking(serverSocket);
+
+  for (uint8_t i = 0; i < EventStream::maxClients; i++) {
+    clientSockets[i] = -1;
+  }
+  LOG_INFO("Event server listening on port %u", port);
+}
+
+/**
+ * Stops event server and closes every client connection
+ */
+void stopEventServer() {
+  if (serverSocket < 0) {
+    return;
+  }
+  for (uint8_t i = 0; i < EventStream::maxClients; i++) {
+    if (clientSockets[i] >= 0) {
+      eventStream.disconnect(i);
+    }
+  }
+  eventStream.poll(millis(), [](int, const uint8_t *, size_t) {
+    return -1;
+  }, closeClient);
+  close(serverSocket);
+  serverSocket = -1;
+}
+
+/**
+ * Accepts new clients, reads their requests and writes queued events without blocking
+ *
+ * @param now current time in milliseconds
+ */
+void pollEventServer(unsigned long now) {
+  if (serverSocket < 0) {
+    return;
+  }
+
+  int connection = accept(serverSocket, NULL, NULL);
+  if (connection >= 0) {
+    int8_t index = eventStream.accept(connection, now);
+    if (index < 0) {
+      close(connection);
+    } else {
+      int noDelay = 1;
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+      setNonBlocking(connection);
+      clientSockets[index] = connection;
+    }
+  }
+
+  for (uint8_t i = 0; i < EventStream::maxClients; i++) {
+    if (clientSockets[i] < 0) {
+      continue;
+    }
+    uint8_t buffer[EVENT_SERVER_READ_CHUNK_SIZE];
+    int received = recv(clientSockets[i], buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received > 0) {
+      eventStream.receive(i, buffer, received);
+    } else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      eventStream.disconnect(i);
+    }
+  }
+
+  eventStream.poll(now, [](int connection, const uint8_t *data, size_t length) {
+    int written = send(connection, data, length, MSG_DONTWAIT);
+    if (written < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    return written;
+  }, closeClient);
+}
+
+/**
+ * Queues tag event to every event stream client
+ *
+ * @param id tag id
+ * @param strength signal strength, 0 for disappearance
+ * @param antenna antenna id
+ */
+void publishLocalEvent(const TagId &id, double strength, uint16_t antenna) {
+  if (serverSocket >= 0) {
+    eventStream.publish(id, strength, antenna);
+  }
+}
+
+/**
+ * Returns number of clients receiving events
+ */
+uint8_t getEventClientCount() {
+  return eventStream.getClientCount();
+}
+
+/**
+ * Returns number of clients dropped because they could not keep up with events
+ */
+uint32_t getEventClientDropCount() {
+  return eventStream.getDroppedCount();
+}
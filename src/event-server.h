@@ -0,0 +1,14 @@
+#ifndef EVENT_SERVER_H
+#define EVENT_SERVER_H
+
+#include <Arduino.h>
+#include "./types/tag-id.h"
+
+void startEventServer(uint16_t port);
+void stopEventServer();
+void pollEventServer(unsigned long now);
+void publishLocalEvent(const TagId &id, double strength, uint16_t antenna);
+uint8_t getEventClientCount();
+uint32_t getEventClientDropCount();
+
+#endif // EVENT_SERVER_H
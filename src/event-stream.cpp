@@ -0,0 +1,498 @@
+#ifndef EVENT_STREAM_CPP
+#define EVENT_STREAM_CPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "./types/tag-id.h"
+
+#ifndef EVENT_STREAM_MAX_CLIENTS
+#define EVENT_STREAM_MAX_CLIENTS 4
+#endif
+#ifndef EVENT_STREAM_QUEUE_SIZE
+#define EVENT_STREAM_QUEUE_SIZE 2048
+#endif
+
+/**
+ * Class for streaming tag events to clients on the local network.
+ *
+ * Clients connect over TCP and choose protocol and format with the first request line. WebSocket clients
+ * send an HTTP upgrade request, and events are sent as binary messages when the request path ends with
+ * "binary" and as JSON text messages otherwise. Plain TCP clients send "json" or "binary" line, and events
+ * are sent as newline delimited JSON or as binary records back to back. Binary record has EPC length, EPC,
+ * TID length, TID, antenna as 16-bit big endian integer and strength rounded to 0-100, 0 only for
+ * disappearance. JSON event has the fields of the MQTT message and antenna, for example:
+ * { "antenna": 1, "tag": "e2003411b802011383258566", "strength": 55.25 }
+ *
+ * Every client has a bounded queue. Client whose queue is too full to take the next event is dropped,
+ * so that a slow client never delays the other clients or the reader. Data sent by WebSocket clients
+ * after the handshake is ignored, except for a close frame. Socket I/O is left to the caller, which
+ * passes the received bytes in and gives writer and closer functions to poll.
+ */
+class EventStream {
+
+  public:
+
+    const static uint8_t maxClients = EVENT_STREAM_MAX_CLIENTS;
+    const static uint16_t queueSize = EVENT_STREAM_QUEUE_SIZE;
+    const static unsigned long handshakeTimeoutMs = 5000;
+
+  private:
+
+    const static uint8_t maxLineLength = 128;
+    const static uint8_t maxKeyLength = 32;
+    const static uint16_t maxEventLength = TAG_EPC_HEX_SIZE + TAG_TID_HEX_SIZE + 64;
+
+    enum State { FREE, HANDSHAKE, STREAMING, CLOSING };
+
+    /**
+     * Struct for connected client
+     */
+    struct Client {
+      State state;
+      int connection;
+      bool webSocket;
+      bool binary;
+      bool requestLineRead;
+      unsigned long connected;
+      char line[maxLineLength + 1];
+      uint8_t lineLength;
+      char key[maxKeyLength + 1];
+      uint8_t queue[queueSize];
+      uint16_t queueStart;
+      uint16_t queueLength;
+    };
+
+    Client clients[maxClients] = {};
+    uint32_t droppedCount = 0;
+
+    /**
+     * Calculates SHA-1 hash
+     *
+     * @param data data to hash
+     * @param length data length
+     * @param hash target buffer of 20 bytes
+     */
+    static void sha1(const uint8_t *data, size_t length, uint8_t hash[20]) {
+      uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+      uint64_t bitLength = (uint64_t) length * 8;
+      size_t paddedLength = ((length + 8) / 64 + 1) * 64;
+
+      for (size_t offset = 0; offset < paddedLength; offset += 64) {
+        uint32_t w[80];
+        for (uint8_t i = 0; i < 64; i++) {
+          size_t position = offset + i;
+          uint8_t value;
+          if (position < length) {
+            value = data[position];
+          } else if (position == length) {
+            value = 0x80;
+          } else if (position >= paddedLength - 8) {
+            value = bitLength >> ((paddedLength - 1 - position) * 8);
+          } else {
+            value = 0;
+          }
+          if (i % 4 == 0) {
+            w[i / 4] = 0;
+          }
+          w[i / 4] |= (uint32_t) value << ((3 - i % 4) * 8);
+        }
+        for (uint8_t i = 16; i < 80; i++) {
+          uint32_t value = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+          w[i] = (value << 1) | (value >> 31);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (uint8_t i = 0; i < 80; i++) {
+          uint32_t f, k;
+          if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+          } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+          } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+          } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+          }
+          uint32_t temp = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+          e = d;
+          d = c;
+          c = (b << 30) | (b >> 2);
+          b = a;
+          a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+      }
+
+      for (uint8_t i = 0; i < 20; i++) {
+        hash[i] = state[i / 4] >> ((3 - i % 4) * 8);
+      }
+    }
+
+    /**
+     * Writes bytes as base64
+     *
+     * @param data bytes to encode
+     * @param length number of bytes
+     * @param buffer target buffer of at least (length + 2) / 3 * 4 + 1 bytes
+     */
+    static void toBase64(const uint8_t *data, size_t length, char *buffer) {
+      static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+      size_t position = 0;
+      for (size_t i = 0; i < length; i += 3) {
+        uint32_t value = data[i] << 16;
+        if (i + 1 < length) {
+          value |= data[i + 1] << 8;
+        }
+        if (i + 2 < length) {
+          value |= data[i + 2];
+        }
+        buffer[position++] = digits[(value >> 18) & 0x3F];
+        buffer[position++] = digits[(value >> 12) & 0x3F];
+        buffer[position++] = i + 1 < length ? digits[(value >> 6) & 0x3F] : '=';
+        buffer[position++] = i + 2 < length ? digits[value & 0x3F] : '=';
+      }
+      buffer[position] = '\0';
+    }
+
+    /**
+     * Checks whether line starts with given prefix, ignoring case
+     *
+     * @param line line
+     * @param prefix lowercase prefix
+     */
+    static bool startsWithIgnoreCase(const char *line, const char *prefix) {
+      for (; *prefix != '\0'; line++, prefix++) {
+        if (tolower((unsigned char) *line) != *prefix) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Marks client to be closed on next poll
+     *
+     * @param client client
+     */
+    void drop(Client &client) {
+      client.state = CLOSING;
+    }
+
+    /**
+     * Adds bytes to client queue
+     *
+     * @param client client
+     * @param data bytes to add
+     * @param length number of bytes
+     * @return whether bytes fit to the queue
+     */
+    bool enqueue(Client &client, const uint8_t *data, size_t length) {
+      if (client.queueLength + length > queueSize) {
+        return false;
+      }
+      for (size_t i = 0; i < length; i++) {
+        client.queue[(client.queueStart + client.queueLength + i) % queueSize] = data[i];
+      }
+      client.queueLength += length;
+      return true;
+    }
+
+    /**
+     * Queues WebSocket handshake response and starts streaming to the client
+     *
+     * @param client client
+     */
+    void acceptWebSocket(Client &client) {
+      static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+      char input[maxKeyLength + sizeof(guid)];
+      snprintf(input, sizeof(input), "%s%s", client.key, guid);
+      uint8_t hash[20];
+      sha1((const uint8_t *) input, strlen(input), hash);
+      char accept[29];
+      toBase64(hash, sizeof(hash), accept);
+
+      char response[160];
+      int length = snprintf(
+        response,
+        sizeof(response),
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n",
+        accept
+      );
+      enqueue(client, (const uint8_t *) response, length);
+      client.state = STREAMING;
+    }
+
+    /**
+     * Handles complete request line or header line of a client
+     *
+     * @param client client
+     */
+    void handleLine(Client &client) {
+      char *line = client.line;
+      if (client.lineLength > 0 && line[client.lineLength - 1] == '\r') {
+        line[client.lineLength - 1] = '\0';
+      }
+
+      if (!client.requestLineRead) {
+        client.requestLineRead = true;
+        if (strncmp(line, "GET ", 4) == 0) {
+          char *path = line + 4;
+          char *pathEnd = strchr(path, ' ');
+          size_t pathLength = pathEnd != NULL ? pathEnd - path : strlen(path);
+          client.webSocket = true;
+          client.binary = pathLength >= 6 && strncmp(path + pathLength - 6, "binary", 6) == 0;
+        } else if (strcmp(line, "json") == 0 || strcmp(line, "binary") == 0) {
+          client.binary = strcmp(line, "binary") == 0;
+          client.state = STREAMING;
+        } else {
+          drop(client);
+        }
+        return;
+      }
+
+      if (startsWithIgnoreCase(line, "sec-websocket-key:")) {
+        char *key = line + 18;
+        while (*key == ' ') {
+          key++;
+        }
+        strncpy(client.key, key, maxKeyLength);
+        client.key[maxKeyLength] = '\0';
+      } else if (line[0] == '\0') {
+        if (client.key[0] == '\0') {
+          drop(client);
+          return;
+        }
+        acceptWebSocket(client);
+      }
+    }
+
+    /**
+     * Writes WebSocket frame header
+     *
+     * @param header target buffer of 4 bytes
+     * @param binary whether frame is binary or text
+     * @param length payload length
+     * @return header length
+     */
+    static uint8_t writeFrameHeader(uint8_t *header, bool binary, size_t length) {
+      header[0] = binary ? 0x82 : 0x81;
+      if (length < 126) {
+        header[1] = length;
+        return 2;
+      }
+      header[1] = 126;
+      header[2] = length >> 8;
+      header[3] = length & 0xFF;
+      return 4;
+    }
+
+    /**
+     * Queues encoded event to client. Client is dropped if the event does not fit its queue
+     *
+     * @param client client
+     * @param event encoded event
+     * @param length event length
+     */
+    void queueEvent(Client &client, const uint8_t *event, size_t length) {
+      uint8_t header[4];
+      uint8_t headerLength = 0;
+      if (client.webSocket) {
+        headerLength = writeFrameHeader(header, client.binary, length);
+      }
+      if (client.queueLength + headerLength + length > queueSize) {
+        droppedCount++;
+        drop(client);
+        return;
+      }
+      enqueue(client, header, headerLength);
+      enqueue(client, event, length);
+    }
+
+  public:
+
+    /**
+     * Takes new connection as a client
+     *
+     * @param connection connection handle given back to writer and closer
+     * @param now current time in milliseconds
+     * @return client index or -1 if every client slot is taken
+     */
+    int8_t accept(int connection, unsigned long now) {
+      for (uint8_t i = 0; i < maxClients; i++) {
+        Client &client = clients[i];
+        if (client.state != FREE) {
+          continue;
+        }
+        client.state = HANDSHAKE;
+        client.connection = connection;
+        client.webSocket = false;
+        client.binary = false;
+        client.requestLineRead = false;
+        client.connected = now;
+        client.lineLength = 0;
+        client.key[0] = '\0';
+        client.queueStart = 0;
+        client.queueLength = 0;
+        return i;
+      }
+      return -1;
+    }
+
+    /**
+     * Handles bytes received from a client
+     *
+     * @param index client index
+     * @param data received bytes
+     * @param length number of received bytes
+     */
+    void receive(int8_t index, const uint8_t *data, size_t length) {
+      Client &client = clients[index];
+      if (client.state == STREAMING) {
+        // Close frame of the WebSocket client, anything else is ignored
+        if (client.webSocket && length > 0 && (data[0] & 0x0F) == 0x08) {
+          drop(client);
+        }
+        return;
+      }
+
+      for (size_t i = 0; i < length && client.state == HANDSHAKE; i++) {
+        if (data[i] == '\n') {
+          client.line[client.lineLength] = '\0';
+          handleLine(client);
+          client.lineLength = 0;
+        } else if (client.lineLength < maxLineLength) {
+          client.line[client.lineLength++] = data[i];
+        }
+      }
+    }
+
+    /**
+     * Marks client closed, for example when its connection has been closed by the other end
+     *
+     * @param index client index
+     */
+    void disconnect(int8_t index) {
+      drop(clients[index]);
+    }
+
+    /**
+     * Queues tag event to every streaming client
+     *
+     * @param id tag id
+     * @param strength signal strength, 0 for disappearance
+     * @param antenna antenna id
+     */
+    void publish(const TagId &id, double strength, uint16_t antenna) {
+      if (getClientCount() == 0) {
+        return;
+      }
+
+      char epc[TAG_EPC_HEX_SIZE];
+      char tid[TAG_TID_HEX_SIZE];
+      char json[maxEventLength];
+      id.epcToHex(epc);
+      id.tidToHex(tid);
+      int jsonLength = id.tidLength > 0
+        ? snprintf(json, sizeof(json), "{\"antenna\":%u,\"tag\":\"%s\",\"tid\":\"%s\",\"strength\":%.2f}", antenna, epc, tid, strength)
+        : snprintf(json, sizeof(json), "{\"antenna\":%u,\"tag\":\"%s\",\"strength\":%.2f}", antenna, epc, strength);
+
+      uint8_t record[TAG_EPC_MAX_BYTES + TAG_TID_MAX_BYTES + 5];
+      size_t recordLength = 0;
+      record[recordLength++] = id.epcLength;
+      memcpy(record + recordLength, id.epc, id.epcLength);
+      recordLength += id.epcLength;
+      record[recordLength++] = id.tidLength;
+      memcpy(record + recordLength, id.tid, id.tidLength);
+      recordLength += id.tidLength;
+      record[recordLength++] = antenna >> 8;
+      record[recordLength++] = antenna & 0xFF;
+      double rounded = strength < 0 ? 0 : strength > 100 ? 100 : strength + 0.5;
+      record[recordLength++] = strength != 0 && rounded < 1 ? 1 : (uint8_t) rounded;
+
+      for (uint8_t i = 0; i < maxClients; i++) {
+        Client &client = clients[i];
+        if (client.state != STREAMING) {
+          continue;
+        }
+        if (client.binary) {
+          queueEvent(client, record, recordLength);
+        } else if (client.webSocket) {
+          queueEvent(client, (const uint8_t *) json, jsonLength);
+        } else {
+          json[jsonLength] = '\n';
+          queueEvent(client, (const uint8_t *) json, jsonLength + 1);
+          json[jsonLength] = '\0';
+        }
+      }
+    }
+
+    /**
+     * Writes queued bytes to clients, closes dropped clients and drops clients that have not completed
+     * their request within handshake timeout
+     *
+     * @param now current time in milliseconds
+     * @param write writer called with connection, bytes and length, returns number of bytes written or -1 on error
+     * @param close closer called with connection of every closed client
+     */
+    template <typename Writer, typename Closer>
+    void poll(unsigned long now, Writer write, Closer close) {
+      for (uint8_t i = 0; i < maxClients; i++) {
+        Client &client = clients[i];
+        if (client.state == HANDSHAKE && now - client.connected > handshakeTimeoutMs) {
+          drop(client);
+        }
+
+        while (client.state == STREAMING && client.queueLength > 0) {
+          uint16_t contiguous = queueSize - client.queueStart;
+          uint16_t length = client.queueLength < contiguous ? client.queueLength : contiguous;
+          int written = write(client.connection, client.queue + client.queueStart, length);
+          if (written < 0) {
+            drop(client);
+            break;
+          }
+          client.queueStart = (client.queueStart + written) % queueSize;
+          client.queueLength -= written;
+          if (written < length) {
+            break;
+          }
+        }
+
+        if (client.state == CLOSING) {
+          close(client.connection);
+          client.state = FREE;
+        }
+      }
+    }
+
+    /**
+     * Returns number of clients receiving events
+     */
+    uint8_t getClientCount() {
+      uint8_t count = 0;
+      for (uint8_t i = 0; i < maxClients; i++) {
+        if (clients[i].state == STREAMING) {
+          count++;
+        }
+      }
+      return count;
+    }
+
+    /**
+     * Returns number of clients dropped because they could not keep up with events
+     */
+    uint32_t getDroppedCount() {
+      return droppedCount;
+    }
+};
+
+#endif // EVENT_STREAM_CPP
@@ -0,0 +1,122 @@
+#ifndef FLUSH_SCHEDULER_CPP
+#define FLUSH_SCHEDULER_CPP
+
+#include <stdint.h>
+
+/**
+ * Class for adaptive MQTT flush scheduling.
+ *
+ * Flush interval starts from the configured base interval. It is doubled (up to maxStretchFactor times the
+ * base) when a flush takes more than half of the interval or the link reports an error, and shrinks back
+ * towards the base interval when flushes are fast again. Queue filling past the high-water mark triggers an
+ * early flush, and nothing is flushed while the queue is empty and no tag can have disappeared.
+ *
+ * Publish budget limits how many messages a single flush may publish so that the main loop is not blocked
+ * for more than maxFlushDurationMs on a slow link. It is derived from the measured per-message publish time.
+ */
+class FlushScheduler {
+
+  private:
+
+    const static uint32_t maxStretchFactor = 8;
+    const static uint32_t highWaterPercent = 75;
+    const static uint32_t maxFlushDurationMs = 250;
+    const static uint16_t minPublishBudget = 5;
+    const static uint16_t maxPublishBudget = 500;
+
+    unsigned long lastFlush = 0;
+    uint32_t interval = 0;
+    // Smoothed publish time per message in microseconds
+    uint32_t messageCostMicros = 0;
+
+    /**
+     * Clamps current interval between base interval and the maximum stretch
+     *
+     * @param baseInterval configured flush interval
+     */
+    void clampInterval(uint32_t baseInterval) {
+      if (interval < baseInterval) {
+        interval = baseInterval;
+      }
+      if (interval > baseInterval * maxStretchFactor) {
+        interval = baseInterval * maxStretchFactor;
+      }
+    }
+
+  public:
+
+    /**
+     * Checks whether queue should be flushed now
+     *
+     * @param now current time in milliseconds
+     * @param baseInterval configured flush interval
+     * @param queueLength messages waiting in queue
+     * @param queueCapacity queue capacity
+     * @param expiryDue whether some tag may have disappeared
+     * @return whether queue should be flushed
+     */
+    bool shouldFlush(unsigned long now, uint32_t baseInterval, uint16_t queueLength, uint16_t queueCapacity, bool expiryDue) {
+      clampInterval(baseInterval);
+
+      if (queueLength * 100 >= queueCapacity * highWaterPercent && now - lastFlush >= baseInterval) {
+        return true;
+      }
+
+      if (now - lastFlush < interval) {
+        return false;
+      }
+
+      return queueLength > 0 || expiryDue;
+    }
+
+    /**
+     * Records finished flush and adapts interval to link speed
+     *
+     * @param now current time in milliseconds
+     * @param baseInterval configured flush interval
+     * @param duration time spent publishing in milliseconds
+     * @param messages number of messages published
+     * @param linkError whether publishing reported an error
+     */
+    void flushed(unsigned long now, uint32_t baseInterval, unsigned long duration, uint16_t messages, bool linkError) {
+      lastFlush = now;
+      clampInterval(baseInterval);
+
+      if (messages > 0) {
+        uint32_t cost = duration * 1000 / messages;
+        messageCostMicros = messageCostMicros == 0 ? cost : (messageCostMicros * 3 + cost) / 4;
+      }
+
+      if (linkError || duration * 2 > interval) {
+        interval *= 2;
+      } else if (duration * 4 < interval) {
+        interval = interval * 3 / 4;
+      }
+
+      clampInterval(baseInterval);
+    }
+
+    /**
+     * Returns number of messages next flush may publish
+     */
+    uint16_t getPublishBudget() {
+      if (messageCostMicros == 0) {
+        return maxPublishBudget;
+      }
+
+      uint32_t budget = maxFlushDurationMs * 1000 / messageCostMicros;
+      if (budget < minPublishBudget) {
+        return minPublishBudget;
+      }
+      return budget > maxPublishBudget ? maxPublishBudget : budget;
+    }
+
+    /**
+     * Returns current flush interval in milliseconds
+     */
+    uint32_t getInterval() {
+      return interval;
+    }
+};
+
+#endif // FLUSH_SCHEDULER_CPP
@@ -0,0 +1,219 @@
+#ifndef LOG_BUFFER_CPP
+#define LOG_BUFFER_CPP
+
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 24
+#endif
+#ifndef LOG_MESSAGE_MAX_LENGTH
+#define LOG_MESSAGE_MAX_LENGTH 160
+#endif
+#ifndef LOG_REPEAT_INTERVAL_MS
+#define LOG_REPEAT_INTERVAL_MS 5000
+#endif
+
+/**
+ * Struct for buffered log message. Repeated count tells how many times the message occurred
+ * since it was last written, and is 0 for a message written as it happened
+ */
+struct LogEntry {
+  uint8_t level;
+  unsigned long time;
+  uint32_t repeated;
+  char text[LOG_MESSAGE_MAX_LENGTH + 1];
+};
+
+/**
+ * Class for buffering log messages until they can be written out, so that logging never waits for the console.
+ *
+ * Messages are kept in a fixed ring buffer, and messages that do not fit are counted as dropped. Messages
+ * from the same source, usually the same format string, are written at most once per repeat interval.
+ * Occurrences in between are only counted, and the count is added to the buffer with the latest text when
+ * the interval ends. Buffer is not thread safe, callers sharing it between tasks must lock it.
+ */
+class LogBuffer {
+
+  public:
+
+    const static uint8_t size = LOG_BUFFER_SIZE;
+    const static uint8_t repeatSlots = 8;
+    const static unsigned long repeatIntervalMs = LOG_REPEAT_INTERVAL_MS;
+
+  private:
+
+    /**
+     * Struct for tracking repeats of single message source
+     */
+    struct RepeatSlot {
+      const void *source;
+      unsigned long started;
+      uint32_t repeated;
+      uint8_t level;
+      char text[LOG_MESSAGE_MAX_LENGTH + 1];
+    };
+
+    LogEntry entries[size] = {};
+    uint8_t start = 0;
+    uint8_t length = 0;
+    RepeatSlot slots[repeatSlots] = {};
+    uint32_t droppedCount = 0;
+    uint32_t suppressedCount = 0;
+
+    /**
+     * Copies message text truncated to LOG_MESSAGE_MAX_LENGTH and terminates it
+     *
+     * @param destination buffer of LOG_MESSAGE_MAX_LENGTH + 1 bytes
+     * @param text message text
+     */
+    static void copyText(char *destination, const char *text) {
+      size_t textLength = strnlen(text, LOG_MESSAGE_MAX_LENGTH);
+      memcpy(destination, text, textLength);
+      destination[textLength] = '\0';
+    }
+
+    /**
+     * Adds entry to the end of the ring buffer
+     *
+     * @return whether there was room for the entry
+     */
+    bool push(uint8_t level, const char *text, uint32_t repeated, unsigned long now) {
+      if (length == size) {
+        droppedCount++;
+        return false;
+      }
+
+      LogEntry &entry = entries[(start + length) % size];
+      entry.level = level;
+      entry.time = now;
+      entry.repeated = repeated;
+      copyText(entry.text, text);
+      length++;
+      return true;
+    }
+
+    /**
+     * Adds count of suppressed repeats of the slot to the buffer
+     *
+     * @param slot repeat slot
+     * @param now current time
+     */
+    void pushRepeats(RepeatSlot &slot, unsigned long now) {
+      if (slot.repeated > 0) {
+        push(slot.level, slot.text, slot.repeated, now);
+        slot.repeated = 0;
+      }
+    }
+
+    /**
+     * Finds repeat slot of message source, or takes over a free slot or the slot used longest ago
+     *
+     * @param source message source
+     * @param now current time
+     * @return repeat slot, whose source is NULL if it was taken over
+     */
+    RepeatSlot &getSlot(const void *source, unsigned long now) {
+      uint8_t oldest = 0;
+      for (uint8_t i = 0; i < repeatSlots; i++) {
+        if (slots[i].source == source) {
+          return slots[i];
+        }
+        if (slots[oldest].source != NULL && (slots[i].source == NULL || now - slots[i].started > now - slots[oldest].started)) {
+          oldest = i;
+        }
+      }
+
+      pushRepeats(slots[oldest], now);
+      slots[oldest].source = NULL;
+      return slots[oldest];
+    }
+
+  public:
+
+    /**
+     * Adds message to the buffer, or only counts it if the same source was written less than repeat interval ago
+     *
+     * @param level log level
+     * @param source pointer identifying where the message comes from, usually its format string
+     * @param text message text, truncated to LOG_MESSAGE_MAX_LENGTH
+     * @param now current time
+     * @return whether message was added to the buffer
+     */
+    bool add(uint8_t level, const void *source, const char *text, unsigned long now) {
+      RepeatSlot &slot = getSlot(source, now);
+      if (slot.source == source && now - slot.started < repeatIntervalMs) {
+        slot.repeated++;
+        slot.level = level;
+        copyText(slot.text, text);
+        suppressedCount++;
+        return false;
+      }
+
+      pushRepeats(slot, now);
+      slot.source = source;
+      slot.started = now;
+      return push(level, text, 0, now);
+    }
+
+    /**
+     * Adds counts of repeats whose interval has ended to the buffer. Called periodically, so that
+     * repeats are reported even when the message does not occur again
+     *
+     * @param now current time
+     */
+    void expire(unsigned long now) {
+      for (uint8_t i = 0; i < repeatSlots; i++) {
+        if (slots[i].repeated > 0 && now - slots[i].started >= repeatIntervalMs) {
+          pushRepeats(slots[i], now);
+          slots[i].started = now;
+        }
+      }
+    }
+
+    /**
+     * Takes the oldest message from the buffer
+     *
+     * @param entry entry to fill
+     * @return whether there was a message
+     */
+    bool take(LogEntry *entry) {
+      if (length == 0) {
+        return false;
+      }
+
+      *entry = entries[start];
+      start = (start + 1) % size;
+      length--;
+      return true;
+    }
+
+    /**
+     * Returns number of messages waiting in the buffer
+     */
+    uint8_t getLength() {
+      return length;
+    }
+
+    /**
+     * Returns number of messages lost because the buffer was full
+     */
+    uint32_t getDroppedCount() {
+      return droppedCount;
+    }
+
+    /**
+     * Returns number of repeated messages that were only counted
+     */
+    uint32_t getSuppressedCount() {
+      return suppressedCount;
+    }
+};
+
+#endif // LOG_BUFFER_CPP
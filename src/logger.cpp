@@ -0,0 +1,189 @@
+#include "logger.h"
+#include <stdarg.h>
+
+#define LOGGER_TASK_STACK_SIZE 3072
+#define LOGGER_TASK_PRIORITY 1
+// Loop and reader tasks run on core 1
+#define LOGGER_TASK_CORE 0
+#define LOGGER_IDLE_WAIT_MS 100
+#define LOGGER_LINE_MAX_LENGTH (LOG_MESSAGE_MAX_LENGTH + 48)
+
+static LogBuffer logBuffer;
+static portMUX_TYPE logBufferLock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t loggerTask = NULL;
+static volatile bool loggerWriting = false;
+
+/**
+ * Returns letter shown for log level
+ *
+ * @param level log level
+ */
+static char getLogLevelLetter(uint8_t level) {
+  switch (level) {
+  case LOG_LEVEL_ERROR:
+    return 'E';
+  case LOG_LEVEL_WARNING:
+    return 'W';
+  case LOG_LEVEL_INFO:
+    return 'I';
+  default:
+    return 'D';
+  }
+}
+
+/**
+ * Writes text to the console only as fast as the UART transmit FIFO takes it, sleeping instead of
+ * spinning while the FIFO is full
+ *
+ * @param text text to write
+ * @param length text length
+ */
+static void writeConsole(const char *text, size_t length) {
+  while (length > 0) {
+    int room = Serial.availableForWrite();
+    if (room <= 0) {
+      vTaskDelay(1);
+      continue;
+    }
+
+    size_t chunk = (size_t) room < length ? room : length;
+    Serial.write((const uint8_t *) text, chunk);
+    text += chunk;
+    length -= chunk;
+  }
+}
+
+/**
+ * Writes log line to the console
+ *
+ * @param level log level
+ * @param time time of the message
+ * @param text message text
+ * @param repeated number of times message occurred since it was last written
+ */
+static void writeLogLine(uint8_t level, unsigned long time, const char *text, uint32_t repeated) {
+  char line[LOGGER_LINE_MAX_LENGTH];
+  int length;
+  if (repeated > 0) {
+    length = snprintf(line, sizeof(line), "%c (%lu) %s (repeated %u times)\r\n", getLogLevelLetter(level), time, text, repeated);
+  } else {
+    length = snprintf(line, sizeof(line), "%c (%lu) %s\r\n", getLogLevelLetter(level), time, text);
+  }
+
+  if (length > 0) {
+    writeConsole(line, (size_t) length < sizeof(line) ? length : sizeof(line) - 1);
+  }
+}
+
+/**
+ * Takes the oldest buffered message, and ends repeat intervals that are over
+ *
+ * @param entry entry to fill
+ * @param droppedCount number of messages dropped so far
+ * @return whether there was a message
+ */
+static bool takeLogEntry(LogEntry *entry, uint32_t *droppedCount) {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&logBufferLock);
+  logBuffer.expire(now);
+  bool taken = logBuffer.take(entry);
+  *droppedCount = logBuffer.getDroppedCount();
+  loggerWriting = taken;
+  portEXIT_CRITICAL(&logBufferLock);
+  return taken;
+}
+
+/**
+ * Logger task. Writes buffered messages to the console when woken by a new message, and at least
+ * every LOGGER_IDLE_WAIT_MS to report repeats
+ */
+static void loggerTaskLoop(void *) {
+  static LogEntry entry;
+  uint32_t droppedCount = 0;
+  uint32_t reportedDroppedCount = 0;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOGGER_IDLE_WAIT_MS));
+    while (takeLogEntry(&entry, &droppedCount)) {
+      writeLogLine(entry.level, entry.time, entry.text, entry.repeated);
+    }
+
+    if (droppedCount != reportedDroppedCount) {
+      char text[48];
+      snprintf(text, sizeof(text), "Log buffer full, %u messages dropped", droppedCount - reportedDroppedCount);
+      writeLogLine(LOG_LEVEL_WARNING, millis(), text, 0);
+      reportedDroppedCount = droppedCount;
+    }
+  }
+}
+
+/**
+ * Starts the logger task. Messages logged before this are buffered and written once the task runs
+ */
+void initializeLogger() {
+  xTaskCreatePinnedToCore(loggerTaskLoop, "logger", LOGGER_TASK_STACK_SIZE, NULL, LOGGER_TASK_PRIORITY, &loggerTask, LOGGER_TASK_CORE);
+}
+
+/**
+ * Formats message and buffers it for the logger task. Never waits for the console, so it is safe
+ * to call from the loop and reader tasks. Use LOG_* macros instead of calling this directly
+ *
+ * @param level log level
+ * @param format printf style format, also identifies the message when limiting repeats
+ */
+void logMessage(uint8_t level, const char *format, ...) {
+  char text[LOG_MESSAGE_MAX_LENGTH + 1];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  unsigned long now = millis();
+  portENTER_CRITICAL(&logBufferLock);
+  bool added = logBuffer.add(level, format, text, now);
+  portEXIT_CRITICAL(&logBufferLock);
+
+  if (added && loggerTask != NULL) {
+    xTaskNotifyGive(loggerTask);
+  }
+}
+
+/**
+ * Waits until buffered messages have been written to the console, used before restarting
+ *
+ * @param timeoutMs maximum time to wait
+ */
+void flushLogger(unsigned long timeoutMs) {
+  unsigned long started = millis();
+  while (loggerTask != NULL && millis() - started < timeoutMs) {
+    portENTER_CRITICAL(&logBufferLock);
+    bool pending = logBuffer.getLength() > 0 || loggerWriting;
+    portEXIT_CRITICAL(&logBufferLock);
+    if (!pending) {
+      break;
+    }
+    xTaskNotifyGive(loggerTask);
+    vTaskDelay(1);
+  }
+  Serial.flush();
+}
+
+/**
+ * Returns number of log messages lost because the buffer was full
+ */
+uint32_t getLogDropCount() {
+  portENTER_CRITICAL(&logBufferLock);
+  uint32_t count = logBuffer.getDroppedCount();
+  portEXIT_CRITICAL(&logBufferLock);
+  return count;
+}
+
+/**
+ * Returns number of repeated log messages that were only counted
+ */
+uint32_t getLogSuppressedCount() {
+  portENTER_CRITICAL(&logBufferLock);
+  uint32_t count = logBuffer.getSuppressedCount();
+  portEXIT_CRITICAL(&logBufferLock);
+  return count;
+}
@@ -1,242 +1,748 @@
-#include <WiFiClientSecure.h>
 #include <MQTTClient.h>
 #include <ArduinoJson.h>
 #include "WiFi.h"
 #include <ETH.h>
+#include <esp_system.h>
+#include <Preferences.h>
 #include "message-parser.cpp"
+#include "epc-filter.cpp"
+#include "tag-registry.cpp"
+#include "flush-scheduler.cpp"
+#include "broker-table.cpp"
+#include "publish-window.cpp"
+#include "tag-interner.cpp"
+#include "warm-restart-state.cpp"
 #include "ota-update.h"
+#include "reader-uart.h"
+#include "./types/reader-state.h"
+#include "reader-filter.h"
+#include "device-config.h"
+#include "tls-client.h"
+#include "event-server.h"
+#include "logger.h"
 
-#define MQTT_FLUSH_INTERVAL_MS 100
 #define MQTT_CONNECT_TIMEOUT 10000
 #define MQTT_DEVICE_RESET_TIMEOUT 60000
 #define START_RETRY_TIMEOUT_MS 3000
-#define TAG_DISAPPEARED_TIMEOUT_MS 1500
 #define SERIAL_MESSAGE_FAILED_TIMEOUT_MS 30000
-#define OTA_CHECK_INTERVAL_MS 60000
 #define NETWORK_CONNECTION_TIMEOUT_MS 15000
-
-/**
- * Struct for MQTT server
- */
-struct MqttServer {
-  char host[100];
-  char protocol[10];
-  uint16_t port;
-};
-
-/**
- * Struct for tag registry items
- */
-struct TagRegistryItem {
-  std::string epc;
-  unsigned long lastSeen;
-  int16_t antenna;
-};
-
-static int8_t mqttServerIndex = MQTT_URL_COUNT - 1;
-WiFiClientSecure net = WiFiClientSecure();
+#define READER_FILTER_MAX_ATTEMPTS 3
+#define EPC_FILTER_MESSAGE_DOCUMENT_SIZE 8192
+#define EPC_FILTER_NAMESPACE "epc-filter"
+#define EPC_FILTER_KEY "filter"
+#define STATUS_PUBLISH_INTERVAL_MS 60000
+#define OTA_PROGRESS_PUBLISH_INTERVAL_MS 5000
+#define MQTT_ACK_TIMEOUT_MS 10000
+#define MQTT_REBOOT_ACK_WAIT_MS 2000
+#define PRESENCE_SNAPSHOT_INTERVAL_MS 1000
+#define LOGGER_RESTART_FLUSH_TIMEOUT_MS 500
+// Leaves room for topic and headers in MQTT client buffer
+#define PRESENCE_SNAPSHOT_MAX_LENGTH 3584
+// Status message grows with every reader listed in it
+#define STATUS_DOCUMENT_SIZE (1408 + READER_COUNT * 128)
+#define STATUS_MESSAGE_MAX_LENGTH (1408 + READER_COUNT * 128)
+
+static BrokerTable brokerTable;
+static PublishWindow publishWindow;
+static PubackScanner pubackScanner;
+static int8_t mqttServerIndex = -1;
+TlsClient net;
 MQTTClient client = MQTTClient(4096);
 
 String deviceId = "";
 String hostname = "esp32-";
 
 bool ethConnected = false;
-static bool stopSuccessfull = false;
-static bool startSuccessfull = false;
-
-// Serial buffer
-const uint32_t messageBufferSize = 256;
-uint32_t antennaInputBuffer[messageBufferSize];
-uint32_t antennaMessageLength = 0;
 
-// Message markers
-const uint16_t messageStartMarker[2] = { 0xA5, 0x5A };
-const uint16_t messageEndMarker[2] = { 0x0D, 0x0A };
+// Runtime configuration
+DeviceConfig deviceConfig;
 
-// Epc registry
-const uint16_t registryBufferSize = 100;
-TagRegistryItem registry[registryBufferSize];
-uint16_t registryLength = 0;
+// Reader side inventory filter, same for every reader
+ReaderFilter readerFilter;
 
-// Quere buffer
-const uint16_t queueBufferSize = 100;
-ContinueInventoryMessage queue[queueBufferSize];
-uint16_t queueLength = 0;
+// Initialization and health of each reader
+static ReaderState readers[READER_COUNT] = {};
 
-uint16_t previousByte = 0;
+// Epc registry and outgoing message queue
+static TagRegistry tagRegistry;
+static FlushScheduler flushScheduler;
+// Registry saved before software restart, RTC slow memory keeps it over the restart
+RTC_NOINIT_ATTR static WarmRestartState warmRestartState;
 
 // Device commands
 const uint32_t stopAntennaCommand[8] = { 0xA5, 0x5A, 0x00, 0x08, 0x8C, 0x84, 0x0D, 0x0A };
 const uint32_t startAntennaCommand[10] = { 0xA5, 0x5A, 0x00, 0x0A, 0x82, 0x27, 0x10, 0xBF, 0x0D, 0x0A };
 const uint32_t askHWVersionCommand[8] = { 0xA5, 0x5A, 0x00, 0x08, 0x00, 0x08, 0x0D, 0x0A };
 const uint32_t setRegionCommand[10] = { 0xA5, 0x5A, 0x00, 0x0A, 0x2C, 0x01, 0x04, 0x23, 0x0D, 0x0A };
-const uint32_t setAntennasCommand[17] = { 0xa5, 0x5a, 0x00, 0x11, 0x28, 0x01, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x37, 0x0d, 0x0a };
-const uint32_t setIdleTimeCommand[11] = { 0xa5, 0x5a, 0x00, 0x0b, 0x4e, 0x01, 0x00, 0x32, 0x76, 0x0d, 0x0a };
 
-unsigned long lastContinueAttempt = 0;
-unsigned long lastMqttFlush = 0;
-unsigned long lastOtaCheck = 0;
-unsigned long lastMessageReceived = 0;
 unsigned long lastMqttConnection = 0;
+unsigned long lastStatusPublish = 0;
+unsigned long lastPresenceSnapshotPublish = 0;
+static uint8_t presenceSnapshot[PRESENCE_SNAPSHOT_MAX_LENGTH];
+// Status message is built in static buffers, it is too large for the loop task stack
+static StaticJsonDocument<STATUS_DOCUMENT_SIZE> statusDocument;
+static char statusMessage[STATUS_MESSAGE_MAX_LENGTH];
 
 static MessageParser parser;
 
+// On-device EPC allow/deny set
+static EpcFilter epcFilter;
+static TagInterner tagInterner;
+
+/**
+ * Returns device specific MQTT topic
+ *
+ * @param suffix topic suffix
+ * @return topic under device topic
+ */
+String getDeviceTopic(const String &suffix) {
+  String prefix = MQTT_TOPIC_PREFIX;
+  String topic = MQTT_TOPIC;
+  return prefix + "/" + topic + "/" + deviceId + "/" + suffix;
+}
+
+/**
+ * Returns fleet wide firmware announcement topic
+ *
+ * @return firmware announcement topic
+ */
+String getFirmwareTopic() {
+  String prefix = MQTT_TOPIC_PREFIX;
+  String topic = MQTT_TOPIC;
+  return prefix + "/" + topic + "/firmware";
+}
+
+/**
+ * Writes packet to the broker connection. Connection is closed if packet could not be written completely,
+ * so that a partial packet is never followed by another one
+ *
+ * @param packet packet bytes
+ * @param length packet length
+ * @return whether packet was written
+ */
+bool writeMqttPacket(const uint8_t *packet, size_t length) {
+  if (net.write(packet, length) == length) {
+    return true;
+  }
+  net.stop();
+  return false;
+}
+
+/**
+ * Handles bytes received from the broker connection, acknowledging messages in the publish window
+ *
+ * @param data received bytes
+ * @param length number of received bytes
+ */
+void handleMqttBytesReceived(const uint8_t *data, size_t length) {
+  unsigned long now = millis();
+  pubackScanner.feed(data, length, [now](uint16_t packetId) {
+    publishWindow.acknowledge(packetId, now);
+  });
+}
+
+/**
+ * Publishes retained mapping of tag session id to EPC and TID. Mapping is published with QoS 1 on
+ * tag-ids/<session id> topic, so that a mapping the broker did not acknowledge is published again. Example payload:
+ * { "tag": "e2003411b802011383258566" }
+ *
+ * @param sessionId session id
+ * @return whether mapping was published
+ */
+bool publishTagMapping(uint16_t sessionId) {
+  const TagId &id = tagInterner.getTag(sessionId);
+  char epc[TAG_EPC_HEX_SIZE];
+  char tid[TAG_TID_HEX_SIZE];
+  id.epcToHex(epc);
+  StaticJsonDocument<64> doc;
+  doc["tag"] = (const char *) epc;
+  if (id.tidLength > 0) {
+    id.tidToHex(tid);
+    doc["tid"] = (const char *) tid;
+  }
+  char jsonBuffer[256];
+  serializeJson(doc, jsonBuffer);
+  return client.publish(getDeviceTopic("tag-ids/" + String(sessionId)), jsonBuffer, true, 1);
+}
+
 /**
- * Publishes antenna update message to mqtt broker
+ * Publishes antenna update message to mqtt broker. Message is published with QoS 1 through the
+ * publish window when it is enabled, and with QoS 0 otherwise. Statistics of the reads the update
+ * stands for are added when they are enabled in configuration. When tag interning is enabled, tag is
+ * identified with its session id and the mapping of the id is published first until it has gone out
  * 
- * @param epc tag epc
+ * @param id tag id
  * @param strength signal strength
  * @param antenna antenna id
+ * @param statistics read statistics or NULL for presence transitions
+ * @return whether message was published or taken into the publish window
  */
-void publishAntennaMqttMessage(std::string epc, double strength, uint16_t antenna) {
-  StaticJsonDocument<200> doc;
-  doc["tag"] = epc;
+bool publishAntennaMqttMessage(const TagId &id, double strength, uint16_t antenna, const TagReadStatistics *statistics) {
+  char epc[TAG_EPC_HEX_SIZE];
+  char tid[TAG_TID_HEX_SIZE];
+  StaticJsonDocument<256> doc;
+  uint16_t reference = PublishWindow::noReference;
+  if (deviceConfig.internTags) {
+    bool mappingPending;
+    uint16_t sessionId = tagInterner.intern(id, millis(), &mappingPending, [](uint16_t candidate) {
+      return publishWindow.isReferenced(candidate);
+    });
+    if (sessionId == TagInterner::noSessionId) {
+      return false;
+    }
+    if (mappingPending) {
+      if (!publishTagMapping(sessionId)) {
+        return false;
+      }
+      tagInterner.setMappingPublished(sessionId);
+    }
+    doc["id"] = sessionId;
+    reference = sessionId;
+  } else {
+    id.epcToHex(epc);
+    doc["tag"] = (const char *) epc;
+    if (id.tidLength > 0) {
+      id.tidToHex(tid);
+      doc["tid"] = (const char *) tid;
+    }
+  }
   doc["strength"] = strength;
+  if (deviceConfig.readStatistics && statistics != NULL) {
+    doc["reads"] = statistics->count;
+    doc["minStrength"] = statistics->minStrength;
+    doc["maxStrength"] = statistics->maxStrength;
+    doc["meanStrength"] = statistics->meanStrength;
+    doc["firstSeen"] = statistics->firstSeen;
+    doc["lastSeen"] = statistics->lastSeen;
+  }
   char jsonBuffer[512];
-  serializeJson(doc, jsonBuffer);
-  String prefix = MQTT_TOPIC_PREFIX;
-  String topic = MQTT_TOPIC;
-  client.publish(prefix + "/" + topic + "/" + deviceId + "/" + antenna, jsonBuffer);
+  size_t length = serializeJson(doc, jsonBuffer);
+  String topic = getDeviceTopic(String(antenna));
+  if (deviceConfig.publishWindow == 0 || !PublishWindow::fits(topic.length(), length)) {
+    return client.publish(topic, jsonBuffer);
+  }
+  return publishWindow.publish(topic.c_str(), jsonBuffer, length, millis(), writeMqttPacket, reference);
+}
+
+/**
+ * Checks whether every reader has confirmed the inventory filter
+ */
+bool isReaderFilterConfirmed() {
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++) {
+    if (!readers[reader].filterConfirmed) {
+      return false;
+    }
+  }
+  return true;
 }
 
 /**
- * Publishes online message to mqtt broker
+ * Publishes online message to mqtt broker. Health of each reader is listed in readers, example:
+ * { "started": true, "lastMessageAgeMs": 12, "overflows": 0, "filterConfirmed": true }
  */
 void publishOnlineMqttMessage() {
-  StaticJsonDocument<200> doc;
+  lastStatusPublish = millis();
+  JsonDocument &doc = statusDocument;
+  doc.clear();
   doc["status"] = "online";
   doc["version"] = VERSION_NAME;
-  char jsonBuffer[512];
-  serializeJson(doc, jsonBuffer);
-  String prefix = MQTT_TOPIC_PREFIX;
-  String topic = MQTT_TOPIC;
-  client.publish(prefix + "/" + topic + "/" + deviceId + "/status", jsonBuffer);
+  JsonObject filter = doc.createNestedObject("readerFilter");
+  filter["enabled"] = readerFilter.enabled;
+  filter["confirmed"] = isReaderFilterConfirmed();
+  serializeDeviceConfig(deviceConfig, doc.createNestedObject("config"));
+  JsonArray readerStatus = doc.createNestedArray("readers");
+  uint32_t readerOverflowCount = 0;
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++) {
+    JsonObject status = readerStatus.createNestedObject();
+    status["started"] = readers[reader].startSuccessfull;
+    status["lastMessageAgeMs"] = millis() - readers[reader].lastMessageReceived;
+    status["overflows"] = getReaderUartOverflowCount(reader);
+    status["filterConfirmed"] = readers[reader].filterConfirmed;
+    readerOverflowCount += getReaderUartOverflowCount(reader);
+  }
+  JsonObject stats = doc.createNestedObject("stats");
+  stats["shed"] = tagRegistry.getShedCount();
+  stats["presenceOverflows"] = tagRegistry.getPresenceOverflowCount();
+  stats["registryOverflows"] = tagRegistry.getRegistryOverflowCount();
+  stats["readerOverflows"] = readerOverflowCount;
+  stats["readerFrameDrops"] = getReaderFrameDropCount();
+  stats["zoneTransitions"] = tagRegistry.getZoneTransitionCount();
+  stats["internedTags"] = tagInterner.getCount();
+  stats["internEvictions"] = tagInterner.getEvictionCount();
+  stats["localStreamClients"] = getEventClientCount();
+  stats["localStreamDrops"] = getEventClientDropCount();
+  stats["logDrops"] = getLogDropCount();
+  stats["logSuppressed"] = getLogSuppressedCount();
+  stats["publishAcked"] = publishWindow.getAcknowledgedCount();
+  stats["publishRetransmits"] = publishWindow.getRetransmitCount();
+  stats["publishInFlight"] = publishWindow.getInFlight();
+  stats["publishLatencyMs"] = publishWindow.getLatencyMs();
+  stats["publishMaxLatencyMs"] = publishWindow.getMaxLatencyMs();
+  TlsHandshakeStats tlsStats;
+  net.getHandshakeStats(&tlsStats);
+  stats["tlsFullHandshakes"] = tlsStats.fullHandshakes;
+  stats["tlsResumedHandshakes"] = tlsStats.resumedHandshakes;
+  stats["tlsLastHandshakeMs"] = tlsStats.lastHandshakeMs;
+  if (mqttServerIndex >= 0) {
+    stats["broker"] = mqttServerIndex;
+    stats["brokerLatencyMs"] = brokerTable.getServer(mqttServerIndex).latencyMs;
+  }
+  OtaProgress otaProgress;
+  getOtaProgress(&otaProgress);
+  if (otaProgress.active) {
+    JsonObject ota = doc.createNestedObject("ota");
+    ota["written"] = otaProgress.written;
+    ota["total"] = otaProgress.total;
+    ota["bytesPerSecond"] = otaProgress.bytesPerSecond;
+  }
+  size_t length = measureJson(doc);
+  if (doc.overflowed() || length >= sizeof(statusMessage)) {
+    LOG_ERROR("Status message does not fit, %u bytes", (unsigned) length);
+    return;
+  }
+  serializeJson(doc, statusMessage, sizeof(statusMessage));
+  client.publish(getDeviceTopic("status"), statusMessage);
 }
 
 /**
- * Adds message received from serial to queue
- * also updates registry, if tag with same epc and antenna is found last seen value is updated to current time,
- * otherwise tag is added to registry
- * 
+ * Publishes retained presence snapshot of every tracked tag to presence topic. Snapshot is binary,
+ * see TagRegistry::encodeSnapshot for the format
+ */
+void publishPresenceSnapshot() {
+  lastPresenceSnapshotPublish = millis();
+  size_t length = tagRegistry.encodeSnapshot(presenceSnapshot, PRESENCE_SNAPSHOT_MAX_LENGTH);
+  if (!client.publish(getDeviceTopic("presence").c_str(), (const char *) presenceSnapshot, length, true, 0)) {
+    tagRegistry.invalidateSnapshot();
+  }
+}
+
+/**
+ * Adds message received from serial to queue and updates registry
+ *
  * @param message messaged received from serial
  */
-void addToQueue(ContinueInventoryMessage message) {
-  boolean foundFromRegistry = false;
-  for (uint16_t i = 0; i < registryLength; i++) {
-    if (message.epc == registry[i].epc && message.antenna == registry[i].antenna) {
-      registry[i].lastSeen = millis();
-      foundFromRegistry = true;
+void addToQueue(const ContinueInventoryMessage &message) {
+  uint32_t registryOverflowCount = tagRegistry.getRegistryOverflowCount();
+  uint32_t presenceOverflowCount = tagRegistry.getPresenceOverflowCount();
+
+  tagRegistry.add(message, millis());
+
+  if (tagRegistry.getRegistryOverflowCount() != registryOverflowCount) {
+    LOG_WARNING("Epc registry overflow, losing data");
+  }
+  if (tagRegistry.getPresenceOverflowCount() != presenceOverflowCount) {
+    LOG_WARNING("Presence queue overflow, losing data");
+  }
+}
+
+/**
+ * Flushes message queue to mqtt broker
+ * Also checks if tags have not been seen
+ * in a while and sends message with strength of 0 for those tags.
+ * Appear and disappear events are published before strength updates, which
+ * are limited to the publish budget of the flush scheduler and to the free
+ * space of the publish window. Full publish window stops the flush without
+ * losing messages and is not reported as a link error.
+ * Publish duration and errors are reported to the flush scheduler
+ */
+void flushQueue() {
+  unsigned long started = millis();
+  bool publishFailed = false;
+  uint16_t published = 0;
+
+  uint16_t budget = flushScheduler.getPublishBudget();
+  if (deviceConfig.publishWindow > 0 && publishWindow.getFree() < budget) {
+    budget = publishWindow.getFree();
+  }
+
+  tagRegistry.flush(started, budget, [&publishFailed, &published](const TagId &id, double strength, uint16_t antenna, const TagReadStatistics *statistics) {
+    if (deviceConfig.publishWindow > 0 && publishWindow.getFree() == 0) {
+      // Full window is backpressure, message waits in the registry for acknowledgements
+      return false;
+    }
+    published++;
+    if (!publishAntennaMqttMessage(id, strength, antenna, statistics)) {
+      publishFailed = true;
+    }
+    return !publishFailed;
+  });
+
+  unsigned long now = millis();
+  bool linkError = publishFailed || client.lastError() != LWMQTT_SUCCESS || !net.connected();
+  flushScheduler.flushed(now, deviceConfig.flushIntervalMs, now - started, published, linkError);
+}
+
+/**
+ * Makes every reader initialize again
+ *
+ * @param filterChanged whether inventory filter has changed and has to be set again
+ */
+void reinitializeReaders(bool filterChanged) {
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++) {
+    if (filterChanged) {
+      readers[reader].filterConfirmed = false;
+      readers[reader].filterAttempts = 0;
     }
+    readers[reader].startSuccessfull = false;
   }
+}
 
-  if (!foundFromRegistry) {
-    registry[registryLength] = { epc: message.epc, lastSeen: millis(), antenna: message.antenna };
-    registryLength++;
-    if (registryLength >= registryBufferSize) {
-      registryLength = registryBufferSize - 1;
-      Serial.println("WARNING!! Epc registry overflow, losing data");
+/**
+ * Handles reader filter message. Filter is persisted and the readers reinitialized with it
+ *
+ * @param payload MQTT message payload
+ */
+void handleReaderFilterMessage(String &payload) {
+  ReaderFilter filter;
+  if (!parseReaderFilter(payload, &filter)) {
+    return;
+  }
+
+  readerFilter = filter;
+  saveReaderFilter(readerFilter);
+  reinitializeReaders(true);
+}
+
+/**
+ * Collects EPC strings from JSON array. Missing array is an empty list
+ *
+ * @param field JSON array of EPCs
+ * @param epcs collected EPCs
+ * @return false if field is not an array of strings
+ */
+bool collectEpcs(JsonVariant field, std::vector<std::string> &epcs) {
+  if (field.isNull()) {
+    return true;
+  }
+  if (!field.is<JsonArray>()) {
+    return false;
+  }
+  for (JsonVariant epc : field.as<JsonArray>()) {
+    if (!epc.is<const char*>()) {
+      return false;
     }
+    epcs.push_back(epc.as<const char*>());
   }
+  return true;
+}
 
-  for (uint16_t i = 0; i < queueLength; i++) {
-    if (queue[i].antenna == message.antenna && queue[i].epc == message.epc) {
-      queue[i] = message;
-      return;
+/**
+ * Loads EPC filter from NVS. Filter stays disabled if nothing valid has been stored
+ */
+void loadEpcFilter() {
+  Preferences preferences;
+  preferences.begin(EPC_FILTER_NAMESPACE, true);
+  size_t length = preferences.getBytesLength(EPC_FILTER_KEY);
+  if (length > 0) {
+    std::vector<uint8_t> buffer(length);
+    preferences.getBytes(EPC_FILTER_KEY, buffer.data(), length);
+    if (!epcFilter.decode(buffer.data(), length)) {
+      LOG_WARNING("Stored EPC filter is invalid");
     }
   }
+  preferences.end();
+}
 
-  if (queueLength >= queueBufferSize) {
-    queueLength = queueBufferSize - 1;
-    Serial.println("WARNING!! Message queue overflow, losing data");
+/**
+ * Stores EPC filter to NVS. Stored filter is removed if the filter does not fit NVS, so that an
+ * outdated filter is not loaded after restart
+ */
+void saveEpcFilter() {
+  std::vector<uint8_t> buffer;
+  epcFilter.encode(buffer);
+  Preferences preferences;
+  preferences.begin(EPC_FILTER_NAMESPACE, false);
+  if (preferences.putBytes(EPC_FILTER_KEY, buffer.data(), buffer.size()) != buffer.size()) {
+    preferences.remove(EPC_FILTER_KEY);
+    LOG_WARNING("EPC filter of %u bytes does not fit NVS, it is lost on restart", (unsigned) buffer.size());
   }
-  queue[queueLength] = message;
-  queueLength++;
+  preferences.end();
 }
 
 /**
- * Flushes message queue to mqtt broker
- * Also checks if tags have not been seen 
- * in a while and sends message with strength of 0 for those tags
+ * Handles EPC filter message. Large sets can be sent in several messages, example payload:
+ * { "mode": "deny", "clear": true, "add": [ "E2003411B802011383258566" ], "remove": [] }
+ * Filter is stored to NVS after every message and loaded at startup
+ *
+ * @param payload MQTT message payload
  */
-void flushQueue() {
-  for (uint16_t i = 0; i < queueLength; i++) {
-    ContinueInventoryMessage message = queue[i];
-    publishAntennaMqttMessage(message.epc, message.strength, message.antenna);
+void handleEpcFilterMessage(String &payload) {
+  DynamicJsonDocument doc(EPC_FILTER_MESSAGE_DOCUMENT_SIZE);
+  if (deserializeJson(doc, payload)) {
+    LOG_WARNING("Invalid EPC filter message");
+    return;
   }
-  queueLength = 0;
 
-  unsigned long now = millis();
-  uint16_t newRegistrySize = 0;
-  for (uint16_t i = 0; i < registryLength; i++) {
-    if (now - registry[i].lastSeen > TAG_DISAPPEARED_TIMEOUT_MS) {
-      publishAntennaMqttMessage(registry[i].epc, 0.0, registry[i].antenna);
+  EpcFilterMode mode = epcFilter.getMode();
+  if (!doc["mode"].isNull()) {
+    const char *modeName = doc["mode"] | "";
+    if (strcmp(modeName, "allow") == 0) {
+      mode = EPC_FILTER_ALLOW;
+    } else if (strcmp(modeName, "deny") == 0) {
+      mode = EPC_FILTER_DENY;
+    } else if (strcmp(modeName, "disabled") == 0) {
+      mode = EPC_FILTER_DISABLED;
     } else {
-      registry[newRegistrySize] = registry[i];
-      newRegistrySize++;
+      LOG_WARNING("Invalid EPC filter mode: %s", modeName);
+      return;
     }
   }
-  registryLength = newRegistrySize;
+
+  bool clear = doc["clear"] | false;
+  std::vector<std::string> added;
+  std::vector<std::string> removed;
+  if (!collectEpcs(doc["add"], added) || !collectEpcs(doc["remove"], removed)) {
+    LOG_WARNING("Invalid EPC filter message: add and remove must be lists of EPCs");
+    return;
+  }
+
+  // Whole message is rejected if the new set does not fit, so that filter is never left cleared by it
+  if ((clear || !added.empty() || !removed.empty()) && !epcFilter.update(added, removed, clear)) {
+    LOG_WARNING("EPC filter would exceed %u EPCs, message ignored", (unsigned) EpcFilter::maxSize);
+    return;
+  }
+  epcFilter.setMode(mode);
+  saveEpcFilter();
+
+  LOG_INFO("EPC filter updated, EPC count: %u", (unsigned) epcFilter.size());
+}
+
+/**
+ * Applies report mode and disappeared timeouts of the configuration to tag registry
+ */
+void applyRegistryConfig() {
+  tagRegistry.setZoneMode(deviceConfig.reportMode == ZONE_REPORT_MODE, deviceConfig.zoneHysteresis);
+  tagRegistry.setDisappearedTimeout(deviceConfig.tagDisappearedTimeoutMs);
+  tagRegistry.setAdaptiveTimeout(deviceConfig.adaptiveTimeout, deviceConfig.minTagDisappearedTimeoutMs, deviceConfig.maxTagDisappearedTimeoutMs);
+}
+
+/**
+ * Starts local event stream on configured port, or stops it when port is 0
+ */
+void applyLocalStreamConfig() {
+  if (deviceConfig.localStreamPort == 0) {
+    stopEventServer();
+  } else {
+    startEventServer(deviceConfig.localStreamPort);
+  }
+}
+
+/**
+ * Saves tag registry to RTC memory, writes out buffered log messages and restarts the device
+ */
+void restartDevice() {
+  size_t length = tagRegistry.saveState(warmRestartState.data, WARM_RESTART_STATE_SIZE);
+  sealWarmRestartState(&warmRestartState, length);
+  LOG_INFO("Restarting");
+  flushLogger(LOGGER_RESTART_FLUSH_TIMEOUT_MS);
+  esp_restart();
+}
+
+/**
+ * Restores tag registry saved before software restart, so that tags still present are not announced again
+ * and tags that left during restart are declared gone. Saved registry is used only once
+ */
+void restoreRegistryState() {
+  bool valid = esp_reset_reason() == ESP_RST_SW && isWarmRestartStateValid(warmRestartState);
+  clearWarmRestartState(&warmRestartState);
+  if (!valid) {
+    return;
+  }
+  if (!tagRegistry.restoreState(warmRestartState.data, warmRestartState.length, millis())) {
+    LOG_WARNING("Saved tag registry was malformed");
+    return;
+  }
+  LOG_INFO("Tag registry restored, tag count: %u", tagRegistry.getRegistryLength());
+}
+
+/**
+ * Handles configuration message. Valid configuration is applied live, persisted and echoed on the status topic.
+ * Configuration equal to the current one is ignored, so that NVS is not written again on every reconnect
+ *
+ * @param payload MQTT message payload
+ */
+void handleConfigMessage(String &payload) {
+  DeviceConfig config = deviceConfig;
+  if (!parseDeviceConfig(payload, &config) || !deviceConfigChanged(deviceConfig, config)) {
+    return;
+  }
+
+  if (readerSettingsChanged(deviceConfig, config)) {
+    reinitializeReaders(false);
+  }
+
+  bool localStreamChanged = deviceConfig.localStreamPort != config.localStreamPort;
+  deviceConfig = config;
+  saveDeviceConfig(deviceConfig);
+  applyRegistryConfig();
+  if (localStreamChanged) {
+    applyLocalStreamConfig();
+  }
+  publishWindow.setWindowSize(deviceConfig.publishWindow);
+  publishOnlineMqttMessage();
+}
+
+/**
+ * Handles retained firmware announcement. OTA task starts the update if announced version is newer
+ * than the running one, example payload:
+ * { "version": "1.0.23", "sha256": "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08" }
+ *
+ * @param payload MQTT message payload
+ */
+void handleFirmwareAnnouncement(String &payload) {
+  StaticJsonDocument<256> doc;
+  if (deserializeJson(doc, payload)) {
+    LOG_WARNING("Invalid firmware announcement");
+    return;
+  }
+
+  const char *version = doc["version"] | "";
+  const char *hash = doc["sha256"] | "";
+  if (strlen(version) == 0) {
+    LOG_WARNING("Firmware announcement without version");
+    return;
+  }
+
+  announceFirmwareUpdate(version, hash);
 }
 
 /**
  * MQTT message handler
  */
 void messageHandler(String &topic, String &payload) {
-  Serial.println("incoming: " + topic + " - " + payload);
+  LOG_DEBUG("incoming: %s - %s", topic.c_str(), payload.c_str());
+
+  if (topic == getDeviceTopic("reader-filter")) {
+    handleReaderFilterMessage(payload);
+  } else if (topic == getDeviceTopic("epc-filter")) {
+    handleEpcFilterMessage(payload);
+  } else if (topic == getDeviceTopic("config")) {
+    handleConfigMessage(payload);
+  } else if (topic == getFirmwareTopic()) {
+    handleFirmwareAnnouncement(payload);
+  }
 }
 
 /**
  * Sends stop inventory command to device
+ *
+ * @param reader reader id
  */
-void stopInventory() {
-  for (int i = 0; i < 8; i++) {
-    Serial1.write(stopAntennaCommand[i]);
-  }
+void stopInventory(uint8_t reader) {
+  writeReaderUart(reader, stopAntennaCommand, 8);
 }
 
 /**
  * Sends continue inventory command to device
+ *
+ * @param reader reader id
+ */
+void continueInventory(uint8_t reader) {
+  writeReaderUart(reader, startAntennaCommand, 10);
+}
+
+/**
+ * Sends time frame inventory command to device
+ *
+ * @param reader reader id
+ */
+void startTimeFrameInventory(uint8_t reader) {
+  const uint32_t payload[2] = { highByte(deviceConfig.timeFrameWindowMs), lowByte(deviceConfig.timeFrameWindowMs) };
+  uint32_t command[10];
+  uint32_t length = parser.constructCommand(TIME_FRAME_INVENTORY, payload, 2, command);
+  writeReaderUart(reader, command, length);
+}
+
+/**
+ * Sends get time frame inventory result command to device
+ *
+ * @param reader reader id
+ */
+void requestTimeFrameInventoryResult(uint8_t reader) {
+  uint32_t command[8];
+  uint32_t length = parser.constructCommand(GET_TIME_FRAME_INVENTORY_RESULT, NULL, 0, command);
+  writeReaderUart(reader, command, length);
+}
+
+/**
+ * Starts inventory with selected inventory mode
+ *
+ * @param reader reader id
  */
-void continueInventory() {
-  for (int i = 0; i < 10; i++) {
-    Serial1.write(startAntennaCommand[i]);
+void startInventory(uint8_t reader) {
+  if (deviceConfig.inventoryMode == TIME_FRAME_INVENTORY_MODE) {
+    startTimeFrameInventory(reader);
+  } else {
+    continueInventory(reader);
   }
 }
 
 /**
  * Sends set region eu command to device
+ *
+ * @param reader reader id
  */
-void setEuRegion() {
-  for (int i = 0; i < 10; i++) {
-    Serial1.write(setRegionCommand[i]);
-  }
+void setEuRegion(uint8_t reader) {
+  writeReaderUart(reader, setRegionCommand, 10);
 }
 
 /**
  * Sends set antennas command to device
+ *
+ * @param reader reader id
  */
-void setAntennas() {
-  for (int i = 0; i < 17; i++) {
-    Serial1.write(setAntennasCommand[i]);
-  }
+void setAntennas(uint8_t reader) {
+  const uint32_t payload[9] = { 0x01, highByte(deviceConfig.antennaMask), lowByte(deviceConfig.antennaMask), 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  uint32_t command[17];
+  uint32_t length = parser.constructCommand(ANTENNA_SETTING, payload, 9, command);
+  writeReaderUart(reader, command, length);
+}
+
+/**
+ * Sends EPC and TID simultaneously mode setting command to device. Mode is always set so that reader
+ * stops sending TIDs when reading them is turned off
+ *
+ * @param reader reader id
+ */
+void setEpcAndTidMode(uint8_t reader) {
+  const uint32_t payload[1] = { deviceConfig.readTid ? 0x01u : 0x00u };
+  uint32_t command[9];
+  uint32_t length = parser.constructCommand(GET_THE_EPC_AND_TID_SIMULTANEOUSLY_MODE_SETTING, payload, 1, command);
+  writeReaderUart(reader, command, length);
 }
 
 /**
  * Sends set idle time command to device
+ *
+ * @param reader reader id
  */
-void setIdleTime() {
-  for (int i = 0; i < 11; i++) {
-    Serial1.write(setIdleTimeCommand[i]);
-  }
+void setIdleTime(uint8_t reader) {
+  const uint32_t payload[3] = { 0x01, highByte(deviceConfig.antennaIdleTimeMs), lowByte(deviceConfig.antennaIdleTimeMs) };
+  uint32_t command[11];
+  uint32_t length = parser.constructCommand(SET_IDLE_TIME_OF_SWITCH_ANTENNA, payload, 3, command);
+  writeReaderUart(reader, command, length);
+}
+
+/**
+ * Sends inventory filtering setting command to device
+ *
+ * @param reader reader id
+ */
+void setReaderFilter(uint8_t reader) {
+  uint32_t command[READER_FILTER_MAX_MASK_BYTES + 13];
+  uint32_t length = constructReaderFilterCommand(readerFilter, command);
+  writeReaderUart(reader, command, length);
+  readers[reader].lastFilterAttempt = millis();
+  readers[reader].filterAttempts++;
 }
 
 /**
  * Sends ask hardware version command to device
+ *
+ * @param reader reader id
  */
-void askHardwareVersion() {
-  for (int i = 0; i < 8; i++) {
-    Serial1.write(askHWVersionCommand[i]);
-  }
+void askHardwareVersion(uint8_t reader) {
+  writeReaderUart(reader, askHWVersionCommand, 8);
 }
 
 /**
@@ -244,32 +750,25 @@ void askHardwareVersion() {
  */
 void connectToNetwork() {
   if (ethConnected) {
-    Serial.println("Ethernet connected, turning off Wi-Fi");
+    LOG_INFO("Ethernet connected, turning off Wi-Fi");
     WiFi.mode(WIFI_OFF);
   } else {
     WiFi.mode(WIFI_STA);
     WiFi.begin(WIFI_SSID, WIFI_PASS);
-    Serial.print("Connecting to Wi-Fi (");
-    Serial.print("ssid: ");
-    Serial.print(WIFI_SSID);
-    Serial.print(", pass: ");
-    Serial.print(WIFI_PASS);
-    Serial.println(")");
+    LOG_INFO("Connecting to Wi-Fi (ssid: %s, pass: %s)", WIFI_SSID, WIFI_PASS);
   }
 
   long connectionStarted = millis();
   while (WiFi.status() != WL_CONNECTED && !ethConnected && !net.connected()) {
     delay(500);
-    Serial.print(".");
     if (millis() - connectionStarted > NETWORK_CONNECTION_TIMEOUT_MS) {
-      Serial.println("Network connection timed out, retrying...");
+      LOG_WARNING("Network connection timed out, retrying...");
       return;
     }
   }
 
-  net.setInsecure();
 
-  Serial.println("Network connected!");
+  LOG_INFO("Network connected!");
 }
 
 /**
@@ -278,31 +777,23 @@ void connectToNetwork() {
 void onEthEvent(WiFiEvent_t event) {
   switch (event) {
     case SYSTEM_EVENT_ETH_START:
-      Serial.print("ETH Started with hostname: ");
-      Serial.println(hostname.c_str());
+      LOG_INFO("ETH Started with hostname: %s", hostname.c_str());
       ETH.setHostname(hostname.c_str());
       break;
     case SYSTEM_EVENT_ETH_CONNECTED:
-      Serial.println("ETH Connected");
+      LOG_INFO("ETH Connected");
       break;
     case SYSTEM_EVENT_ETH_GOT_IP:
-      Serial.print("ETH IPv4: ");
-      Serial.print(ETH.localIP());
-      if (ETH.fullDuplex()) {
-        Serial.print(", FULL_DUPLEX");
-      }
-      Serial.print(", ");
-      Serial.print(ETH.linkSpeed());
-      Serial.println("Mbps");
+      LOG_INFO("ETH IPv4: %s%s, %uMbps", ETH.localIP().toString().c_str(), ETH.fullDuplex() ? ", FULL_DUPLEX" : "", ETH.linkSpeed());
       ethConnected = true;
       WiFi.disconnect();
       break;
     case SYSTEM_EVENT_ETH_DISCONNECTED:
-      Serial.println("ETH Disconnected");
+      LOG_INFO("ETH Disconnected");
       ethConnected = false;
       break;
     case SYSTEM_EVENT_ETH_STOP:
-      Serial.println("ETH Stopped");
+      LOG_INFO("ETH Stopped");
       ethConnected = false;
       break;
     default:
@@ -311,79 +802,77 @@ void onEthEvent(WiFiEvent_t event) {
 }
 
 /**
- * Parses mqtt server url
- * 
- * @param url mqtt server url
- * @param server mqtt server struct
- */
-void parseMqttServerUrl(const char* url, MqttServer* server) {
-  sscanf(url, "%[^:]://%[^:]:%hu", server->protocol, server->host, &server->port);
-}
-
-/**
- * Parses mqtt server urls
- * 
- * @param urls mqtt server urls
+ * Resolves broker address, using address cached by broker table while it is fresh. Stale address is used
+ * if resolving fails
+ *
+ * @param index broker index
+ * @param address resolved address
+ * @return whether address was found
  */
+bool resolveMqttServer(uint8_t index, IPAddress &address) {
+  uint32_t cached;
+  if (brokerTable.getCachedAddress(index, millis(), &cached)) {
+    address = IPAddress(cached);
+    return true;
+  }
 
-MqttServer getMqttServer() {
-  mqttServerIndex = (mqttServerIndex + 1) % MQTT_URL_COUNT;
-  char mqttUrls[] = MQTT_URLS;
-  char* url = strtok(mqttUrls, ",");
-
-  uint8_t i = 0;
-  while (url != NULL && i < MQTT_URL_COUNT) {
-    if (i == mqttServerIndex) {
-      MqttServer server;
-      parseMqttServerUrl(url, &server);
-      return server;
-    } else {
-      url = strtok(NULL, ",");
-      i++;
-    }
+  const MqttServer &server = brokerTable.getServer(index);
+  if (WiFi.hostByName(server.host, address) == 1 && (uint32_t) address != 0) {
+    brokerTable.setCachedAddress(index, millis(), address);
+    return true;
   }
 
-  throw "No MQTT servers found";
-};
+  if (server.address != 0) {
+    address = IPAddress(server.address);
+    return true;
+  }
+  return false;
+}
 
 /**
- * Connect to MQTT 
+ * Connect to MQTT. Healthiest broker is tried first and failed attempt fails over to the next best broker
 */
 void connectToMQTT() {
-  MqttServer mqttServer = getMqttServer();
-  
-  Serial.print("Setting MQTT settings (");
-  Serial.print("Server index: ");
-  Serial.print(mqttServerIndex);
-  Serial.print(", user: ");
-  Serial.print(MQTT_USER);
-  Serial.print(", pass: ");
-  Serial.print(MQTT_PASS);
-  Serial.print(", topic prefix: ");
-  Serial.print(MQTT_TOPIC_PREFIX);
-  Serial.print(", topic: ");
-  Serial.print(MQTT_TOPIC);
-  Serial.print(", host: ");
-  Serial.print(mqttServer.host);
-  Serial.print(", port: ");
-  Serial.print(mqttServer.port);
-  Serial.print(", protocol: ");
-  Serial.print(mqttServer.protocol);
-  Serial.println(")");
-
-  client.begin(mqttServer.host, mqttServer.port, net);
-
-  client.onMessage(messageHandler);
-  client.setOptions(10, true, 5000);
+  if (brokerTable.getCount() == 0) {
+    LOG_ERROR("No valid MQTT server urls configured");
+    return;
+  }
 
   char clientId[deviceId.length() + 1];
   deviceId.toCharArray(clientId, deviceId.length() + 1);
 
-  Serial.println("Connecting to MQTT endpoint...");
+  client.onMessage(messageHandler);
+  client.setOptions(10, true, 5000);
+
   long connectionStarted = millis();
-  while (!client.connect(clientId, MQTT_USER, MQTT_PASS)) {
-    Serial.println(client.lastError());
-    Serial.print(".");
+  while (true) {
+    mqttServerIndex = brokerTable.select(millis());
+    const MqttServer &mqttServer = brokerTable.getServer(mqttServerIndex);
+
+    LOG_INFO(
+      "Setting MQTT settings (Server index: %d, user: %s, pass: %s, topic prefix: %s, topic: %s, host: %s, port: %u, protocol: %s, latency: %u ms, failures: %u)",
+      mqttServerIndex, MQTT_USER, MQTT_PASS, MQTT_TOPIC_PREFIX, MQTT_TOPIC, mqttServer.host, mqttServer.port, mqttServer.protocol,
+      (unsigned) mqttServer.latencyMs, (unsigned) mqttServer.consecutiveFailures
+    );
+
+    unsigned long attemptStarted = millis();
+    IPAddress address;
+    if (resolveMqttServer(mqttServerIndex, address)) {
+      net.setServerName(mqttServer.host);
+      client.begin(address, mqttServer.port, net);
+
+      LOG_INFO("Connecting to MQTT endpoint...");
+      pubackScanner.reset();
+      if (client.connect(clientId, MQTT_USER, MQTT_PASS)) {
+        brokerTable.recordSuccess(mqttServerIndex, millis(), millis() - attemptStarted);
+        break;
+      }
+      LOG_WARNING("MQTT connection failed, error: %d", client.lastError());
+    } else {
+      LOG_WARNING("Could not resolve MQTT server address");
+    }
+
+    brokerTable.recordFailure(mqttServerIndex, millis());
     delay(1000);
     if (!net.connected()) {
       connectToNetwork();
@@ -393,73 +882,128 @@ void connectToMQTT() {
     }
   }
 
+  client.subscribe(getDeviceTopic("reader-filter"));
+  client.subscribe(getDeviceTopic("epc-filter"));
+  client.subscribe(getDeviceTopic("config"));
+  client.subscribe(getFirmwareTopic());
   publishOnlineMqttMessage();
 
-  Serial.println("MQTT connected!");
-}
+  tagRegistry.invalidateSnapshot();
 
-/**
- * Read message from antenna
- */
-void read() {
-  static uint16_t ndx = 0;
-  static bool recvInProgress = false;
-  uint16_t rc = Serial1.read();
-  if (previousByte == messageStartMarker[0] && rc == messageStartMarker[1]) {
-    // Message start detected
-    recvInProgress = true;
-    antennaInputBuffer[0] = previousByte;
-    antennaInputBuffer[1] = rc;
-    ndx = 2;
-    antennaMessageLength = 0;
-  } else if (recvInProgress && previousByte == messageEndMarker[0] && rc == messageEndMarker[1]) {
-    // Message end detected
-    if (ndx >= messageBufferSize - 3) {
-      ndx = messageBufferSize - 3;
-      Serial.println("WARNING!! input buffer overflow, losing data");
+  // Broker may have lost retained mappings. Mappings of messages in flight are published before the
+  // messages are sent again, and the rest before the next message that uses them
+  tagInterner.invalidateMappings();
+  for (uint16_t i = 0; deviceConfig.internTags && i < tagInterner.getCount(); i++) {
+    if (publishWindow.isReferenced(i) && publishTagMapping(i)) {
+      tagInterner.setMappingPublished(i);
     }
-    recvInProgress = false;
-    antennaInputBuffer[ndx] = previousByte;
-    antennaInputBuffer[ndx + 1] = rc;
-    antennaMessageLength = ndx + 2;
-    ndx = 0;
-  } else if (recvInProgress) {
-    if (ndx >= messageBufferSize) {
-      ndx = messageBufferSize - 1;
-      Serial.println("WARNING!! input buffer overflow, losing data");
-    }
-    antennaInputBuffer[ndx] = rc;
-    ndx++;
   }
-  previousByte = rc;
+
+  uint8_t retransmitted = publishWindow.retransmit(millis(), writeMqttPacket);
+  if (retransmitted > 0) {
+    LOG_INFO("Sent again messages waiting for PUBACK: %u", retransmitted);
+  }
+
+  TlsHandshakeStats tlsStats;
+  net.getHandshakeStats(&tlsStats);
+  LOG_INFO("MQTT connected! TLS handshake took %u ms (%s)", (unsigned) tlsStats.lastHandshakeMs, tlsStats.lastResumed ? "session resumed" : "full handshake");
 }
 
 /**
- * Handles inventory response
+ * Handles inventory response. Antenna is moved to the antenna namespace of the reader
  *
+ * @param reader reader id
  * @param message parsed continue inventory response message
  */
-void handleInventoryResponse(ContinueInventoryMessage message) {
-  startSuccessfull = true;
-  lastMessageReceived = millis();
+void handleInventoryResponse(uint8_t reader, ContinueInventoryMessage message) {
+  readers[reader].startSuccessfull = true;
+  readers[reader].lastMessageReceived = millis();
+  if (!epcFilter.accepts(message.id)) {
+    return;
+  }
+  message.antenna = getReaderAntenna(reader, message.antenna);
   addToQueue(message);
 }
 
+/**
+ * Handles time frame inventory response. Results are requested once the reader has closed the time frame
+ *
+ * @param reader reader id
+ * @param success whether time frame inventory was successful
+ */
+void handleTimeFrameInventoryResponse(uint8_t reader, bool success) {
+  if (!success) {
+    return;
+  }
+
+  readers[reader].startSuccessfull = true;
+  readers[reader].lastMessageReceived = millis();
+  requestTimeFrameInventoryResult(reader);
+}
+
+/**
+ * Handles time frame inventory result. Next time frame is started after the last result
+ *
+ * @param reader reader id
+ * @param message antenna message
+ * @param parser initialized parser
+ */
+void handleTimeFrameInventoryResult(uint8_t reader, uint32_t message[], MessageParser parser) {
+  if (parser.isTimeFrameInventoryResultTag(message)) {
+    handleInventoryResponse(reader, parser.parseTimeFrameInventoryResult(message));
+  } else {
+    startTimeFrameInventory(reader);
+  }
+}
+
+/**
+ * Handles inventory filtering setting response
+ *
+ * @param reader reader id
+ * @param success whether reader accepted the filter
+ */
+void handleReaderFilterResponse(uint8_t reader, bool success) {
+  if (!success) {
+    LOG_WARNING("Inventory filter rejected by reader %u", reader);
+    return;
+  }
+
+  readers[reader].filterConfirmed = true;
+  if (client.connected()) {
+    publishOnlineMqttMessage();
+  }
+}
+
 /**
  * Parse message with given type
  * TODO: Add support for other message types
  *
+ * @param reader reader id
  * @param type type hex 
  * @param message antenna message
  * @param parser initialized parser
  */
-void parseMessageWithType(uint32_t type, uint32_t message[], MessageParser parser) {
+void parseMessageWithType(uint8_t reader, uint32_t type, uint32_t message[], MessageParser parser) {
   switch (type) {
   case CONTINUE_INVENTORY_RESPONSE:
-    handleInventoryResponse(parser.parseContinueInventoryResponse(message));
+    handleInventoryResponse(reader, parser.parseContinueInventoryResponse(message));
     break;
   case STOP_CONTINUE_INVENTORY_RESPONSE:
-    stopSuccessfull = parser.parseStopContinueInventoryResponse(message);
+    readers[reader].stopSuccessfull = parser.parseStopContinueInventoryResponse(message);
+    break;
+  case GET_THE_EPC_AND_TID_SIMULTANEOUSLY_MODE_SETTING_RESPONSE:
+    if (!parser.parseEpcAndTidModeSettingResponse(message)) {
+      LOG_WARNING("EPC and TID mode setting rejected by reader %u", reader);
+    }
+    break;
+  case INVENTORY_FILTERING_SETTING_RESPONSE:
+    handleReaderFilterResponse(reader, parser.parseInventoryFilteringSettingResponse(message));
+    break;
+  case TIME_FRAME_INVENTORY_RESPONSE:
+    handleTimeFrameInventoryResponse(reader, parser.parseTimeFrameInventoryResponse(message));
+    break;
+  case GET_TIME_FRAME_INVENTORY_RESULT:
+    handleTimeFrameInventoryResult(reader, message, parser);
     break;
   default:
     break;
@@ -467,51 +1011,100 @@ void parseMessageWithType(uint32_t type, uint32_t message[], MessageParser parse
 }
 
 /**
- * Prints device hex message to console. Leave this here for debugging
+ * Logs device hex message at debug level. Bytes that do not fit in one log message are left out.
+ * Leave this here for debugging
+ *
+ * @param message antenna message
+ * @param messageLength length of the message
  */
-void printDeviceHexMessage() {
-  Serial.println("----------START OF DEVICE MESSAGE----------");
-  for (uint32_t i = 0; i < antennaMessageLength; i++) {
-    Serial.println(antennaInputBuffer[i]);
+void printDeviceHexMessage(uint32_t message[], uint32_t messageLength) {
+  char hex[LOG_MESSAGE_MAX_LENGTH + 1] = "";
+  size_t length = 0;
+  for (uint32_t i = 0; i < messageLength && length + 3 < sizeof(hex); i++) {
+    length += snprintf(hex + length, sizeof(hex) - length, "%02X ", (unsigned) message[i] & 0xFF);
   }
-  Serial.println("----------END OF DEVICE MESSAGE----------");
+  LOG_DEBUG("Device message: %s", hex);
 }
 
 /**
  * Parse antenna message
+ *
+ * @param frame frame received from reader
  */
-void parseAntennaMessage() {
-  if (!parser.checkMessageStart(antennaInputBuffer)) {
-    Serial.println("Message start header was incorrect!!\n");
+void parseAntennaMessage(const ReaderFrame &frame) {
+  uint32_t message[READER_FRAME_MAX_LENGTH];
+  for (uint16_t i = 0; i < frame.length; i++) {
+    message[i] = frame.data[i];
+  }
+
+  if (!parser.checkMessageStart(message)) {
+    LOG_WARNING("Message start header was incorrect from reader %u", frame.reader);
     return;
   }
 
-  if (!parser.checkMessageEnd(antennaInputBuffer, antennaMessageLength)) {
-    Serial.println("Message end was incorrect!!\n");
+  if (!parser.checkMessageEnd(message, frame.length)) {
+    LOG_WARNING("Message end was incorrect from reader %u", frame.reader);
     return;
   }
 
-  if (!parser.checkCRC(antennaInputBuffer)) {
-    Serial.println("Message CRC was incorrect!!!\n");
+  if (!parser.checkCRC(message)) {
+    LOG_WARNING("Message CRC was incorrect from reader %u", frame.reader);
     return;
   }
 
-  parseMessageWithType(antennaInputBuffer[4], antennaInputBuffer, parser);
+  parseMessageWithType(frame.reader, message[4], message, parser);
 }
 
 /**
- * Initializes serial communications
+ * Initializes serial communications of a reader
+ *
+ * @param reader reader id
  */
-void initializeCommunication() {
-  stopInventory();
+void initializeCommunication(uint8_t reader) {
+  stopInventory(reader);
+  delay(50);
+  setEuRegion(reader);
   delay(50);
-  setEuRegion();
+  setAntennas(reader);
   delay(50);
-  setAntennas();
+  setIdleTime(reader);
   delay(50);
-  setIdleTime();
+  setEpcAndTidMode(reader);
   delay(50);
-  continueInventory();
+  if (!readers[reader].filterConfirmed && readers[reader].filterAttempts < READER_FILTER_MAX_ATTEMPTS) {
+    setReaderFilter(reader);
+    delay(50);
+  }
+  startInventory(reader);
+}
+
+/**
+ * Reinitializes reader that has not started, has stopped sending messages or has not confirmed
+ * the inventory filter, and reports UART overflows of the reader
+ *
+ * @param reader reader id
+ */
+void maintainReader(uint8_t reader) {
+  ReaderState &state = readers[reader];
+  if (state.startSuccessfull && millis() - state.lastMessageReceived > SERIAL_MESSAGE_FAILED_TIMEOUT_MS) {
+    state.startSuccessfull = false;
+  }
+
+  if (!state.filterConfirmed && state.filterAttempts > 0 && state.filterAttempts < READER_FILTER_MAX_ATTEMPTS && millis() - state.lastFilterAttempt > START_RETRY_TIMEOUT_MS) {
+    // Filter setting was not confirmed, reinitialize reader to try again
+    state.startSuccessfull = false;
+  }
+
+  if (!state.startSuccessfull && millis() - state.lastContinueAttempt > START_RETRY_TIMEOUT_MS) {
+    state.lastContinueAttempt = millis();
+    initializeCommunication(reader);
+  }
+
+  uint32_t overflowCount = getReaderUartOverflowCount(reader);
+  if (overflowCount != state.lastOverflowCount) {
+    state.lastOverflowCount = overflowCount;
+    LOG_WARNING("UART overflow of reader %u, total overflow events: %u", reader, overflowCount);
+  }
 }
 
 /**
@@ -521,20 +1114,32 @@ void setup() {
   deviceId = WiFi.macAddress();
   hostname += deviceId;
   Serial.begin(9600);
-  Serial1.begin(115200);
+  initializeLogger();
+  initializeReaderUart(115200);
+  loadDeviceConfig(&deviceConfig);
+  applyRegistryConfig();
+  tagRegistry.setEventListener(publishLocalEvent);
+  publishWindow.setWindowSize(deviceConfig.publishWindow);
+  net.setReceiveObserver(handleMqttBytesReceived);
+  loadReaderFilter(&readerFilter);
+  loadEpcFilter();
   
-  Serial.print("Device ID: ");
-  Serial.println(deviceId);
-  
-  Serial.print("Firmare version: ");
-  Serial.println(VERSION_NAME);
+  LOG_INFO("Device ID: %s", deviceId.c_str());
+  LOG_INFO("Firmare version: %s", VERSION_NAME);
 
   WiFi.onEvent(onEthEvent);
   ETH.begin();
+  brokerTable.parse(MQTT_URLS, MQTT_URL_COUNT);
   connectToNetwork();
+  applyLocalStreamConfig();
   connectToMQTT();
   delay(50);
-  initializeCommunication();
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++) {
+    initializeCommunication(reader);
+  }
+  // Restored tags count as seen now, so registry is restored only once readers are reading again
+  restoreRegistryState();
+  startOtaTask();
 }
 
 /**
@@ -542,17 +1147,24 @@ void setup() {
  */
 void loop() {
   if (millis() - lastMqttConnection > MQTT_DEVICE_RESET_TIMEOUT) {
-    esp_restart();
+    restartDevice();
   }
 
   if (!net.connected()) {
-    Serial.println("Network connection lost, reconnecting...");
+    LOG_WARNING("Network connection lost, reconnecting...");
     connectToNetwork();
   }
 
-  if (millis() - lastOtaCheck > OTA_CHECK_INTERVAL_MS) {
-    lastOtaCheck = millis();
-    checkFirmwareUpdates();
+  if (isOtaRebootPending()) {
+    LOG_INFO("Firmware update installed, flushing queue before reboot");
+    flushQueue();
+    unsigned long flushed = millis();
+    while (publishWindow.getInFlight() > 0 && client.connected() && millis() - flushed < MQTT_REBOOT_ACK_WAIT_MS) {
+      client.loop();
+      delay(10);
+    }
+    client.disconnect();
+    restartDevice();
   }
 
   if (!client.connected()) {
@@ -561,28 +1173,43 @@ void loop() {
     lastMqttConnection = millis();
   }
 
-  if (startSuccessfull && millis() - lastMessageReceived > SERIAL_MESSAGE_FAILED_TIMEOUT_MS) {
-    startSuccessfull = false;
+  if (publishWindow.getOldestAge(millis()) > MQTT_ACK_TIMEOUT_MS && client.connected()) {
+    // Broker stopped acknowledging, reconnect so that messages in flight are sent again
+    LOG_WARNING("PUBACK timed out, reconnecting");
+    net.stop();
   }
 
-  if (!startSuccessfull && millis() - lastContinueAttempt > START_RETRY_TIMEOUT_MS) {
-    lastContinueAttempt = millis();
-    initializeCommunication();
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++) {
+    maintainReader(reader);
   }
 
-  if (Serial1.available()) {
-    read();
+  ReaderFrame frame;
+  while (receiveReaderFrame(&frame)) {
+    parseAntennaMessage(frame);
   }
 
-  if (antennaMessageLength > 0) {
-    parseAntennaMessage();
-    antennaMessageLength = 0;
+  unsigned long now = millis();
+  bool expiryDue = tagRegistry.expiryDue(now);
+  if (expiryDue) {
+    // Disappearances reach the local event stream without waiting for the next flush
+    tagRegistry.expire(now);
   }
-
-  if (millis() - lastMqttFlush > MQTT_FLUSH_INTERVAL_MS) {
-    lastMqttFlush = millis();
+  if (flushScheduler.shouldFlush(now, deviceConfig.flushIntervalMs, tagRegistry.getQueueLength(), TagRegistry::queueBufferSize, expiryDue)) {
     flushQueue();
   }
 
+  pollEventServer(millis());
+
+  if (client.connected() && tagRegistry.isSnapshotStale() && millis() - lastPresenceSnapshotPublish >= PRESENCE_SNAPSHOT_INTERVAL_MS) {
+    publishPresenceSnapshot();
+  }
+
+  OtaProgress otaProgress;
+  getOtaProgress(&otaProgress);
+  uint32_t statusPublishInterval = otaProgress.active ? OTA_PROGRESS_PUBLISH_INTERVAL_MS : STATUS_PUBLISH_INTERVAL_MS;
+  if (client.connected() && millis() - lastStatusPublish > statusPublishInterval) {
+    publishOnlineMqttMessage();
+  }
+
   client.loop();
 }
@@ -1,10 +1,10 @@
+#ifndef MESSAGE_PARSER_CPP
+#define MESSAGE_PARSER_CPP
+
 #include <iostream>
 #include <array>
-#include <sstream>
 #include <cstdio>
 #include <string.h>
-#include <iomanip>
-#include <sstream>
 #include "./message-types.h"
 #include "./types/continue-inventory-response.h"
 
@@ -20,6 +20,15 @@ class MessageParser {
 
     const static uint32_t firstEndMarker = 0x0D;
     const static uint32_t secondEndMarker = 0x0A;
+
+    const static uint32_t timeFrameResultEndLength = 9;
+
+    // Start markers, length and command precede the PC word
+    const static uint32_t tagReportPcIndex = 5;
+    // Tag report bytes that are not EPC or TID: start markers, length, command, PC, RSSI, antenna,
+    // frequency, phase, check code and end markers
+    const static uint32_t tagReportFixedLength = 17;
+
     /**
      * Get message data length
      *
@@ -69,7 +78,7 @@ class MessageParser {
      */
     bool checkCRC(uint32_t message[]) {
       const int messageDataLength = getMessageDataLength(message);
-      int result = 0;
+      uint32_t result = 0;
 
       for (int i = 0; i < messageDataLength; i++) {
         if (i > 1 && i < messageDataLength -3) {
@@ -81,93 +90,159 @@ class MessageParser {
     }
 
     /**
-     * Construct hex string from hex decimals.
-     * Example:
-     * Input: 0xE2, 0x00, 0x34, 0x11, 0xB8, 0x02, 0x01, 0x13, 0x83, 0x25, 0x85, 0x66
-     * Output: E2003411B802011383258566
+     * Transforms RSSI to signal strength
      *
-     * @param message antenna message
-     * @param start start index
-     * @param end end index
-     * @return string of hex values
+     * @param rssi RSSI value
+     * @return calculated signal strength
+     */
+    double transformRssiToSignalStrength(double rssi) {
+      int PdBmMax = -30;
+      int PdBmMin = -80;
+      return 100 * (1 - (PdBmMax - rssi) / (PdBmMax - PdBmMin));
+    }
+
+    /**
+     * Constructs command message with start and end markers, length and check code
+     *
+     * @param type command type
+     * @param payload command payload
+     * @param payloadLength payload length
+     * @param command buffer for the constructed command
+     * @return command length
      */
-    std::string constructHexString(uint32_t message[], int start, int end) {
-      std::stringstream buffer;
+    uint32_t constructCommand(uint32_t type, const uint32_t payload[], uint32_t payloadLength, uint32_t command[]) {
+      const uint32_t commandLength = payloadLength + 8;
+      command[0] = firstStartMarker;
+      command[1] = secondStartMarker;
+      command[2] = (commandLength >> 8) & 0xFF;
+      command[3] = commandLength & 0xFF;
+      command[4] = type;
+
+      for (uint32_t i = 0; i < payloadLength; i++) {
+        command[5 + i] = payload[i];
+      }
 
-      for (int i = start; i < end; i++) {
-        buffer << std::hex << std::setw(2) << std::setfill('0') << message[i];
+      uint32_t checkCode = 0;
+      for (uint32_t i = 2; i < commandLength - 3; i++) {
+        checkCode ^= command[i];
       }
-      buffer << std::hex << std::setw(2) << std::setfill('0') << message[end];
-      return buffer.str();
+
+      command[commandLength - 3] = checkCode;
+      command[commandLength - 2] = firstEndMarker;
+      command[commandLength - 1] = secondEndMarker;
+      return commandLength;
     }
 
     /**
-     * Convert hex string to int.
-     * Example:
-     * Input: 0DF732
-     * Output: 915250
+     * Parses tag report with PC, EPC, RSSI and antenna fields.
+     * Shared by continue inventory responses and time frame inventory results.
+     *
+     * EPC length is taken from the length bits of the PC word and the fields after it follow the EPC.
+     * In EPC and TID mode reader sends TID between EPC and RSSI, and its length is what is left of the
+     * message after the EPC. Report that does not fit its declared lengths is returned with empty id
      *
-     * @param value string value
-     * @return converted int value
+     * @param message antenna message
      */
-    int hexStringToInt(std::string value) {
-      unsigned int x;   
-      std::stringstream ss;
-      ss << std::hex << value;
-      ss >> x;
-      return x;
+    ContinueInventoryMessage parseTagReport(uint32_t message[]) {
+      ContinueInventoryMessage result = {};
+
+      uint32_t dataLength = getMessageDataLength(message);
+      uint32_t pc = (message[tagReportPcIndex] << 8) | message[tagReportPcIndex + 1];
+      uint32_t epcLength = ((pc >> 11) & 0x1F) * 2;
+      if (dataLength < tagReportFixedLength + epcLength) {
+        return result;
+      }
+
+      uint32_t tidLength = dataLength - tagReportFixedLength - epcLength;
+      if (tidLength > TAG_TID_MAX_BYTES) {
+        return result;
+      }
+
+      uint32_t position = tagReportPcIndex + 2;
+      for (uint32_t i = 0; i < epcLength; i++) {
+        result.id.epc[i] = message[position++];
+      }
+      for (uint32_t i = 0; i < tidLength; i++) {
+        result.id.tid[i] = message[position++];
+      }
+      result.id.epcLength = epcLength;
+      result.id.tidLength = tidLength;
+
+      uint16_t rssi = 0x10000 - ((message[position] << 8) | message[position + 1]);
+      result.antenna = message[position + 2];
+      result.strength = transformRssiToSignalStrength(-rssi / 10.0);
+
+      return result;
     }
 
     /**
-     * Get twos complement
+     * Parses continue inventory response message
      *
-     * @param value string value
-     * @return double value of complement
+     * @param message antenna message
      */
-    double twosComplement(std::string value) {
-      return (~hexStringToInt(value) + 1);
+    ContinueInventoryMessage parseContinueInventoryResponse(uint32_t message[]) {
+      return parseTagReport(message);
     }
 
     /**
-     * Transforms RSSI to signal strength
+     * Parses continue inventory response message
      *
-     * @param rssi RSSI value
-     * @return calculated signal strength
+     * @param message antenna message
      */
-    double transformRssiToSignalStrength(double rssi) {
-      int PdBmMax = -30;
-      int PdBmMin = -80;
-      return 100 * (1 - (PdBmMax - rssi) / (PdBmMax - PdBmMin));
+    bool parseStopContinueInventoryResponse(uint32_t message[]) {
+      return ( message[5] == 0x01);
     }
 
     /**
-     * Parses continue inventory response message
+     * Parses EPC and TID simultaneously mode setting response message
      *
      * @param message antenna message
+     * @return whether reader accepted the mode
      */
-    ContinueInventoryMessage parseContinueInventoryResponse(uint32_t message[]) {
+    bool parseEpcAndTidModeSettingResponse(uint32_t message[]) {
+      return ( message[5] == 0x01);
+    }
 
-      std::string pc = constructHexString(message, 5, 6);
-      std::string epc = constructHexString(message, 7, 18);
-      std::string rssiString = constructHexString(message, 19, 20);
-      uint16_t rssi = twosComplement(rssiString);
-      std::string frequency = constructHexString(message, 22, 24);
-      std::string phase = constructHexString(message, 25, 25);
+    /**
+     * Parses inventory filtering setting response message
+     *
+     * @param message antenna message
+     * @return whether reader accepted the filter
+     */
+    bool parseInventoryFilteringSettingResponse(uint32_t message[]) {
+      return ( message[5] == 0x01);
+    }
 
-      ContinueInventoryMessage result;
-      result.antenna = message[21];
-      result.strength = transformRssiToSignalStrength(-rssi / 10.0);
-      result.epc = epc;
+    /**
+     * Parses time frame inventory response message. Reader sends it when the time frame has ended
+     *
+     * @param message antenna message
+     * @return whether the time frame inventory was successful
+     */
+    bool parseTimeFrameInventoryResponse(uint32_t message[]) {
+      return ( message[5] == 0x01);
+    }
 
-      return result;
+    /**
+     * Checks whether time frame inventory result message carries a tag.
+     * Reader ends the result listing with a status only message
+     *
+     * @param message antenna message
+     * @return whether message contains a tag report
+     */
+    bool isTimeFrameInventoryResultTag(uint32_t message[]) {
+      return getMessageDataLength(message) > timeFrameResultEndLength;
     }
 
     /**
-     * Parses continue inventory response message
+     * Parses single tag from time frame inventory result message.
+     * Reader has already deduplicated reads within the time frame
      *
      * @param message antenna message
      */
-    bool parseStopContinueInventoryResponse(uint32_t message[]) {
-      return ( message[5] == 0x01);
+    ContinueInventoryMessage parseTimeFrameInventoryResult(uint32_t message[]) {
+      return parseTagReport(message);
     }
-};
\ No newline at end of file
+};
+
+#endif // MESSAGE_PARSER_CPP
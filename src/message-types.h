@@ -1,3 +1,6 @@
+#ifndef MESSAGE_TYPES_H
+#define MESSAGE_TYPES_H
+
 #include <stdint.h>
 #include <string.h>
 
@@ -488,4 +491,6 @@ enum MessageTypes {
 
   /* Operation fail response */
   OPERATION_FAIL_RESPONSE = 0xff
-};
\ No newline at end of file
+};
+
+#endif // MESSAGE_TYPES_H
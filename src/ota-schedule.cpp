@@ -0,0 +1,234 @@
+#ifndef OTA_SCHEDULE_CPP
+#define OTA_SCHEDULE_CPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Updates are started by firmware announcements over MQTT, polling is a slow fallback
+#ifndef OTA_CHECK_INTERVAL_MS
+#define OTA_CHECK_INTERVAL_MS 21600000
+#endif
+
+// Random delay added to every check so that devices powered up together do not poll in lockstep
+#ifndef OTA_CHECK_JITTER_MS
+#define OTA_CHECK_JITTER_MS 600000
+#endif
+
+// Random delay before downloading announced firmware so that a rollout is spread over the fleet
+#ifndef OTA_ANNOUNCEMENT_JITTER_MS
+#define OTA_ANNOUNCEMENT_JITTER_MS 30000
+#endif
+
+// Interval for retrying failed download of announced firmware, doubled after every failure
+#ifndef OTA_ANNOUNCEMENT_RETRY_INTERVAL_MS
+#define OTA_ANNOUNCEMENT_RETRY_INTERVAL_MS 60000
+#endif
+
+// Check interval is doubled after every failed check up to this limit
+#ifndef OTA_MAX_BACKOFF_MS
+#define OTA_MAX_BACKOFF_MS 3600000
+#endif
+
+#define OTA_MAX_FAILURE_COUNT 16
+#define OTA_MAX_DOWNLOAD_ATTEMPTS 6
+#define OTA_RESUME_DELAY_MS 2000
+#define OTA_HASH_HEX_LENGTH 64
+#define OTA_VERSION_MAX_LENGTH 64
+
+#define OTA_HTTP_OK 200
+#define OTA_HTTP_PARTIAL_CONTENT 206
+#define OTA_HTTP_NOT_MODIFIED 304
+
+/**
+ * Outcome of conditional firmware version query
+ */
+enum OtaVersionQueryResult {
+  OTA_VERSION_FAILED,
+  OTA_VERSION_CACHED,
+  OTA_VERSION_LOADED
+};
+
+/**
+ * Returns whether firmware version query should be sent with If-None-Match and If-Modified-Since.
+ * Validators are only useful when the version they belong to is still stored
+ *
+ * @param cachedVersion version stored from the previous response
+ * @param validator ETag or Last-Modified of the previous response
+ * @return whether validator should be sent
+ */
+static inline bool shouldSendVersionValidator(const char *cachedVersion, const char *validator) {
+  return cachedVersion[0] != '\0' && validator[0] != '\0';
+}
+
+/**
+ * Interprets response to conditional firmware version query
+ *
+ * @param responseCode HTTP response code
+ * @param hasCachedVersion whether version of the previous response is stored
+ * @return whether stored version is used, new version was loaded or query failed
+ */
+static inline OtaVersionQueryResult getVersionQueryResult(int responseCode, bool hasCachedVersion) {
+  if (responseCode == OTA_HTTP_NOT_MODIFIED && hasCachedVersion) {
+    return OTA_VERSION_CACHED;
+  }
+  return responseCode == OTA_HTTP_OK ? OTA_VERSION_LOADED : OTA_VERSION_FAILED;
+}
+
+/**
+ * Returns whether firmware response can be written from given offset. First request must be
+ * answered with the whole firmware and resumed requests with a Content-Range starting from
+ * the offset of the same firmware length
+ *
+ * @param responseCode HTTP response code
+ * @param contentRange Content-Range header of the response
+ * @param offset first requested byte
+ * @param total firmware length from the first response
+ * @return whether response continues the download
+ */
+static inline bool isResumableFirmwareResponse(int responseCode, const char *contentRange, size_t offset, size_t total) {
+  if (offset == 0) {
+    return responseCode == OTA_HTTP_OK;
+  }
+  if (responseCode != OTA_HTTP_PARTIAL_CONTENT) {
+    return false;
+  }
+
+  unsigned long rangeStart = 0, rangeEnd = 0, rangeTotal = 0;
+  return sscanf(contentRange, "bytes %lu-%lu/%lu", &rangeStart, &rangeEnd, &rangeTotal) == 3
+    && rangeStart == offset && rangeTotal == total && rangeEnd < rangeTotal;
+}
+
+/**
+ * Returns delay before resuming interrupted firmware download, doubled for every attempt
+ *
+ * @param attempt download attempt, first resume is attempt 1
+ * @return delay in milliseconds
+ */
+static inline uint32_t getResumeDelay(uint8_t attempt) {
+  return attempt == 0 ? 0 : (uint32_t) OTA_RESUME_DELAY_MS << (attempt - 1);
+}
+
+/**
+ * Class for scheduling firmware checks and downloads of announced firmware.
+ *
+ * Polls happen at check interval and announced firmware is retried at retry interval, both doubled
+ * for every failure in a row up to OTA_MAX_BACKOFF_MS. Random values are passed in so that the
+ * schedule does not depend on the hardware random generator
+ */
+class OtaSchedule {
+
+  private:
+
+    char version[OTA_VERSION_MAX_LENGTH + 1] = "";
+    char hash[OTA_HASH_HEX_LENGTH + 1] = "";
+    bool announced = false;
+    uint8_t consecutiveFailures = 0;
+
+  public:
+
+    /**
+     * Takes firmware announcement to be downloaded. Announcement of the firmware that is already
+     * waiting, such as retained message delivered again after reconnect, keeps the backoff
+     *
+     * @param announcedVersion announced firmware version
+     * @param announcedHash announced firmware SHA-256 as hex string, may be empty
+     * @return whether announcement changed
+     */
+    bool announce(const char *announcedVersion, const char *announcedHash) {
+      if (announced && strncmp(version, announcedVersion, OTA_VERSION_MAX_LENGTH) == 0 && strncmp(hash, announcedHash, OTA_HASH_HEX_LENGTH) == 0) {
+        return false;
+      }
+
+      strncpy(version, announcedVersion, OTA_VERSION_MAX_LENGTH);
+      version[OTA_VERSION_MAX_LENGTH] = '\0';
+      strncpy(hash, announcedHash, OTA_HASH_HEX_LENGTH);
+      hash[OTA_HASH_HEX_LENGTH] = '\0';
+      announced = true;
+      consecutiveFailures = 0;
+      return true;
+    }
+
+    /**
+     * Records result of firmware check or download. Successful download ends the announcement
+     *
+     * @param success whether check or download succeeded
+     */
+    void recordResult(bool success) {
+      if (success) {
+        announced = false;
+        consecutiveFailures = 0;
+      } else if (consecutiveFailures < OTA_MAX_FAILURE_COUNT) {
+        consecutiveFailures++;
+      }
+    }
+
+    /**
+     * Returns delay before next firmware check or retry of announced firmware
+     *
+     * @param random random value for jitter
+     * @return delay in milliseconds
+     */
+    uint32_t getNextDelay(uint32_t random) {
+      uint32_t interval = announced ? OTA_ANNOUNCEMENT_RETRY_INTERVAL_MS : OTA_CHECK_INTERVAL_MS;
+      uint32_t delay = interval;
+      for (uint8_t i = 0; i < consecutiveFailures && delay < OTA_MAX_BACKOFF_MS; i++) {
+        delay *= 2;
+      }
+      // Backoff limit never shortens intervals that are already longer
+      if (delay > OTA_MAX_BACKOFF_MS && interval < OTA_MAX_BACKOFF_MS) {
+        delay = OTA_MAX_BACKOFF_MS;
+      }
+      return delay + random % (OTA_CHECK_JITTER_MS + 1);
+    }
+
+    /**
+     * Returns delay before the first firmware check, spread over the check interval
+     *
+     * @param random random value
+     * @return delay in milliseconds
+     */
+    static uint32_t getFirstDelay(uint32_t random) {
+      return random % OTA_CHECK_INTERVAL_MS;
+    }
+
+    /**
+     * Returns delay before downloading announced firmware
+     *
+     * @param random random value
+     * @return delay in milliseconds
+     */
+    static uint32_t getAnnouncementDelay(uint32_t random) {
+      return random % (OTA_ANNOUNCEMENT_JITTER_MS + 1);
+    }
+
+    /**
+     * Returns whether announced firmware is waiting to be downloaded
+     */
+    bool isAnnounced() {
+      return announced;
+    }
+
+    /**
+     * Returns announced firmware version
+     */
+    const char *getVersion() {
+      return version;
+    }
+
+    /**
+     * Returns announced firmware hash, empty if hash was not announced
+     */
+    const char *getHash() {
+      return hash;
+    }
+
+    /**
+     * Returns number of failed checks or downloads in a row
+     */
+    uint8_t getFailureCount() {
+      return consecutiveFailures;
+    }
+};
+
+#endif // OTA_SCHEDULE_CPP
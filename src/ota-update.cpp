@@ -1,6 +1,20 @@
 #include <HTTPClient.h>
 #include <Update.h>
+#include <Preferences.h>
+#include <mbedtls/sha256.h>
+#include <esp_ota_ops.h>
 #include "ota-update.h"
+#include "ota-schedule.cpp"
+#include "delta-patch.cpp"
+#include "logger.h"
+
+#define OTA_TASK_STACK_SIZE 8192
+#define OTA_TASK_PRIORITY 1
+#define OTA_TASK_CORE 0
+#define OTA_CHUNK_SIZE 1024
+#define OTA_STREAM_TIMEOUT_MS 10000
+#define OTA_PREFERENCES_NAMESPACE "ota"
+#define OTA_PROGRESS_STEP_PERCENT 10
 
 String updatesUrl = UPDATES_URL;
 const char *versionName = VERSION_NAME;
@@ -8,6 +22,22 @@ const char *versionName = VERSION_NAME;
 // Variables to validate firmware content
 volatile int contentLength = 0;
 
+// Set by the OTA task when new firmware has been installed, reboot is left to the main loop
+static volatile bool rebootPending = false;
+
+// Download progress, written by the OTA task and read by the main loop
+static volatile bool downloadActive = false;
+static volatile uint32_t progressWritten = 0;
+static volatile uint32_t progressTotal = 0;
+static volatile uint32_t progressBytesPerSecond = 0;
+static uint8_t progressStep = 0;
+
+// Latest firmware announcement, written by the main loop and read by the OTA task
+static TaskHandle_t otaTaskHandle = NULL;
+static portMUX_TYPE announcementMux = portMUX_INITIALIZER_UNLOCKED;
+static char announcedVersion[OTA_VERSION_MAX_LENGTH + 1];
+static char announcedHash[OTA_HASH_HEX_LENGTH + 1];
+
 /**
  * Parses version string to integer. Method expects version string in format x.y.z. 
  * 
@@ -35,27 +65,176 @@ String getVersionUrl() {
 }
 
 /**
- * Performs query to check the latest firmware version and returns the latest version
- * @return latest version as string
+ * Performs query to check the latest firmware version and returns the latest version.
+ *
+ * Query is conditional: ETag and Last-Modified of the previous response are stored to NVS
+ * and sent back as If-None-Match and If-Modified-Since, so an unchanged version file is
+ * answered with an empty 304 response and the stored version is used.
+ *
+ * @return latest version as string or empty string if query failed
  */
 String getLatestVersion() {
+  Preferences preferences;
+  preferences.begin(OTA_PREFERENCES_NAMESPACE, true);
+  String cachedVersion = preferences.getString("version", "");
+  String etag = preferences.getString("etag", "");
+  String lastModified = preferences.getString("lastModified", "");
+  preferences.end();
+
   HTTPClient http;
+  const char *headerKeys[] = {"ETag", "Last-Modified"};
   http.begin(getVersionUrl());
+  http.collectHeaders(headerKeys, 2);
+  if (shouldSendVersionValidator(cachedVersion.c_str(), etag.c_str())) {
+    http.addHeader("If-None-Match", etag);
+  }
+  if (shouldSendVersionValidator(cachedVersion.c_str(), lastModified.c_str())) {
+    http.addHeader("If-Modified-Since", lastModified);
+  }
+
   int httpResponseCode = http.GET();
-  if (httpResponseCode != 200) {
-    Serial.println("Failed to load firmware version");
-    Serial.println(httpResponseCode);
+  OtaVersionQueryResult result = getVersionQueryResult(httpResponseCode, cachedVersion.length() > 0);
+  if (result == OTA_VERSION_CACHED) {
+    http.end();
+    return cachedVersion;
+  }
+  if (result == OTA_VERSION_FAILED) {
+    LOG_WARNING("Failed to load firmware version, response %d", httpResponseCode);
     http.end();
     return "";
   }
   String version = http.getString();
   version.trim();
-  
+
+  preferences.begin(OTA_PREFERENCES_NAMESPACE, false);
+  preferences.putString("version", version);
+  preferences.putString("etag", http.header("ETag"));
+  preferences.putString("lastModified", http.header("Last-Modified"));
+  preferences.end();
+
   http.end();
 
   return version;
 }
 
+/**
+ * Updates download progress shared with the main loop
+ *
+ * @param written bytes written so far
+ * @param total firmware length in bytes
+ * @param started download start time in milliseconds
+ */
+static void updateProgress(size_t written, size_t total, unsigned long started) {
+  unsigned long elapsed = millis() - started;
+  progressWritten = written;
+  progressTotal = total;
+  progressBytesPerSecond = elapsed > 0 ? (uint64_t) written * 1000 / elapsed : 0;
+
+  uint8_t step = written * 100 / total / OTA_PROGRESS_STEP_PERCENT;
+  if (step != progressStep) {
+    progressStep = step;
+    LOG_INFO("OTA progress: %u/%u bytes, %u KB/s", (unsigned) written, (unsigned) total, progressBytesPerSecond / 1024);
+  }
+}
+
+/**
+ * Reads response body in chunks and passes them to consumer. Download speed is throttled
+ * to OTA_MAX_BYTES_PER_SECOND and the task yields after every chunk
+ *
+ * @param stream HTTP response stream
+ * @param length number of bytes to read
+ * @param consume chunk consumer, returns false to stop reading
+ * @return number of bytes consumed
+ */
+template <typename Consumer>
+static size_t readFirmwareStream(WiFiClient *stream, size_t length, Consumer consume) {
+  uint8_t buffer[OTA_CHUNK_SIZE];
+  size_t consumed = 0;
+  unsigned long started = millis();
+  unsigned long lastData = started;
+
+  while (consumed < length) {
+    size_t available = stream->available();
+    if (available == 0) {
+      if (!stream->connected() || millis() - lastData > OTA_STREAM_TIMEOUT_MS) {
+        break;
+      }
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
+    }
+
+    size_t chunkLength = min(available, min(sizeof(buffer), length - consumed));
+    int read = stream->read(buffer, chunkLength);
+    if (read <= 0) {
+      break;
+    }
+    if (!consume(buffer, read)) {
+      break;
+    }
+    consumed += read;
+    lastData = millis();
+
+    unsigned long expectedElapsed = (uint64_t) consumed * 1000 / OTA_MAX_BYTES_PER_SECOND;
+    unsigned long elapsed = millis() - started;
+    vTaskDelay(expectedElapsed > elapsed ? pdMS_TO_TICKS(expectedElapsed - elapsed) : 1);
+  }
+
+  return consumed;
+}
+
+/**
+ * Writes firmware chunk to flash and feeds it to the firmware hash
+ *
+ * @param buffer firmware chunk
+ * @param length chunk length
+ * @param hash firmware hash context
+ * @return whether chunk was written
+ */
+static bool writeFirmwareChunk(const uint8_t *buffer, size_t length, mbedtls_sha256_context *hash) {
+  if (Update.write((uint8_t *) buffer, length) != length) {
+    return false;
+  }
+  mbedtls_sha256_update_ret(hash, buffer, length);
+  return true;
+}
+
+/**
+ * Verifies firmware hash and finishes update. Update is aborted if hash does not match
+ *
+ * @param hash firmware hash context, freed by this function
+ * @param expectedHash expected hash as lower case hex string
+ * @return whether update was installed
+ */
+static bool finishUpdate(mbedtls_sha256_context *hash, const String &expectedHash) {
+  uint8_t digest[32];
+  mbedtls_sha256_finish_ret(hash, digest);
+  mbedtls_sha256_free(hash);
+
+  char actualHash[OTA_HASH_HEX_LENGTH + 1];
+  for (uint8_t i = 0; i < sizeof(digest); i++) {
+    sprintf(actualHash + i * 2, "%02x", digest[i]);
+  }
+  if (expectedHash != actualHash) {
+    LOG_ERROR("Firmware hash mismatch: %s, aborting", actualHash);
+    Update.abort();
+    return false;
+  }
+
+  if (Update.end()) {
+    if (Update.isFinished()) {
+      LOG_INFO("OTA update has successfully completed. Waiting for reboot ...");
+      rebootPending = true;
+      return true;
+    } else {
+      LOG_ERROR("Something went wrong! OTA update hasn't been finished properly.");
+    }
+  } else {
+    LOG_ERROR("An error Occurred. Error #: %u", Update.getError());
+  }
+
+  return false;
+}
+
 /**
  * Gets path to firmware file by version
  * @param version Firmware version
@@ -65,82 +244,363 @@ String getFirmwarePath(String version) {
   return updatesUrl + "/" + version + "/firmware.bin";
 }
 
+/**
+ * Gets path to delta patch from the running firmware version to given version
+ * @param version Firmware version
+ * @return path to delta patch
+ */
+String getPatchPath(String version) {
+  return updatesUrl + "/" + version + "/patches/" + versionName + ".patch";
+}
+
+/**
+ * Gets path to firmware hash file by version. The file contains hex encoded SHA-256 of the firmware
+ * @param version Firmware version
+ * @return path to firmware hash
+ */
+String getFirmwareHashPath(String version) {
+  return getFirmwarePath(version) + ".sha256";
+}
+
+/**
+ * Loads SHA-256 published next to the firmware file
+ * @param version Firmware version
+ * @return hash as lower case hex string or empty string if hash could not be loaded
+ */
+String getFirmwareHash(const String &version) {
+  HTTPClient http;
+  http.begin(getFirmwareHashPath(version));
+  int httpResponseCode = http.GET();
+  if (httpResponseCode != HTTP_CODE_OK) {
+    LOG_WARNING("Failed to load firmware hash, response %d", httpResponseCode);
+    http.end();
+    return "";
+  }
+
+  // Hash file may be in sha256sum format with the file name after the hash
+  String hash = http.getString().substring(0, OTA_HASH_HEX_LENGTH);
+  hash.toLowerCase();
+  http.end();
+
+  if (hash.length() != OTA_HASH_HEX_LENGTH) {
+    LOG_WARNING("Invalid firmware hash");
+    return "";
+  }
+  return hash;
+}
+
+/**
+ * Requests firmware from given offset. Offsets past zero are requested with a Range header and
+ * the server must answer with matching Content-Range
+ *
+ * @param http HTTP client
+ * @param firmwarePath firmware url
+ * @param offset first byte to request
+ * @param total firmware length, set from the first response and verified on resumed responses
+ * @return whether response body can be written from offset
+ */
+static bool requestFirmware(HTTPClient &http, const String &firmwarePath, size_t offset, size_t *total) {
+  const char *headerKeys[] = {"Content-Type", "Content-Range"};
+  http.begin(firmwarePath);
+  http.collectHeaders(headerKeys, 2);
+  if (offset > 0) {
+    http.addHeader("Range", "bytes=" + String(offset) + "-");
+  }
+  int httpResponseCode = http.GET();
+
+  String contentRange = http.header("Content-Range");
+  if (!isResumableFirmwareResponse(httpResponseCode, contentRange.c_str(), offset, *total)) {
+    LOG_WARNING("Failed to load firmware, response %d, content range: %s", httpResponseCode, contentRange.c_str());
+    return false;
+  }
+  if (offset == 0) {
+    int responseLength = http.getSize();
+    *total = responseLength > 0 ? responseLength : 0;
+  }
+
+  if (*total == 0) {
+    LOG_WARNING("No content for OTA update (length 0)");
+    return false;
+  }
+
+  String contentType = http.header("Content-Type");
+  if (contentType != "application/octet-stream") {
+    LOG_WARNING("Invalid content type: %s", contentType.c_str());
+    return false;
+  }
+
+  return true;
+}
+
 /**
  * Checks and updates firmware if new version is available
+ *
+ * @return false if version query or update failed
  */
-void checkFirmwareUpdates() {
+bool checkFirmwareUpdates() {
   String latestVersionName = getLatestVersion();
+  if (latestVersionName.length() == 0) {
+    return false;
+  }
+
   int latestVersion = parseVersion(latestVersionName.c_str());
   int currentVersion = getCurrentVersion();
   if (latestVersion <= currentVersion) {
-    Serial.println("Current firmware is up to date");
-    return;
+    LOG_INFO("Current firmware is up to date");
+    return true;
   }
 
-  Serial.println("There is a new version of firmware available: " + latestVersionName);
-  processOTAUpdate(latestVersionName);
+  LOG_INFO("There is a new version of firmware available: %s", latestVersionName.c_str());
+  return processOTAUpdate(latestVersionName, "");
 }
 
+#if OTA_DELTA_UPDATES
 /**
- * OTA update processing
- * 
+ * Delta update processing. Patch from the running version is applied while streaming: COPY
+ * operations read the running partition and the result is written to the inactive partition
+ *
  * @param version firmware version
+ * @param expectedHash expected hash of the patched firmware
+ * @return whether update was installed
  */
-void processOTAUpdate(const String &version) {
-  String firmwarePath = getFirmwarePath(version);
+static bool processDeltaUpdate(const String &version, const String &expectedHash) {
+  String patchPath = getPatchPath(version);
 
-  Serial.println("Starting OTA update from " + firmwarePath);
-  
   HTTPClient http;
-  const char * headerKeys[] = {"Content-Type"};
-  http.begin(firmwarePath);
-  http.collectHeaders(headerKeys, 1);
+  http.begin(patchPath);
   int httpResponseCode = http.GET();
-
-  if (httpResponseCode != 200) {
-    Serial.println("Failed to load firmware");
-    Serial.println(httpResponseCode);
+  int patchLength = http.getSize();
+  if (httpResponseCode != HTTP_CODE_OK || patchLength <= 0) {
+    LOG_INFO("No delta patch available from %s, response %d", versionName, httpResponseCode);
     http.end();
-    return;
+    return false;
   }
 
-  contentLength = http.getSize();
-  if (contentLength <= 0) {
-    Serial.println("No content for OTA update (length 0)");
-    http.end();
-    return;
+  LOG_INFO("Starting delta OTA update from %s", patchPath.c_str());
+
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  DeltaPatchApplier applier;
+  mbedtls_sha256_context hash;
+  mbedtls_sha256_init(&hash);
+  mbedtls_sha256_starts_ret(&hash, 0);
+  bool updateStarted = false;
+  unsigned long started = millis();
+  progressStep = 0;
+  downloadActive = true;
+
+  auto readSource = [running](uint32_t offset, uint8_t *buffer, size_t length) {
+    return offset + length <= running->size && esp_partition_read(running, offset, buffer, length) == ESP_OK;
+  };
+  auto writeTarget = [&](const uint8_t *buffer, size_t length) {
+    if (!updateStarted) {
+      if (!Update.begin(applier.getTargetLength())) {
+        LOG_ERROR("There isn't enough space to start OTA update");
+        return false;
+      }
+      updateStarted = true;
+    }
+    if (!writeFirmwareChunk(buffer, length, &hash)) {
+      return false;
+    }
+    updateProgress(applier.getWritten() + length, applier.getTargetLength(), started);
+    return true;
+  };
+
+  readFirmwareStream(http.getStreamPtr(), patchLength, [&](const uint8_t *buffer, size_t length) {
+    return applier.feed(buffer, length, readSource, writeTarget);
+  });
+  http.end();
+  downloadActive = false;
+
+  if (!applier.isFinished()) {
+    LOG_WARNING("Delta patch failed: %s", applier.getError() != NULL ? applier.getError() : "download interrupted");
+    mbedtls_sha256_free(&hash);
+    if (updateStarted) {
+      Update.abort();
+    }
+    return false;
   }
 
-  String contentType = http.header("Content-Type");
-  if (contentType != "application/octet-stream") {
-    Serial.println("Invalid content type: " + http.header("Content-Type"));
-    http.end();
-    return;
+  LOG_INFO("Patched : %u bytes from %d byte patch in %lu s", (unsigned) applier.getWritten(), patchLength, (millis() - started) / 1000);
+  return finishUpdate(&hash, expectedHash);
+}
+#endif
+
+/**
+ * OTA update processing. Delta patch from the running version is tried first when available.
+ * Full image downloads are resumed from the last written byte with Range requests after
+ * interruptions. Firmware is hashed while streaming and verified against the published
+ * SHA-256 before the update is finished
+ *
+ * @param version firmware version
+ * @param knownHash expected firmware hash, loaded from the update server if empty
+ * @return whether update was installed
+ */
+bool processOTAUpdate(const String &version, const String &knownHash) {
+  String firmwarePath = getFirmwarePath(version);
+  String expectedHash = knownHash.length() == OTA_HASH_HEX_LENGTH ? knownHash : getFirmwareHash(version);
+  if (expectedHash.length() == 0) {
+    return false;
   }
 
-  if (Update.begin(contentLength)) {
-    Serial.println("Starting Over-The-Air update. This may take some time to complete ...");
-    size_t written = Update.writeStream(http.getStream());
+#if OTA_DELTA_UPDATES
+  if (processDeltaUpdate(version, expectedHash)) {
+    return true;
+  }
+#endif
 
-    if (written == contentLength) {
-      Serial.println("Written : " + String(written) + " successfully");
-    } else {
-      Serial.println("Written only : " + String(written) + "/" + String(contentLength) + ". Retry?");
-      // Retry??
+  LOG_INFO("Starting OTA update from %s", firmwarePath.c_str());
+
+  mbedtls_sha256_context hash;
+  mbedtls_sha256_init(&hash);
+  mbedtls_sha256_starts_ret(&hash, 0);
+
+  size_t total = 0;
+  size_t written = 0;
+  bool updateStarted = false;
+  unsigned long started = millis();
+  progressStep = 0;
+  downloadActive = true;
+
+  for (uint8_t attempt = 0; attempt < OTA_MAX_DOWNLOAD_ATTEMPTS && (!updateStarted || written < total); attempt++) {
+    if (attempt > 0) {
+      vTaskDelay(pdMS_TO_TICKS(getResumeDelay(attempt)));
+      LOG_INFO("Resuming OTA update from byte %u", (unsigned) written);
+    }
+
+    HTTPClient http;
+    if (!requestFirmware(http, firmwarePath, written, &total)) {
+      http.end();
+      continue;
     }
 
-    if (Update.end()) {
-      if (Update.isFinished()) {
-        Serial.println("OTA update has successfully completed. Rebooting ...");
-        ESP.restart();
-      } else {
-        Serial.println("Something went wrong! OTA update hasn't been finished properly.");
+    if (!updateStarted) {
+      contentLength = total;
+      if (!Update.begin(total)) {
+        LOG_ERROR("There isn't enough space to start OTA update");
+        http.end();
+        break;
       }
-    } else {
-      Serial.println("An error Occurred. Error #: " + String(Update.getError()));
+      LOG_INFO("Starting Over-The-Air update. This may take some time to complete ...");
+      updateStarted = true;
     }
-  } else {
-    Serial.println("There isn't enough space to start OTA update");
+
+    readFirmwareStream(http.getStreamPtr(), total - written, [&](const uint8_t *buffer, size_t length) {
+      if (!writeFirmwareChunk(buffer, length, &hash)) {
+        return false;
+      }
+      written += length;
+      updateProgress(written, total, started);
+      return true;
+    });
     http.end();
+
+    if (Update.hasError()) {
+      break;
+    }
+  }
+
+  downloadActive = false;
+
+  if (!updateStarted || written != total) {
+    if (updateStarted) {
+      LOG_WARNING("Written only : %u/%u, aborting", (unsigned) written, (unsigned) total);
+      Update.abort();
+    }
+    mbedtls_sha256_free(&hash);
+    return false;
+  }
+
+  LOG_INFO("Written : %u successfully in %lu s", (unsigned) written, (millis() - started) / 1000);
+  return finishUpdate(&hash, expectedHash);
+}
+
+/**
+ * OTA task. Downloads firmware without blocking the main loop when a newer version is announced
+ * over MQTT, and polls the update server as a slow fallback. Announced downloads start after a
+ * random delay and failed ones are retried with backoff, which repeated announcements do not reset.
+ * First poll happens at a random point of the check interval to spread devices booted together
+ */
+static void otaTask(void *) {
+  char version[OTA_VERSION_MAX_LENGTH + 1];
+  char hash[OTA_HASH_HEX_LENGTH + 1];
+  OtaSchedule schedule;
+  uint32_t delay = OtaSchedule::getFirstDelay(esp_random());
+  unsigned long scheduled = millis();
+
+  while (!rebootPending) {
+    unsigned long elapsed = millis() - scheduled;
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(elapsed < delay ? delay - elapsed : 0)) > 0) {
+      portENTER_CRITICAL(&announcementMux);
+      strcpy(version, announcedVersion);
+      strcpy(hash, announcedHash);
+      portEXIT_CRITICAL(&announcementMux);
+
+      if (!schedule.announce(version, hash)) {
+        // Same announcement again, keep waiting for the retry
+        continue;
+      }
+      LOG_INFO("Firmware update announced: %s", version);
+      vTaskDelay(pdMS_TO_TICKS(OtaSchedule::getAnnouncementDelay(esp_random())));
+    }
+
+    bool success = schedule.isAnnounced() ? processOTAUpdate(schedule.getVersion(), schedule.getHash()) : checkFirmwareUpdates();
+    schedule.recordResult(success);
+    delay = schedule.getNextDelay(esp_random());
+    scheduled = millis();
+  }
+  vTaskDelete(NULL);
+}
+
+/**
+ * Starts OTA task on the protocol core with low priority
+ */
+void startOtaTask() {
+  xTaskCreatePinnedToCore(otaTask, "ota", OTA_TASK_STACK_SIZE, NULL, OTA_TASK_PRIORITY, &otaTaskHandle, OTA_TASK_CORE);
+}
+
+/**
+ * Passes firmware announcement to the OTA task. Announcements of the running or older
+ * versions are ignored
+ *
+ * @param version announced firmware version
+ * @param hash announced firmware SHA-256 as hex string, may be empty
+ */
+void announceFirmwareUpdate(const char *version, const char *hash) {
+  if (parseVersion(version) <= getCurrentVersion() || strlen(version) > OTA_VERSION_MAX_LENGTH) {
+    return;
+  }
+
+  portENTER_CRITICAL(&announcementMux);
+  strcpy(announcedVersion, version);
+  announcedHash[0] = '\0';
+  if (strlen(hash) == OTA_HASH_HEX_LENGTH) {
+    for (uint8_t i = 0; i <= OTA_HASH_HEX_LENGTH; i++) {
+      announcedHash[i] = tolower(hash[i]);
+    }
   }
+  portEXIT_CRITICAL(&announcementMux);
+
+  if (otaTaskHandle != NULL) {
+    xTaskNotifyGive(otaTaskHandle);
+  }
+}
+
+/**
+ * Returns whether new firmware has been installed and device should be rebooted
+ */
+bool isOtaRebootPending() {
+  return rebootPending;
+}
+
+/**
+ * Returns progress of ongoing firmware download
+ *
+ * @param progress download progress
+ */
+void getOtaProgress(OtaProgress *progress) {
+  progress->active = downloadActive;
+  progress->written = progressWritten;
+  progress->total = progressTotal;
+  progress->bytesPerSecond = progressBytesPerSecond;
 }
@@ -3,7 +3,31 @@
 
 #include <Arduino.h>
 
-void checkFirmwareUpdates();
-void processOTAUpdate(const String &version);
+// Delta patches from the running version are tried before full firmware images
+#ifndef OTA_DELTA_UPDATES
+#define OTA_DELTA_UPDATES 1
+#endif
+
+// Upper limit for firmware download speed, keeps flash writes and TLS decryption from starving other tasks
+#ifndef OTA_MAX_BYTES_PER_SECOND
+#define OTA_MAX_BYTES_PER_SECOND 32768
+#endif
+
+/**
+ * Struct for firmware download progress
+ */
+struct OtaProgress {
+  bool active;
+  uint32_t written;
+  uint32_t total;
+  uint32_t bytesPerSecond;
+};
+
+void startOtaTask();
+void announceFirmwareUpdate(const char *version, const char *hash);
+void getOtaProgress(OtaProgress *progress);
+bool isOtaRebootPending();
+bool checkFirmwareUpdates();
+bool processOTAUpdate(const String &version, const String &knownHash);
 
 #endif // OTA_UPDATE_H
\ No newline at end of file
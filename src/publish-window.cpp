@@ -0,0 +1,382 @@
+#ifndef PUBLISH_WINDOW_CPP
+#define PUBLISH_WINDOW_CPP
+
+#include <stdint.h>
+#include <string.h>
+
+#define MQTT_PUBLISH_PACKET 0x30
+#define MQTT_PUBACK_PACKET 0x40
+#define MQTT_DUP_FLAG 0x08
+#define MQTT_QOS1_FLAG 0x02
+
+/**
+ * Class for finding PUBACK packets from the bytes MQTT client receives.
+ *
+ * Scanner follows packet boundaries of the incoming stream using fixed headers, so bytes inside other
+ * packets are never mistaken for acknowledgements. Stream must be fed from its first byte, so the scanner
+ * is reset before every new connection.
+ */
+class PubackScanner {
+
+  private:
+
+    enum State { HEADER, LENGTH, BODY };
+
+    State state = HEADER;
+    uint8_t header = 0;
+    uint32_t length = 0;
+    uint32_t multiplier = 1;
+    uint32_t position = 0;
+    uint16_t packetId = 0;
+
+  public:
+
+    /**
+     * Resets scanner to the start of a new stream
+     */
+    void reset() {
+      state = HEADER;
+    }
+
+    /**
+     * Feeds received bytes to the scanner
+     *
+     * @param data received bytes
+     * @param dataLength number of received bytes
+     * @param onPuback handler called with packet id of every PUBACK
+     */
+    template <typename Handler>
+    void feed(const uint8_t *data, size_t dataLength, Handler onPuback) {
+      for (size_t i = 0; i < dataLength; i++) {
+        uint8_t value = data[i];
+        switch (state) {
+        case HEADER:
+          header = value;
+          length = 0;
+          multiplier = 1;
+          state = LENGTH;
+          break;
+        case LENGTH:
+          length += (value & 0x7F) * multiplier;
+          multiplier *= 128;
+          if (value & 0x80) {
+            if (multiplier > 128 * 128 * 128) {
+              // Malformed length, broker closes the connection anyway
+              state = HEADER;
+            }
+            break;
+          }
+          position = 0;
+          packetId = 0;
+          state = length == 0 ? HEADER : BODY;
+          break;
+        case BODY:
+          if (position < 2) {
+            packetId = (packetId << 8) | value;
+          }
+          position++;
+          if (position == length) {
+            if ((header & 0xF0) == MQTT_PUBACK_PACKET && length == 2) {
+              onPuback(packetId);
+            }
+            state = HEADER;
+          }
+          break;
+        }
+      }
+    }
+};
+
+/**
+ * Class for QoS 1 publishing with in-flight window.
+ *
+ * Messages are encoded to PUBLISH packets and written without waiting for the broker, up to window size
+ * messages at a time. Every message stays in the window until its PUBACK is received, and messages still
+ * in the window are sent again with DUP flag after reconnecting, in the order they were first sent.
+ * Time from first send to PUBACK is tracked as publish latency.
+ *
+ * Packet identifiers are taken from the upper half of the identifier space so that they do not collide
+ * with the identifiers MQTT client library uses for its own packets.
+ */
+class PublishWindow {
+
+  public:
+
+    const static uint8_t maxWindowSize = 32;
+    const static uint16_t maxPacketSize = 320;
+    const static uint16_t noReference = 0xFFFF;
+
+  private:
+
+    const static uint16_t firstPacketId = 0x8000;
+
+    /**
+     * Struct for message waiting for PUBACK
+     */
+    struct InFlightMessage {
+      uint16_t packetId;
+      uint16_t length;
+      uint16_t reference;
+      unsigned long firstSent;
+      unsigned long lastSent;
+      uint8_t packet[maxPacketSize];
+    };
+
+    // Ordered by first send time
+    InFlightMessage messages[maxWindowSize];
+    uint8_t inFlight = 0;
+    uint8_t windowSize = maxWindowSize;
+    uint16_t nextPacketId = firstPacketId;
+
+    uint32_t acknowledgedCount = 0;
+    uint32_t retransmitCount = 0;
+    uint32_t latencyMs = 0;
+    uint32_t maxLatencyMs = 0;
+
+    /**
+     * Returns next packet identifier that is not in flight
+     */
+    uint16_t allocatePacketId() {
+      while (true) {
+        uint16_t packetId = nextPacketId;
+        nextPacketId = nextPacketId == 0xFFFF ? firstPacketId : nextPacketId + 1;
+
+        bool used = false;
+        for (uint8_t i = 0; i < inFlight; i++) {
+          if (messages[i].packetId == packetId) {
+            used = true;
+            break;
+          }
+        }
+        if (!used) {
+          return packetId;
+        }
+      }
+    }
+
+  public:
+
+    /**
+     * Returns length of QoS 1 PUBLISH packet
+     *
+     * @param topicLength topic length
+     * @param payloadLength payload length
+     */
+    static uint32_t getPacketLength(size_t topicLength, size_t payloadLength) {
+      uint32_t remainingLength = 2 + topicLength + 2 + payloadLength;
+      uint32_t lengthBytes = remainingLength < 128 ? 1 : remainingLength < 16384 ? 2 : 3;
+      return 1 + lengthBytes + remainingLength;
+    }
+
+    /**
+     * Checks whether message fits to the window
+     *
+     * @param topicLength topic length
+     * @param payloadLength payload length
+     */
+    static bool fits(size_t topicLength, size_t payloadLength) {
+      return getPacketLength(topicLength, payloadLength) <= maxPacketSize;
+    }
+
+    /**
+     * Encodes QoS 1 PUBLISH packet
+     *
+     * @param topic topic
+     * @param payload payload
+     * @param payloadLength payload length
+     * @param packetId packet identifier
+     * @param packet buffer for the packet
+     * @param capacity buffer capacity
+     * @return packet length or 0 if packet does not fit to buffer
+     */
+    static uint16_t encodePublish(const char *topic, const char *payload, size_t payloadLength, uint16_t packetId, uint8_t *packet, uint16_t capacity) {
+      size_t topicLength = strlen(topic);
+      if (getPacketLength(topicLength, payloadLength) > capacity) {
+        return 0;
+      }
+
+      uint16_t position = 0;
+      packet[position++] = MQTT_PUBLISH_PACKET | MQTT_QOS1_FLAG;
+      uint32_t remainingLength = 2 + topicLength + 2 + payloadLength;
+      do {
+        uint8_t value = remainingLength % 128;
+        remainingLength /= 128;
+        packet[position++] = remainingLength > 0 ? value | 0x80 : value;
+      } while (remainingLength > 0);
+
+      packet[position++] = topicLength >> 8;
+      packet[position++] = topicLength & 0xFF;
+      memcpy(packet + position, topic, topicLength);
+      position += topicLength;
+      packet[position++] = packetId >> 8;
+      packet[position++] = packetId & 0xFF;
+      memcpy(packet + position, payload, payloadLength);
+      return position + payloadLength;
+    }
+
+    /**
+     * Sets number of messages that may wait for PUBACK at once. Messages already in flight are kept
+     *
+     * @param size window size, at most maxWindowSize
+     */
+    void setWindowSize(uint8_t size) {
+      windowSize = size > maxWindowSize ? maxWindowSize : size;
+    }
+
+    /**
+     * Encodes message into the window and writes it
+     *
+     * @param topic topic
+     * @param payload payload
+     * @param payloadLength payload length
+     * @param now current time in milliseconds
+     * @param write writer called with packet bytes and length, returns whether writing succeeded
+     * @param reference caller defined value the message refers to, such as tag session id, kept until PUBACK
+     * @return whether message was taken into the window. Message that could not be written is sent again
+     * after reconnecting
+     */
+    template <typename Writer>
+    bool publish(const char *topic, const char *payload, size_t payloadLength, unsigned long now, Writer write, uint16_t reference = noReference) {
+      if (inFlight >= windowSize) {
+        return false;
+      }
+
+      InFlightMessage &message = messages[inFlight];
+      message.packetId = allocatePacketId();
+      message.length = encodePublish(topic, payload, payloadLength, message.packetId, message.packet, maxPacketSize);
+      if (message.length == 0) {
+        return false;
+      }
+      message.reference = reference;
+      message.firstSent = now;
+      message.lastSent = now;
+      inFlight++;
+
+      write(message.packet, message.length);
+      return true;
+    }
+
+    /**
+     * Removes acknowledged message from the window
+     *
+     * @param packetId packet identifier of received PUBACK
+     * @param now current time in milliseconds
+     * @return whether message was in flight
+     */
+    bool acknowledge(uint16_t packetId, unsigned long now) {
+      for (uint8_t i = 0; i < inFlight; i++) {
+        if (messages[i].packetId != packetId) {
+          continue;
+        }
+
+        uint32_t latency = now - messages[i].firstSent;
+        latencyMs = acknowledgedCount == 0 ? latency : (latencyMs * 7 + latency) / 8;
+        if (latency > maxLatencyMs) {
+          maxLatencyMs = latency;
+        }
+        acknowledgedCount++;
+
+        for (uint8_t j = i + 1; j < inFlight; j++) {
+          messages[j - 1] = messages[j];
+        }
+        inFlight--;
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * Sends messages in flight again with DUP flag. Called after reconnecting
+     *
+     * @param now current time in milliseconds
+     * @param write writer called with packet bytes and length, returns whether writing succeeded
+     * @return number of messages sent again
+     */
+    template <typename Writer>
+    uint8_t retransmit(unsigned long now, Writer write) {
+      uint8_t sent = 0;
+      for (uint8_t i = 0; i < inFlight; i++) {
+        messages[i].packet[0] |= MQTT_DUP_FLAG;
+        messages[i].lastSent = now;
+        if (!write(messages[i].packet, messages[i].length)) {
+          break;
+        }
+        sent++;
+      }
+      retransmitCount += sent;
+      return sent;
+    }
+
+    /**
+     * Returns time since the oldest message in flight was last sent, or 0 if window is empty
+     *
+     * @param now current time in milliseconds
+     */
+    unsigned long getOldestAge(unsigned long now) {
+      unsigned long oldest = 0;
+      for (uint8_t i = 0; i < inFlight; i++) {
+        if (now - messages[i].lastSent > oldest) {
+          oldest = now - messages[i].lastSent;
+        }
+      }
+      return oldest;
+    }
+
+    /**
+     * Checks whether a message waiting for PUBACK refers to given value
+     *
+     * @param reference reference given to publish
+     */
+    bool isReferenced(uint16_t reference) {
+      for (uint8_t i = 0; i < inFlight; i++) {
+        if (messages[i].reference == reference) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * Returns number of messages that can still be taken into the window
+     */
+    uint8_t getFree() {
+      return inFlight >= windowSize ? 0 : windowSize - inFlight;
+    }
+
+    /**
+     * Returns number of messages waiting for PUBACK
+     */
+    uint8_t getInFlight() {
+      return inFlight;
+    }
+
+    /**
+     * Returns number of acknowledged messages
+     */
+    uint32_t getAcknowledgedCount() {
+      return acknowledgedCount;
+    }
+
+    /**
+     * Returns number of messages sent again after reconnecting
+     */
+    uint32_t getRetransmitCount() {
+      return retransmitCount;
+    }
+
+    /**
+     * Returns smoothed publish latency in milliseconds
+     */
+    uint32_t getLatencyMs() {
+      return latencyMs;
+    }
+
+    /**
+     * Returns highest publish latency in milliseconds
+     */
+    uint32_t getMaxLatencyMs() {
+      return maxLatencyMs;
+    }
+};
+
+#endif // PUBLISH_WINDOW_CPP
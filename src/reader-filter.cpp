@@ -0,0 +1,135 @@
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include "reader-filter.h"
+#include "message-parser.cpp"
+#include "logger.h"
+
+#define READER_FILTER_NAMESPACE "reader-filter"
+#define READER_FILTER_KEY "filter"
+// EPC memory bank has CRC (16 bits), PC (16 bits) and up to 496 bits of EPC
+#define READER_FILTER_MAX_BIT_ADDRESS 528
+
+/**
+ * Converts hex character to its value
+ *
+ * @param c hex character
+ * @return value or -1 if character is not hex
+ */
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Parses reader filter from MQTT message payload. Example payload:
+ * { "enabled": true, "start": 32, "mask": "E200", "length": 16 }
+ *
+ * Start is a bit address in EPC memory bank, so 32 is the first bit of EPC.
+ * Length defaults to the full length of the mask and is at most 255 bits
+ *
+ * @param payload MQTT message payload
+ * @param filter parsed filter
+ * @return whether payload contained a valid filter
+ */
+bool parseReaderFilter(const String &payload, ReaderFilter *filter) {
+  StaticJsonDocument<256> doc;
+  if (deserializeJson(doc, payload)) {
+    LOG_WARNING("Invalid reader filter message");
+    return false;
+  }
+
+  ReaderFilter result = {};
+  result.enabled = doc["enabled"] | false;
+  if (!result.enabled) {
+    *filter = result;
+    return true;
+  }
+
+  const char *mask = doc["mask"] | "";
+  size_t maskLength = strlen(mask);
+  if (maskLength == 0 || maskLength % 2 != 0 || maskLength / 2 > READER_FILTER_MAX_MASK_BYTES) {
+    LOG_WARNING("Invalid reader filter mask");
+    return false;
+  }
+
+  for (size_t i = 0; i < maskLength; i += 2) {
+    int high = hexValue(mask[i]);
+    int low = hexValue(mask[i + 1]);
+    if (high < 0 || low < 0) {
+      LOG_WARNING("Invalid reader filter mask");
+      return false;
+    }
+    result.mask[i / 2] = (high << 4) + low;
+  }
+
+  uint16_t startBit = doc["start"] | 32;
+  uint16_t maskBitLength = doc["length"] | (uint16_t) (maskLength * 4);
+  if (maskBitLength == 0 || maskBitLength > maskLength * 4 || maskBitLength > READER_FILTER_MAX_MASK_BITS || startBit + maskBitLength > READER_FILTER_MAX_BIT_ADDRESS) {
+    LOG_WARNING("Invalid reader filter range");
+    return false;
+  }
+
+  result.startBit = startBit;
+  result.maskBitLength = maskBitLength;
+  *filter = result;
+  return true;
+}
+
+/**
+ * Loads reader filter from NVS. Filter is disabled if nothing has been stored
+ *
+ * @param filter loaded filter
+ */
+void loadReaderFilter(ReaderFilter *filter) {
+  Preferences preferences;
+  *filter = {};
+  preferences.begin(READER_FILTER_NAMESPACE, true);
+  if (preferences.getBytesLength(READER_FILTER_KEY) == sizeof(ReaderFilter)) {
+    preferences.getBytes(READER_FILTER_KEY, filter, sizeof(ReaderFilter));
+  }
+  preferences.end();
+}
+
+/**
+ * Stores reader filter to NVS
+ *
+ * @param filter filter to store
+ */
+void saveReaderFilter(const ReaderFilter &filter) {
+  Preferences preferences;
+  preferences.begin(READER_FILTER_NAMESPACE, false);
+  preferences.putBytes(READER_FILTER_KEY, &filter, sizeof(ReaderFilter));
+  preferences.end();
+}
+
+/**
+ * Constructs inventory filtering setting command. Disabled filter clears the filter from the reader
+ *
+ * @param filter reader filter
+ * @param command buffer for the command, must fit READER_FILTER_MAX_MASK_BYTES + 13 values
+ * @return command length
+ */
+uint32_t constructReaderFilterCommand(const ReaderFilter &filter, uint32_t command[]) {
+  MessageParser parser;
+  uint32_t payload[READER_FILTER_MAX_MASK_BYTES + 5];
+  uint32_t maskBytes = filter.enabled ? (filter.maskBitLength + 7) / 8 : 0;
+
+  payload[0] = filter.enabled ? 0x01 : 0x00;
+  payload[1] = READER_FILTER_EPC_MEMORY_BANK;
+  payload[2] = (filter.startBit >> 8) & 0xFF;
+  payload[3] = filter.startBit & 0xFF;
+  payload[4] = filter.enabled ? filter.maskBitLength : 0;
+  for (uint32_t i = 0; i < maskBytes; i++) {
+    payload[5 + i] = filter.mask[i];
+  }
+
+  return parser.constructCommand(INVENTORY_FILTERING_SETTING, payload, maskBytes + 5, command);
+}
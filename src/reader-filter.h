@@ -0,0 +1,27 @@
+#ifndef READER_FILTER_H
+#define READER_FILTER_H
+
+#include <Arduino.h>
+
+#define READER_FILTER_MAX_MASK_BYTES 32
+// Mask length is sent to the reader as a single byte
+#define READER_FILTER_MAX_MASK_BITS 255
+#define READER_FILTER_EPC_MEMORY_BANK 0x01
+
+/**
+ * Struct for reader side inventory filter. Reader only reports tags whose EPC memory
+ * matches the mask starting from given bit address
+ */
+struct ReaderFilter {
+  bool enabled;
+  uint16_t startBit;
+  uint8_t maskBitLength;
+  uint8_t mask[READER_FILTER_MAX_MASK_BYTES];
+};
+
+bool parseReaderFilter(const String &payload, ReaderFilter *filter);
+void loadReaderFilter(ReaderFilter *filter);
+void saveReaderFilter(const ReaderFilter &filter);
+uint32_t constructReaderFilterCommand(const ReaderFilter &filter, uint32_t command[]);
+
+#endif // READER_FILTER_H
@@ -0,0 +1,104 @@
+#ifndef READER_FRAME_DECODER_CPP
+#define READER_FRAME_DECODER_CPP
+
+#include <stdint.h>
+#include "./types/reader-frame.h"
+
+/**
+ * Class for decoding reader frames from UART byte stream. Every reader port has its own decoder, so
+ * bytes of one reader never end up in frames of another. Frames are delimited by the declared length
+ * so that marker bytes inside EPCs do not split or restart frames
+ */
+class ReaderFrameDecoder {
+
+  private:
+
+    const static uint8_t firstStartMarker = 0xA5;
+    const static uint8_t secondStartMarker = 0x5A;
+
+    ReaderFrame currentFrame;
+    bool recvInProgress = false;
+    uint8_t previousByte = 0;
+    uint32_t invalidLengthCount = 0;
+
+    /**
+     * Returns frame length declared in the frame header
+     */
+    uint16_t getDeclaredLength() {
+      return (currentFrame.data[2] << 8) + currentFrame.data[3];
+    }
+
+  public:
+
+    /**
+     * Creates decoder for given reader
+     *
+     * @param reader reader id set to decoded frames
+     */
+    ReaderFrameDecoder(uint8_t reader = 0) {
+      currentFrame.reader = reader;
+      currentFrame.length = 0;
+    }
+
+    /**
+     * Resets decoder state, for example after bytes have been lost
+     */
+    void reset() {
+      recvInProgress = false;
+      previousByte = 0;
+      currentFrame.length = 0;
+    }
+
+    /**
+     * Feeds single received byte to the decoder
+     *
+     * @param rc received byte
+     * @param complete called with every complete frame
+     */
+    template <typename FrameHandler>
+    void decode(uint8_t rc, FrameHandler complete) {
+      bool lengthKnown = recvInProgress && currentFrame.length >= 4;
+
+      if (!lengthKnown && previousByte == firstStartMarker && rc == secondStartMarker) {
+        // Message start detected
+        recvInProgress = true;
+        currentFrame.data[0] = previousByte;
+        currentFrame.data[1] = rc;
+        currentFrame.length = 2;
+      } else if (recvInProgress) {
+        currentFrame.data[currentFrame.length] = rc;
+        currentFrame.length++;
+
+        if (currentFrame.length == 4) {
+          uint16_t declaredLength = getDeclaredLength();
+          if (declaredLength < 8 || declaredLength > READER_FRAME_MAX_LENGTH) {
+            invalidLengthCount++;
+            reset();
+            return;
+          }
+        }
+
+        if (currentFrame.length >= 4 && currentFrame.length == getDeclaredLength()) {
+          recvInProgress = false;
+          complete(currentFrame);
+        }
+      }
+      previousByte = rc;
+    }
+
+    /**
+     * Returns reader id of the decoder
+     */
+    uint8_t getReader() {
+      return currentFrame.reader;
+    }
+
+    /**
+     * Returns number of frames dropped because of invalid declared length
+     */
+    uint32_t getInvalidLengthCount() {
+      return invalidLengthCount;
+    }
+};
+
+#endif // READER_FRAME_DECODER_CPP
@@ -0,0 +1,198 @@
+#include "reader-uart.h"
+#include "reader-frame-decoder.cpp"
+#include "logger.h"
+
+#define READER_UART_READ_CHUNK_SIZE 128
+#define READER_UART_RXFIFO_FULL_THRESHOLD 32
+#define READER_UART_RX_TIMEOUT_THRESHOLD 2
+#define READER_UART_TASK_STACK_SIZE 4096
+#define READER_UART_TASK_PRIORITY 3
+#define READER_UART_TASK_CORE 1
+
+/**
+ * Struct for UART port of single reader. Decoder is only touched from the task of the port
+ */
+struct ReaderPort {
+  uart_port_t port;
+  int rxPin;
+  int txPin;
+  QueueHandle_t eventQueue;
+  ReaderFrameDecoder decoder;
+  volatile uint32_t overflowCount;
+  uint32_t invalidLengthCount;
+};
+
+static ReaderPort readerPorts[READER_COUNT] = {
+  { READER_UART_PORT, READER_UART_RX_PIN, READER_UART_TX_PIN, NULL, ReaderFrameDecoder(0), 0, 0 },
+#if READER_COUNT > 1
+  { READER2_UART_PORT, READER2_UART_RX_PIN, READER2_UART_TX_PIN, NULL, ReaderFrameDecoder(1), 0, 0 },
+#endif
+};
+
+static QueueHandle_t frameQueue = NULL;
+static volatile uint32_t frameDropCount = 0;
+
+/**
+ * Hands complete frame over to the main loop
+ *
+ * @param frame decoded frame
+ */
+static void completeFrame(const ReaderFrame &frame) {
+  if (xQueueSend(frameQueue, &frame, 0) != pdTRUE) {
+    frameDropCount++;
+  }
+}
+
+/**
+ * Reads everything the driver has buffered for the port and feeds it to its decoder
+ *
+ * @param port reader port
+ */
+static void drainReaderUart(ReaderPort &port) {
+  uint8_t chunk[READER_UART_READ_CHUNK_SIZE];
+  size_t buffered = 0;
+  uart_get_buffered_data_len(port.port, &buffered);
+
+  while (buffered > 0) {
+    size_t toRead = buffered < sizeof(chunk) ? buffered : sizeof(chunk);
+    int read = uart_read_bytes(port.port, chunk, toRead, 0);
+    if (read <= 0) {
+      break;
+    }
+
+    for (int i = 0; i < read; i++) {
+      port.decoder.decode(chunk[i], completeFrame);
+    }
+    buffered -= read;
+  }
+
+  if (port.decoder.getInvalidLengthCount() != port.invalidLengthCount) {
+    port.invalidLengthCount = port.decoder.getInvalidLengthCount();
+    LOG_WARNING("Invalid frame length from reader %u, losing data", port.decoder.getReader());
+  }
+}
+
+/**
+ * Reader task. Sleeps on the UART event queue of its port and decodes frames as soon as the driver reports data
+ *
+ * @param parameter reader port
+ */
+static void readerUartTask(void *parameter) {
+  ReaderPort &port = *(ReaderPort *) parameter;
+  uart_event_t event;
+
+  for (;;) {
+    if (xQueueReceive(port.eventQueue, &event, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+
+    switch (event.type) {
+    case UART_DATA:
+      drainReaderUart(port);
+      break;
+    case UART_BUFFER_FULL:
+      // Ring buffer is still intact, consume it and let the decoder resync on the next header
+      port.overflowCount++;
+      drainReaderUart(port);
+      break;
+    case UART_FIFO_OVF:
+      // Hardware FIFO overflowed, bytes are missing mid-stream
+      port.overflowCount++;
+      uart_flush_input(port.port);
+      xQueueReset(port.eventQueue);
+      port.decoder.reset();
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/**
+ * Installs UART driver for reader port and starts its reader task
+ *
+ * @param port reader port
+ * @param baudRate reader baud rate
+ */
+static void initializeReaderPort(ReaderPort &port, int baudRate) {
+  uart_config_t config = {};
+  config.baud_rate = baudRate;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity = UART_PARITY_DISABLE;
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+
+  uart_param_config(port.port, &config);
+  uart_set_pin(port.port, port.txPin, port.rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  uart_driver_install(port.port, READER_UART_RX_BUFFER_SIZE, READER_UART_TX_BUFFER_SIZE, READER_UART_EVENT_QUEUE_SIZE, &port.eventQueue, 0);
+
+  // Raise data events early so the decoder keeps up with short inventory frames
+  uart_intr_config_t interruptConfig = {};
+  interruptConfig.intr_enable_mask = UART_RXFIFO_FULL_INT_ENA_M | UART_RXFIFO_TOUT_INT_ENA_M | UART_FRM_ERR_INT_ENA_M | UART_RXFIFO_OVF_INT_ENA_M;
+  interruptConfig.rxfifo_full_thresh = READER_UART_RXFIFO_FULL_THRESHOLD;
+  interruptConfig.rx_timeout_thresh = READER_UART_RX_TIMEOUT_THRESHOLD;
+  uart_intr_config(port.port, &interruptConfig);
+
+  port.decoder.reset();
+  xTaskCreatePinnedToCore(readerUartTask, "readerUart", READER_UART_TASK_STACK_SIZE, &port, READER_UART_TASK_PRIORITY, NULL, READER_UART_TASK_CORE);
+}
+
+/**
+ * Installs UART drivers for every reader and starts the reader tasks
+ *
+ * @param baudRate reader baud rate
+ */
+void initializeReaderUart(int baudRate) {
+  frameQueue = xQueueCreate(READER_FRAME_QUEUE_SIZE, sizeof(ReaderFrame));
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++) {
+    initializeReaderPort(readerPorts[reader], baudRate);
+  }
+}
+
+/**
+ * Writes command to a reader
+ *
+ * @param reader reader id
+ * @param command command bytes
+ * @param length command length
+ */
+void writeReaderUart(uint8_t reader, const uint32_t command[], size_t length) {
+  char buffer[READER_FRAME_MAX_LENGTH];
+  if (length > sizeof(buffer)) {
+    length = sizeof(buffer);
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    buffer[i] = command[i];
+  }
+  uart_write_bytes(readerPorts[reader].port, buffer, length);
+}
+
+/**
+ * Takes next decoded frame of any reader without blocking
+ *
+ * @param frame frame to fill, reader of the frame is set
+ * @return whether frame was available
+ */
+bool receiveReaderFrame(ReaderFrame *frame) {
+  if (frameQueue == NULL) {
+    return false;
+  }
+  return xQueueReceive(frameQueue, frame, 0) == pdTRUE;
+}
+
+/**
+ * Returns number of RX overflow events reported by the UART driver of a reader
+ *
+ * @param reader reader id
+ */
+uint32_t getReaderUartOverflowCount(uint8_t reader) {
+  return readerPorts[reader].overflowCount;
+}
+
+/**
+ * Returns number of decoded frames dropped because the main loop fell behind
+ */
+uint32_t getReaderFrameDropCount() {
+  return frameDropCount;
+}
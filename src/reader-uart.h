@@ -0,0 +1,49 @@
+#ifndef READER_UART_H
+#define READER_UART_H
+
+#include <Arduino.h>
+#include <driver/uart.h>
+#include "./types/reader-frame.h"
+
+// Readers are connected to Serial1 and Serial2, UART 0 is the console
+#ifndef READER_COUNT
+#define READER_COUNT 1
+#endif
+#if READER_COUNT < 1 || READER_COUNT > 2
+#error "READER_COUNT must be 1 or 2"
+#endif
+
+#ifndef READER_UART_PORT
+#define READER_UART_PORT UART_NUM_1
+#endif
+#ifndef READER_UART_RX_PIN
+#define READER_UART_RX_PIN 9
+#endif
+#ifndef READER_UART_TX_PIN
+#define READER_UART_TX_PIN 10
+#endif
+
+// Second reader is on the UEXT connector by default
+#ifndef READER2_UART_PORT
+#define READER2_UART_PORT UART_NUM_2
+#endif
+#ifndef READER2_UART_RX_PIN
+#define READER2_UART_RX_PIN 36
+#endif
+#ifndef READER2_UART_TX_PIN
+#define READER2_UART_TX_PIN 4
+#endif
+
+#define READER_UART_RX_BUFFER_SIZE 8192
+#define READER_UART_TX_BUFFER_SIZE 256
+#define READER_UART_EVENT_QUEUE_SIZE 32
+// Frames of every reader share the queue to the main loop
+#define READER_FRAME_QUEUE_SIZE (32 * READER_COUNT)
+
+void initializeReaderUart(int baudRate);
+void writeReaderUart(uint8_t reader, const uint32_t command[], size_t length);
+bool receiveReaderFrame(ReaderFrame *frame);
+uint32_t getReaderUartOverflowCount(uint8_t reader);
+uint32_t getReaderFrameDropCount();
+
+#endif // READER_UART_H
@@ -0,0 +1,232 @@
+#ifndef TAG_INTERNER_CPP
+#define TAG_INTERNER_CPP
+
+#include <stdint.h>
+#include "./types/tag-id.h"
+
+/**
+ * Class for assigning compact session ids to tags.
+ *
+ * Tags are kept in a fixed table and the index of a tag in the table is its session id. Ids are found with
+ * an open addressing hash index, so interning a tag takes constant time. When the table is full the least
+ * recently used tag gives its id to the new tag, except ids that are pinned because messages waiting for
+ * acknowledgement still refer to them. Caller publishes the id to tag mapping before the id is used in any
+ * message, and marks it published only once publishing succeeded, so that a mapping that failed to go out
+ * is tried again on the next use of the id
+ */
+class TagInterner {
+
+  public:
+
+    const static uint16_t capacity = 256;
+    const static uint16_t noSessionId = 0xFFFF;
+
+  private:
+
+    // Hash index is kept at most half full
+    const static uint16_t slotCount = capacity * 2;
+    const static uint16_t slotMask = slotCount - 1;
+
+    /**
+     * Struct for interned tag
+     */
+    struct Entry {
+      TagId id;
+      uint32_t hash;
+      unsigned long lastUsed;
+      bool mappingPublished;
+    };
+
+    Entry entries[capacity];
+    uint16_t count = 0;
+    // Entry index + 1 of each slot, 0 for empty slot
+    uint16_t slots[slotCount] = {};
+    uint32_t evictionCount = 0;
+
+    /**
+     * Calculates FNV-1a hash of tag EPC and TID
+     *
+     * @param id tag id
+     * @return hash
+     */
+    static uint32_t hash(const TagId &id) {
+      uint32_t value = 0x811c9dc5;
+      for (uint8_t i = 0; i < id.epcLength; i++) {
+        value = (value ^ id.epc[i]) * 0x01000193;
+      }
+      value = (value ^ id.tidLength) * 0x01000193;
+      for (uint8_t i = 0; i < id.tidLength; i++) {
+        value = (value ^ id.tid[i]) * 0x01000193;
+      }
+      return value;
+    }
+
+    /**
+     * Finds slot of tag or the empty slot where it would be inserted
+     *
+     * @param id tag id
+     * @param value hash of the tag
+     * @return slot index
+     */
+    uint16_t findSlot(const TagId &id, uint32_t value) {
+      uint16_t slot = value & slotMask;
+      while (slots[slot] != 0) {
+        const Entry &entry = entries[slots[slot] - 1];
+        if (entry.hash == value && entry.id == id) {
+          return slot;
+        }
+        slot = (slot + 1) & slotMask;
+      }
+      return slot;
+    }
+
+    /**
+     * Removes slot from hash index. Following slots of the probe sequence are shifted back
+     * so that lookups do not stop at the hole
+     *
+     * @param slot slot index
+     */
+    void removeSlot(uint16_t slot) {
+      uint16_t hole = slot;
+      uint16_t next = (hole + 1) & slotMask;
+      while (slots[next] != 0) {
+        uint16_t home = entries[slots[next] - 1].hash & slotMask;
+        if (((next - home) & slotMask) >= ((next - hole) & slotMask)) {
+          slots[hole] = slots[next];
+          hole = next;
+        }
+        next = (next + 1) & slotMask;
+      }
+      slots[hole] = 0;
+    }
+
+    /**
+     * Returns index of the least recently used entry that is not pinned
+     *
+     * @param now current time in milliseconds
+     * @param isPinned predicate telling whether session id must keep its tag
+     * @return entry index or noSessionId if every entry is pinned
+     */
+    template <typename Pinned>
+    uint16_t findLeastRecentlyUsed(unsigned long now, Pinned isPinned) {
+      uint16_t oldest = noSessionId;
+      for (uint16_t i = 0; i < count; i++) {
+        if ((oldest == noSessionId || now - entries[i].lastUsed > now - entries[oldest].lastUsed) && !isPinned(i)) {
+          oldest = i;
+        }
+      }
+      return oldest;
+    }
+
+  public:
+
+    /**
+     * Returns session id of tag. Tag that has not been seen gets a free id, or the id of the least
+     * recently used tag that is not pinned when all ids are taken
+     *
+     * @param id tag id
+     * @param now current time in milliseconds
+     * @param mappingPending set to whether mapping of the id has not been published yet and has to be
+     * published before the id is used
+     * @param isPinned predicate telling whether session id must keep its tag, for example because a
+     * message waiting for acknowledgement refers to it
+     * @return session id or noSessionId if every id is pinned
+     */
+    template <typename Pinned>
+    uint16_t intern(const TagId &id, unsigned long now, bool *mappingPending, Pinned isPinned) {
+      uint32_t value = hash(id);
+      uint16_t slot = findSlot(id, value);
+      if (slots[slot] != 0) {
+        Entry &entry = entries[slots[slot] - 1];
+        entry.lastUsed = now;
+        *mappingPending = !entry.mappingPublished;
+        return slots[slot] - 1;
+      }
+
+      uint16_t index;
+      if (count < capacity) {
+        index = count;
+        count++;
+      } else {
+        index = findLeastRecentlyUsed(now, isPinned);
+        if (index == noSessionId) {
+          *mappingPending = false;
+          return noSessionId;
+        }
+        removeSlot(findSlot(entries[index].id, entries[index].hash));
+        slot = findSlot(id, value);
+        evictionCount++;
+      }
+
+      entries[index] = {};
+      entries[index].id = id;
+      entries[index].hash = value;
+      entries[index].lastUsed = now;
+      slots[slot] = index + 1;
+      *mappingPending = true;
+      return index;
+    }
+
+    /**
+     * Returns session id of tag when no id is pinned
+     *
+     * @param id tag id
+     * @param now current time in milliseconds
+     * @param mappingPending set to whether mapping of the id has to be published before the id is used
+     * @return session id
+     */
+    uint16_t intern(const TagId &id, unsigned long now, bool *mappingPending) {
+      return intern(id, now, mappingPending, [](uint16_t) { return false; });
+    }
+
+    /**
+     * Marks mapping of session id published
+     *
+     * @param sessionId session id less than count
+     */
+    void setMappingPublished(uint16_t sessionId) {
+      entries[sessionId].mappingPublished = true;
+    }
+
+    /**
+     * Marks every mapping unpublished, for example when broker may have lost the retained mappings
+     */
+    void invalidateMappings() {
+      for (uint16_t i = 0; i < count; i++) {
+        entries[i].mappingPublished = false;
+      }
+    }
+
+    /**
+     * Returns tag of session id
+     *
+     * @param sessionId session id less than count
+     */
+    const TagId &getTag(uint16_t sessionId) {
+      return entries[sessionId].id;
+    }
+
+    /**
+     * Returns number of assigned session ids
+     */
+    uint16_t getCount() {
+      return count;
+    }
+
+    /**
+     * Returns number of session ids that were given to another tag because table was full
+     */
+    uint32_t getEvictionCount() {
+      return evictionCount;
+    }
+
+    /**
+     * Forgets every tag. Ids are assigned again from 0
+     */
+    void clear() {
+      count = 0;
+      memset(slots, 0, sizeof(slots));
+    }
+};
+
+#endif // TAG_INTERNER_CPP
@@ -0,0 +1,973 @@
+#ifndef TAG_REGISTRY_CPP
+#define TAG_REGISTRY_CPP
+
+#include <stdint.h>
+#include <math.h>
+#include "./types/continue-inventory-response.h"
+#include "./types/tag-registry-item.h"
+#include "./types/tag-read-statistics.h"
+
+/**
+ * Class for tag registry and outgoing message queues.
+ *
+ * Registry keeps track of tags currently seen by each antenna so that appearance and disappearance can be detected.
+ * Presence transitions (appearance and disappearance) go to a priority queue that is always published first and
+ * never shed. Strength updates go to a queue that holds the latest message of each tag and antenna pair, and they
+ * are shed when the queue is full or left for the next flush when the publish budget runs out. Every queued
+ * update also accumulates count, strength range and mean and first and last read time of the reads it stands for.
+ *
+ * In zone mode registry holds one item per tag with its smoothed strength on each antenna. Tag is reported
+ * only on its zone antenna: appearance, disappearance and zone transitions are queued as presence transitions
+ * and strength updates are not published. Zone moves to the strongest antenna when it is stronger than the
+ * zone antenna by the hysteresis, or when the zone antenna no longer sees the tag. Transition is published as
+ * disappearance from the old zone antenna followed by appearance on the new one.
+ *
+ * Tags are considered gone when they have not been seen within disappeared timeout. With adaptive timeout every
+ * registry item tracks smoothed mean and deviation of the interval between its reads, and once enough intervals
+ * have been seen its timeout is the mean plus a number of deviations within bounds. Reads closer to each other
+ * than the sample interval are counted as one, so a burst of reads does not hide the gaps between bursts.
+ * Interval statistics of tags that disappear are kept for a while, and if the tag reappears the gap is taken
+ * as an interval. Tags read often are declared gone soon after they leave, and tags read in bursts at the edge
+ * of the field learn to be kept through the gaps instead of flapping. In zone mode antenna readings are never
+ * dropped before the disappeared timeout.
+ *
+ * Registry can be encoded to presence snapshot that lists every tracked tag with its antenna and strength.
+ * Snapshot becomes stale when tags appear, disappear or move, or when strength of a tag has moved by the
+ * snapshot strength step since it was encoded, so static tags do not make the snapshot stale.
+ *
+ * Registry and pending presence transitions can be saved to a buffer that survives restart and restored from
+ * it, so that tags present before restart are not announced again. Restored tags count as seen at restore,
+ * and tags that left during restart are declared gone when their timeout passes.
+ *
+ * Event listener gets every presence transition and strength update as it is queued, independent of flushing,
+ * for consumers such as the local event stream that must not wait for the broker.
+ */
+class TagRegistry {
+
+  public:
+
+    typedef void (*EventListener)(const TagId &id, double strength, uint16_t antenna);
+
+    const static uint16_t registryBufferSize = 100;
+    const static uint16_t queueBufferSize = 100;
+    // Every registry item can have both a disappearance and a reappearance pending
+    const static uint16_t presenceBufferSize = registryBufferSize * 2;
+
+    const static uint8_t snapshotFormatVersion = 1;
+    const static uint8_t snapshotHeaderLength = 4;
+    const static uint8_t snapshotTruncatedFlag = 0x01;
+    const static uint8_t snapshotStrengthStep = 5;
+
+    const static uint8_t stateFormatVersion = 1;
+    const static uint8_t stateHeaderLength = 5;
+
+    const static unsigned long defaultDisappearedTimeout = 1500;
+    // Intervals needed before adaptive timeout replaces disappeared timeout
+    const static uint8_t timeoutMinSamples = 4;
+    // Shortest interval sampled, reads closer to the previous sample are part of the same sample
+    const static unsigned long intervalSampleMs = 100;
+    const static uint8_t goneBufferSize = 16;
+    // Deviations of read interval added to mean read interval
+    const static uint8_t timeoutDeviations = 4;
+
+  private:
+
+    /**
+     * Struct for queued strength update and statistics of the reads coalesced into it
+     */
+    struct StrengthUpdate {
+      ContinueInventoryMessage message;
+      TagReadStatistics statistics;
+    };
+
+    TagRegistryItem registry[registryBufferSize];
+    uint16_t registryLength = 0;
+
+    ContinueInventoryMessage presenceQueue[presenceBufferSize];
+    uint16_t presenceQueueLength = 0;
+
+    StrengthUpdate queue[queueBufferSize];
+    uint16_t queueLength = 0;
+
+    unsigned long disappearedTimeout = defaultDisappearedTimeout;
+    bool adaptiveTimeout = false;
+    unsigned long minTimeout = 0;
+    unsigned long maxTimeout = 0;
+
+    // Earliest time some registry item or reading may expire, found during previous flush and kept up
+    // to date when items are added
+    unsigned long nextExpiry = 0;
+    bool expiryKnown = false;
+
+    uint32_t registryOverflowCount = 0;
+    uint32_t presenceOverflowCount = 0;
+    uint32_t shedCount = 0;
+
+    bool zoneMode = false;
+    float zoneHysteresis = 0;
+    uint32_t zoneTransitionCount = 0;
+
+    bool snapshotStale = true;
+
+    EventListener listener = NULL;
+
+    /**
+     * Struct for interval statistics of disappeared tag
+     */
+    struct GoneItem {
+      TagId id;
+      int16_t antenna;
+      unsigned long lastSeen;
+      unsigned long lastSampled;
+      float intervalMean;
+      float intervalVariance;
+      uint8_t intervalCount;
+    };
+
+    // Ring buffer of recently disappeared tags
+    GoneItem goneItems[goneBufferSize] = {};
+    uint8_t goneNext = 0;
+
+    /**
+     * Gives event to the listener as it is queued
+     *
+     * @param message presence transition or strength update
+     */
+    void notify(const ContinueInventoryMessage &message) {
+      if (listener != NULL) {
+        listener(message.id, message.strength, message.antenna);
+      }
+    }
+
+    /**
+     * Adds presence transition to priority queue
+     *
+     * @param message presence message, strength of 0 for disappearance
+     */
+    void addPresence(const ContinueInventoryMessage &message) {
+      notify(message);
+      if (presenceQueueLength >= presenceBufferSize) {
+        presenceOverflowCount++;
+        return;
+      }
+      presenceQueue[presenceQueueLength] = message;
+      presenceQueueLength++;
+    }
+
+    /**
+     * Returns strength rounded to 0-100 for encoding
+     *
+     * @param strength strength
+     */
+    static uint8_t roundStrength(float strength) {
+      strength = strength < 0 ? 0 : strength > 100 ? 100 : strength;
+      return (uint8_t) (strength + 0.5f);
+    }
+
+    /**
+     * Returns number of bytes tag takes when encoded
+     *
+     * @param id tag id
+     */
+    static size_t getEncodedTagLength(const TagId &id) {
+      return id.epcLength + id.tidLength + 4;
+    }
+
+    /**
+     * Writes tag as EPC length, EPC, TID length, TID, antenna and strength
+     *
+     * @param buffer target buffer
+     * @param position position of the tag in buffer
+     * @param id tag id
+     * @param antenna antenna id
+     * @param strength strength rounded to 0-100
+     * @return position after the tag
+     */
+    static size_t encodeTag(uint8_t *buffer, size_t position, const TagId &id, int16_t antenna, uint8_t strength) {
+      buffer[position++] = id.epcLength;
+      memcpy(buffer + position, id.epc, id.epcLength);
+      position += id.epcLength;
+      buffer[position++] = id.tidLength;
+      memcpy(buffer + position, id.tid, id.tidLength);
+      position += id.tidLength;
+      buffer[position++] = antenna;
+      buffer[position++] = strength;
+      return position;
+    }
+
+    /**
+     * Reads tag written by encodeTag
+     *
+     * @param buffer source buffer
+     * @param length buffer length
+     * @param position position of the tag in buffer
+     * @param message decoded tag id, antenna and strength
+     * @return position after the tag or 0 if tag is malformed
+     */
+    static size_t decodeTag(const uint8_t *buffer, size_t length, size_t position, ContinueInventoryMessage *message) {
+      if (position + 1 > length) {
+        return 0;
+      }
+      uint8_t epcLength = buffer[position++];
+      if (epcLength == 0 || epcLength > TAG_EPC_MAX_BYTES || position + epcLength + 1 > length) {
+        return 0;
+      }
+      message->id = {};
+      message->id.epcLength = epcLength;
+      memcpy(message->id.epc, buffer + position, epcLength);
+      position += epcLength;
+
+      uint8_t tidLength = buffer[position++];
+      if (tidLength > TAG_TID_MAX_BYTES || position + tidLength + 2 > length) {
+        return 0;
+      }
+      message->id.tidLength = tidLength;
+      memcpy(message->id.tid, buffer + position, tidLength);
+      position += tidLength;
+      message->antenna = buffer[position++];
+      message->strength = buffer[position++];
+      return position;
+    }
+
+    /**
+     * Removes pending strength update of given tag and antenna pair
+     *
+     * @param id tag id
+     * @param antenna antenna id
+     */
+    void removeFromQueue(const TagId &id, int16_t antenna) {
+      for (uint16_t i = 0; i < queueLength; i++) {
+        if (queue[i].message.antenna == antenna && queue[i].message.id == id) {
+          for (uint16_t j = i + 1; j < queueLength; j++) {
+            queue[j - 1] = queue[j];
+          }
+          queueLength--;
+          return;
+        }
+      }
+    }
+
+    /**
+     * Adds strength update to queue. Pending update of the same tag and antenna pair is replaced
+     * and the read is added to its statistics
+     *
+     * @param message strength update
+     * @param now current time in milliseconds
+     */
+    void queueStrengthUpdate(const ContinueInventoryMessage &message, unsigned long now) {
+      notify(message);
+      float strength = message.strength;
+      for (uint16_t i = 0; i < queueLength; i++) {
+        StrengthUpdate &update = queue[i];
+        if (update.message.antenna == message.antenna && update.message.id == message.id) {
+          TagReadStatistics &statistics = update.statistics;
+          update.message = message;
+          statistics.count++;
+          statistics.minStrength = strength < statistics.minStrength ? strength : statistics.minStrength;
+          statistics.maxStrength = strength > statistics.maxStrength ? strength : statistics.maxStrength;
+          statistics.meanStrength += (strength - statistics.meanStrength) / statistics.count;
+          statistics.lastSeen = now;
+          return;
+        }
+      }
+
+      if (queueLength >= queueBufferSize) {
+        shedCount++;
+        return;
+      }
+      queue[queueLength] = { message, { 1, strength, strength, strength, now, now } };
+      queueLength++;
+    }
+
+    /**
+     * Finds tag reading of given antenna
+     *
+     * @param item registry item
+     * @param antenna antenna id
+     * @return reading or NULL if antenna does not see the tag
+     */
+    static TagReading *findReading(TagRegistryItem &item, int16_t antenna) {
+      for (uint8_t i = 0; i < item.readingCount; i++) {
+        if (item.readings[i].antenna == antenna) {
+          return &item.readings[i];
+        }
+      }
+      return NULL;
+    }
+
+    /**
+     * Returns reading of the antenna that sees tag strongest
+     *
+     * @param item registry item with at least one reading
+     */
+    static TagReading *getStrongestReading(TagRegistryItem &item) {
+      TagReading *strongest = &item.readings[0];
+      for (uint8_t i = 1; i < item.readingCount; i++) {
+        if (item.readings[i].strength > strongest->strength) {
+          strongest = &item.readings[i];
+        }
+      }
+      return strongest;
+    }
+
+    /**
+     * Updates smoothed strength of tag on message antenna. Reading of the antenna that has not seen the tag
+     * for longest is replaced when all reading slots are taken
+     *
+     * @param item registry item
+     * @param message messaged received from serial
+     * @param now current time in milliseconds
+     */
+    static void updateReading(TagRegistryItem &item, const ContinueInventoryMessage &message, unsigned long now) {
+      TagReading *reading = findReading(item, message.antenna);
+      if (reading != NULL) {
+        reading->strength = (reading->strength * 3 + message.strength) / 4;
+        reading->lastSeen = now;
+        return;
+      }
+
+      if (item.readingCount < ZONE_MAX_ANTENNAS) {
+        reading = &item.readings[item.readingCount];
+        item.readingCount++;
+      } else {
+        reading = &item.readings[0];
+        for (uint8_t i = 1; i < item.readingCount; i++) {
+          if (item.readings[i].lastSeen < reading->lastSeen) {
+            reading = &item.readings[i];
+          }
+        }
+      }
+      *reading = { message.antenna, (float) message.strength, now };
+    }
+
+    /**
+     * Updates smoothed strength of registry item. Presence snapshot becomes stale when strength has moved
+     * by the snapshot strength step from the encoded value
+     *
+     * @param item registry item
+     * @param strength new smoothed strength
+     */
+    void updateStrength(TagRegistryItem &item, float strength) {
+      item.strength = strength;
+      float change = strength - item.snapshotStrength;
+      if (change >= snapshotStrengthStep || change <= -snapshotStrengthStep) {
+        snapshotStale = true;
+      }
+    }
+
+    /**
+     * Returns timeout after which registry item is considered gone
+     *
+     * @param item registry item
+     */
+    unsigned long getTimeout(const TagRegistryItem &item) {
+      return adaptiveTimeout && item.intervalCount >= timeoutMinSamples ? item.timeoutMs : disappearedTimeout;
+    }
+
+    /**
+     * Returns timeout after which zone mode antenna reading is dropped. Adaptive timeout
+     * extends but never shortens it
+     *
+     * @param item registry item
+     */
+    unsigned long getReadingTimeout(const TagRegistryItem &item) {
+      unsigned long timeout = getTimeout(item);
+      return timeout > disappearedTimeout ? timeout : disappearedTimeout;
+    }
+
+    /**
+     * Moves next expiry earlier if given expiry time comes first
+     *
+     * @param expiry expiry time
+     */
+    void trackExpiry(unsigned long expiry) {
+      if (!expiryKnown || (long) (expiry - nextExpiry) < 0) {
+        nextExpiry = expiry;
+        expiryKnown = true;
+      }
+    }
+
+    /**
+     * Adds interval to smoothed interval statistics of registry item and updates its timeout
+     *
+     * @param item registry item
+     * @param interval interval in milliseconds
+     */
+    void addIntervalSample(TagRegistryItem &item, float interval) {
+      if (item.intervalCount == 0) {
+        item.intervalMean = interval;
+        item.intervalVariance = 0;
+      } else {
+        float difference = interval - item.intervalMean;
+        item.intervalMean += difference / 8;
+        item.intervalVariance = (item.intervalVariance + difference * difference / 8) * 7 / 8;
+      }
+      if (item.intervalCount < 0xFF) {
+        item.intervalCount++;
+      }
+
+      float timeout = item.intervalMean + timeoutDeviations * sqrtf(item.intervalVariance);
+      item.timeoutMs = timeout < minTimeout ? minTimeout : timeout > maxTimeout ? maxTimeout : (uint32_t) timeout;
+    }
+
+    /**
+     * Updates last seen time and read interval statistics of registry item with a new read
+     *
+     * @param item registry item
+     * @param now current time in milliseconds
+     */
+    void recordRead(TagRegistryItem &item, unsigned long now) {
+      if (now - item.lastSampled >= intervalSampleMs) {
+        addIntervalSample(item, now - item.lastSampled);
+        item.lastSampled = now;
+      }
+      item.lastSeen = now;
+      trackExpiry(now + getTimeout(item));
+    }
+
+    /**
+     * Keeps interval statistics of disappeared registry item
+     *
+     * @param item registry item
+     */
+    void rememberGone(const TagRegistryItem &item) {
+      if (!adaptiveTimeout) {
+        return;
+      }
+      goneItems[goneNext] = { item.id, item.antenna, item.lastSeen, item.lastSampled, item.intervalMean, item.intervalVariance, item.intervalCount };
+      goneNext = (goneNext + 1) % goneBufferSize;
+    }
+
+    /**
+     * Restores interval statistics of reappearing tag and takes the gap as an interval. Statistics
+     * are kept for maximum adaptive timeout
+     *
+     * @param item new registry item
+     * @param now current time in milliseconds
+     */
+    void restoreGone(TagRegistryItem &item, unsigned long now) {
+      for (uint8_t i = 0; adaptiveTimeout && i < goneBufferSize; i++) {
+        GoneItem &gone = goneItems[i];
+        if (gone.id.empty() || gone.id != item.id || (!zoneMode && gone.antenna != item.antenna)) {
+          continue;
+        }
+
+        if (now - gone.lastSeen <= maxTimeout) {
+          item.intervalMean = gone.intervalMean;
+          item.intervalVariance = gone.intervalVariance;
+          item.intervalCount = gone.intervalCount;
+          addIntervalSample(item, now - gone.lastSampled);
+        }
+        gone.id.epcLength = 0;
+        return;
+      }
+    }
+
+    /**
+     * Adds new item to registry and queues its appearance
+     *
+     * @param message messaged received from serial
+     * @param now current time in milliseconds
+     * @return added item
+     */
+    TagRegistryItem &addItem(const ContinueInventoryMessage &message, unsigned long now) {
+      TagRegistryItem &item = registry[registryLength];
+      item = {};
+      item.id = message.id;
+      item.lastSeen = now;
+      item.antenna = message.antenna;
+      item.strength = message.strength;
+      item.lastSampled = now;
+      restoreGone(item, now);
+      trackExpiry(now + getTimeout(item));
+      registryLength++;
+      addPresence(message);
+      snapshotStale = true;
+      return item;
+    }
+
+    /**
+     * Moves tag to new zone antenna and queues the transition
+     *
+     * @param item registry item
+     * @param reading reading of the new zone antenna
+     */
+    void moveZone(TagRegistryItem &item, const TagReading &reading) {
+      addPresence({ item.id, item.antenna, 0.0 });
+      addPresence({ item.id, reading.antenna, reading.strength });
+      item.antenna = reading.antenna;
+      zoneTransitionCount++;
+      snapshotStale = true;
+    }
+
+    /**
+     * Adds message to zone registry. Zone of a known tag moves when another antenna sees it stronger
+     * than the zone antenna by the hysteresis
+     *
+     * @param message messaged received from serial
+     * @param now current time in milliseconds
+     */
+    void addToZone(const ContinueInventoryMessage &message, unsigned long now) {
+      for (uint16_t i = 0; i < registryLength; i++) {
+        TagRegistryItem &item = registry[i];
+        if (message.id != item.id) {
+          continue;
+        }
+
+        recordRead(item, now);
+        updateReading(item, message, now);
+        TagReading *strongest = getStrongestReading(item);
+        TagReading *zone = findReading(item, item.antenna);
+        if (strongest->antenna != item.antenna && (zone == NULL || strongest->strength >= zone->strength + zoneHysteresis)) {
+          moveZone(item, *strongest);
+          zone = strongest;
+        }
+        if (zone != NULL) {
+          updateStrength(item, zone->strength);
+        }
+        return;
+      }
+
+      if (registryLength < registryBufferSize) {
+        updateReading(addItem(message, now), message, now);
+        return;
+      }
+
+      // Zone mode publishes no strength updates, so untracked tags are only counted
+      registryOverflowCount++;
+    }
+
+    /**
+     * Drops antenna readings that have not been seen within timeout. Tags not seen within their timeout
+     * are moved to presence queue as disappearances, and tags the zone antenna no longer sees move to
+     * the strongest remaining antenna
+     *
+     * @param now current time in milliseconds
+     */
+    void sweepZones(unsigned long now) {
+      uint16_t newRegistrySize = 0;
+      expiryKnown = false;
+      for (uint16_t i = 0; i < registryLength; i++) {
+        TagRegistryItem &item = registry[i];
+        unsigned long timeout = getTimeout(item);
+        if (now - item.lastSeen > timeout) {
+          addPresence({ item.id, item.antenna, 0.0 });
+          rememberGone(item);
+          snapshotStale = true;
+          continue;
+        }
+
+        unsigned long readingTimeout = getReadingTimeout(item);
+        uint8_t readingCount = 0;
+        for (uint8_t j = 0; j < item.readingCount; j++) {
+          if (now - item.readings[j].lastSeen > readingTimeout) {
+            continue;
+          }
+          trackExpiry(item.readings[j].lastSeen + readingTimeout);
+          item.readings[readingCount] = item.readings[j];
+          readingCount++;
+        }
+        item.readingCount = readingCount;
+        trackExpiry(item.lastSeen + timeout);
+
+        if (findReading(item, item.antenna) == NULL) {
+          moveZone(item, *getStrongestReading(item));
+          updateStrength(item, findReading(item, item.antenna)->strength);
+        }
+        registry[newRegistrySize] = item;
+        newRegistrySize++;
+      }
+      registryLength = newRegistrySize;
+    }
+
+    /**
+     * Moves tags that have not been seen within timeout from registry to presence queue as disappearances
+     *
+     * @param now current time in milliseconds
+     */
+    void sweep(unsigned long now) {
+      if (zoneMode) {
+        sweepZones(now);
+        return;
+      }
+
+      uint16_t newRegistrySize = 0;
+      expiryKnown = false;
+      for (uint16_t i = 0; i < registryLength; i++) {
+        unsigned long timeout = getTimeout(registry[i]);
+        if (now - registry[i].lastSeen > timeout) {
+          removeFromQueue(registry[i].id, registry[i].antenna);
+          addPresence({ registry[i].id, registry[i].antenna, 0.0 });
+          rememberGone(registry[i]);
+          snapshotStale = true;
+        } else {
+          trackExpiry(registry[i].lastSeen + timeout);
+          registry[newRegistrySize] = registry[i];
+          newRegistrySize++;
+        }
+      }
+      registryLength = newRegistrySize;
+    }
+
+  public:
+
+    /**
+     * Sets timeout after which tags that have not been seen are considered gone
+     *
+     * @param timeout disappeared timeout in milliseconds
+     */
+    void setDisappearedTimeout(unsigned long timeout) {
+      disappearedTimeout = timeout;
+      // Expiry times are found again on next flush
+      expiryKnown = false;
+    }
+
+    /**
+     * Enables or disables adaptive timeout. Disappeared timeout is used until enough reads of a tag
+     * have been seen
+     *
+     * @param enabled whether timeout of each tag follows its read interval
+     * @param minimum shortest adaptive timeout in milliseconds
+     * @param maximum longest adaptive timeout in milliseconds
+     */
+    void setAdaptiveTimeout(bool enabled, unsigned long minimum, unsigned long maximum) {
+      adaptiveTimeout = enabled;
+      minTimeout = minimum;
+      maxTimeout = maximum;
+      expiryKnown = false;
+    }
+
+    /**
+     * Enables or disables zone mode. Tracked tags are reported gone when the mode changes, and they
+     * appear again as they are seen in the new mode
+     *
+     * @param enabled whether tags are reported on their zone antenna only
+     * @param hysteresis strength difference needed to move zone to another antenna
+     */
+    void setZoneMode(bool enabled, float hysteresis) {
+      zoneHysteresis = hysteresis;
+      if (enabled == zoneMode) {
+        return;
+      }
+
+      for (uint16_t i = 0; i < registryLength; i++) {
+        addPresence({ registry[i].id, registry[i].antenna, 0.0 });
+      }
+      registryLength = 0;
+      queueLength = 0;
+      zoneMode = enabled;
+      snapshotStale = true;
+    }
+
+    /**
+     * Adds message received from serial to registry and queues.
+     * If tag with same id and antenna is found from registry last seen value is updated to current time
+     * and message is queued as strength update, otherwise tag is added to registry and its appearance
+     * is queued as presence transition
+     *
+     * @param message messaged received from serial
+     * @param now current time in milliseconds
+     */
+    void add(const ContinueInventoryMessage &message, unsigned long now) {
+      if (zoneMode) {
+        addToZone(message, now);
+        return;
+      }
+
+      bool foundFromRegistry = false;
+      for (uint16_t i = 0; i < registryLength; i++) {
+        if (message.id == registry[i].id && message.antenna == registry[i].antenna) {
+          recordRead(registry[i], now);
+          updateStrength(registry[i], (registry[i].strength * 3 + message.strength) / 4);
+          foundFromRegistry = true;
+        }
+      }
+
+      if (!foundFromRegistry) {
+        if (registryLength < registryBufferSize) {
+          addItem(message, now);
+          return;
+        }
+        // Untracked tags are still reported, but only as sheddable strength updates
+        registryOverflowCount++;
+      }
+
+      queueStrengthUpdate(message, now);
+    }
+
+    /**
+     * Flushes message queues to given publisher
+     * Tags that have not been seen in a while are published with strength of 0.
+     * Presence transitions are published first and kept for the next flush if publishing fails.
+     * Strength updates are published until the budget, which presence transitions published in the same
+     * flush count against, runs out. The rest, including an update whose publishing fails, wait for the
+     * next flush
+     *
+     * @param now current time in milliseconds
+     * @param budget maximum number of messages to publish
+     * @param publish publisher called with tag id, strength, antenna and read statistics, returns whether publishing
+     * succeeded. Statistics are NULL for presence transitions
+     */
+    template <typename Publisher>
+    void flush(unsigned long now, uint16_t budget, Publisher publish) {
+      sweep(now);
+
+      uint16_t published = 0;
+      uint16_t presencePublished = 0;
+      while (presencePublished < presenceQueueLength) {
+        const ContinueInventoryMessage &message = presenceQueue[presencePublished];
+        if (!publish(message.id, message.strength, message.antenna, NULL)) {
+          break;
+        }
+        presencePublished++;
+        published++;
+      }
+
+      for (uint16_t i = presencePublished; i < presenceQueueLength; i++) {
+        presenceQueue[i - presencePublished] = presenceQueue[i];
+      }
+      presenceQueueLength -= presencePublished;
+      if (presenceQueueLength > 0) {
+        // Link is failing, keep strength updates coalescing in queue
+        return;
+      }
+
+      uint16_t queuePublished = 0;
+      while (queuePublished < queueLength && published < budget) {
+        const StrengthUpdate &update = queue[queuePublished];
+        if (!publish(update.message.id, update.message.strength, update.message.antenna, &update.statistics)) {
+          break;
+        }
+        queuePublished++;
+        published++;
+      }
+
+      for (uint16_t i = queuePublished; i < queueLength; i++) {
+        queue[i - queuePublished] = queue[i];
+      }
+      queueLength -= queuePublished;
+    }
+
+    /**
+     * Encodes presence snapshot of every tracked tag. Snapshot starts with format version, tag count as
+     * 16-bit big endian integer and flags, followed by each tag as EPC length, EPC, TID length, TID,
+     * antenna and strength rounded to 0-100. Tags that do not fit are left out and truncated flag is set
+     *
+     * @param buffer buffer for the snapshot
+     * @param capacity buffer capacity, at least snapshot header length
+     * @return snapshot length
+     */
+    size_t encodeSnapshot(uint8_t *buffer, size_t capacity) {
+      size_t position = snapshotHeaderLength;
+      uint16_t count = 0;
+      uint8_t flags = 0;
+      for (uint16_t i = 0; i < registryLength; i++) {
+        TagRegistryItem &item = registry[i];
+        if (position + getEncodedTagLength(item.id) > capacity) {
+          flags |= snapshotTruncatedFlag;
+          break;
+        }
+
+        item.snapshotStrength = roundStrength(item.strength);
+        position = encodeTag(buffer, position, item.id, item.antenna, item.snapshotStrength);
+        count++;
+      }
+
+      buffer[0] = snapshotFormatVersion;
+      buffer[1] = count >> 8;
+      buffer[2] = count & 0xFF;
+      buffer[3] = flags;
+      snapshotStale = false;
+      return position;
+    }
+
+    /**
+     * Saves registry and pending presence transitions. State starts with format version and counts of registry
+     * items and presence transitions as 16-bit big endian integers, followed by the items and transitions in
+     * the tag format of presence snapshot. Strength of a transition is 0 only for disappearance. Items and
+     * transitions that do not fit are left out, and left out tags are announced again after restore
+     *
+     * @param buffer buffer for the state
+     * @param capacity buffer capacity, at least state header length
+     * @return state length
+     */
+    size_t saveState(uint8_t *buffer, size_t capacity) {
+      size_t position = stateHeaderLength;
+      uint16_t itemCount = 0;
+      for (; itemCount < registryLength; itemCount++) {
+        const TagRegistryItem &item = registry[itemCount];
+        if (position + getEncodedTagLength(item.id) > capacity) {
+          break;
+        }
+        position = encodeTag(buffer, position, item.id, item.antenna, roundStrength(item.strength));
+      }
+
+      uint16_t transitionCount = 0;
+      for (; itemCount == registryLength && transitionCount < presenceQueueLength; transitionCount++) {
+        const ContinueInventoryMessage &message = presenceQueue[transitionCount];
+        if (position + getEncodedTagLength(message.id) > capacity) {
+          break;
+        }
+        uint8_t strength = roundStrength(message.strength);
+        if (message.strength != 0 && strength == 0) {
+          strength = 1;
+        }
+        position = encodeTag(buffer, position, message.id, message.antenna, strength);
+      }
+
+      buffer[0] = stateFormatVersion;
+      buffer[1] = itemCount >> 8;
+      buffer[2] = itemCount & 0xFF;
+      buffer[3] = transitionCount >> 8;
+      buffer[4] = transitionCount & 0xFF;
+      return position;
+    }
+
+    /**
+     * Restores registry and pending presence transitions saved by saveState. Restored tags are not announced
+     * again and count as seen now, and adaptive timeouts are learned again. Registry is left unchanged if
+     * state is malformed. Zone mode must be set before restoring
+     *
+     * @param buffer saved state
+     * @param length state length
+     * @param now current time in milliseconds
+     * @return whether state was restored
+     */
+    bool restoreState(const uint8_t *buffer, size_t length, unsigned long now) {
+      if (length < stateHeaderLength || buffer[0] != stateFormatVersion) {
+        return false;
+      }
+      uint16_t itemCount = (buffer[1] << 8) | buffer[2];
+      uint16_t transitionCount = (buffer[3] << 8) | buffer[4];
+
+      // Every tag is checked before registry is changed
+      ContinueInventoryMessage message;
+      size_t position = stateHeaderLength;
+      for (uint32_t i = 0; i < (uint32_t) itemCount + transitionCount; i++) {
+        position = decodeTag(buffer, length, position, &message);
+        if (position == 0) {
+          return false;
+        }
+      }
+      if (position != length) {
+        return false;
+      }
+
+      registryLength = 0;
+      presenceQueueLength = 0;
+      queueLength = 0;
+      position = stateHeaderLength;
+      for (uint16_t i = 0; i < itemCount; i++) {
+        position = decodeTag(buffer, length, position, &message);
+        if (registryLength >= registryBufferSize) {
+          continue;
+        }
+        TagRegistryItem &item = registry[registryLength];
+        item = {};
+        item.id = message.id;
+        item.lastSeen = now;
+        item.antenna = message.antenna;
+        item.strength = message.strength;
+        item.lastSampled = now;
+        if (zoneMode) {
+          updateReading(item, message, now);
+        }
+        registryLength++;
+      }
+      for (uint16_t i = 0; i < transitionCount; i++) {
+        position = decodeTag(buffer, length, position, &message);
+        addPresence(message);
+      }
+
+      expiryKnown = false;
+      snapshotStale = true;
+      return true;
+    }
+
+    /**
+     * Checks whether registry has changed since presence snapshot was encoded
+     */
+    bool isSnapshotStale() {
+      return snapshotStale;
+    }
+
+    /**
+     * Marks presence snapshot stale so that it is encoded again, for example after reconnecting
+     */
+    void invalidateSnapshot() {
+      snapshotStale = true;
+    }
+
+    /**
+     * Sets listener that gets every presence transition and strength update as it is queued, before
+     * coalescing and also when the queue is full, so it does not depend on publishing
+     *
+     * @param eventListener listener called with tag id, strength and antenna, or NULL
+     */
+    void setEventListener(EventListener eventListener) {
+      listener = eventListener;
+    }
+
+    /**
+     * Moves tags that have not been seen within timeout to presence queue without flushing, so that
+     * disappearances reach the event listener also when flushes are delayed
+     *
+     * @param now current time in milliseconds
+     */
+    void expire(unsigned long now) {
+      sweep(now);
+    }
+
+    /**
+     * Checks whether some registry item may have disappeared. Can report too early but never too late
+     *
+     * @param now current time in milliseconds
+     */
+    bool expiryDue(unsigned long now) {
+      return registryLength > 0 && (!expiryKnown || (long) (now - nextExpiry) > 0);
+    }
+
+    /**
+     * Returns number of messages waiting in queues
+     */
+    uint16_t getQueueLength() {
+      return presenceQueueLength + queueLength;
+    }
+
+    /**
+     * Returns number of tags in registry
+     */
+    uint16_t getRegistryLength() {
+      return registryLength;
+    }
+
+    /**
+     * Returns number of tags that could not be tracked because registry was full
+     */
+    uint32_t getRegistryOverflowCount() {
+      return registryOverflowCount;
+    }
+
+    /**
+     * Returns number of presence transitions lost because presence queue was full
+     */
+    uint32_t getPresenceOverflowCount() {
+      return presenceOverflowCount;
+    }
+
+    /**
+     * Returns number of strength updates shed because queue was full or publishing failed
+     */
+    uint32_t getShedCount() {
+      return shedCount;
+    }
+
+    /**
+     * Returns number of zone transitions of tags between antennas
+     */
+    uint32_t getZoneTransitionCount() {
+      return zoneTransitionCount;
+    }
+};
+
+#endif // TAG_REGISTRY_CPP
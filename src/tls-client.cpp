@@ -0,0 +1,348 @@
+#include "tls-client.h"
+#include "logger.h"
+
+/**
+ * Struct for cached TLS session of a broker
+ */
+struct TlsSessionCacheEntry {
+  char host[100];
+  uint16_t port;
+  bool valid;
+  uint32_t lastUsed;
+  mbedtls_ssl_session session;
+};
+
+// Sessions are shared by all clients, failover between brokers keeps a session for each
+static TlsSessionCacheEntry sessionCache[TLS_SESSION_CACHE_SIZE];
+
+/**
+ * Finds cached session of a broker
+ *
+ * @param host broker host
+ * @param port broker port
+ * @return cache entry or NULL if broker has no cached session
+ */
+static TlsSessionCacheEntry *findCachedSession(const char *host, uint16_t port) {
+  for (uint8_t i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (sessionCache[i].valid && sessionCache[i].port == port && strcmp(sessionCache[i].host, host) == 0) {
+      return &sessionCache[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns cache entry for storing broker session. Existing entry of the broker is reused,
+ * otherwise an empty or the least recently used entry is taken
+ *
+ * @param host broker host
+ * @param port broker port
+ * @return cache entry
+ */
+static TlsSessionCacheEntry *getSessionCacheEntry(const char *host, uint16_t port) {
+  TlsSessionCacheEntry *entry = findCachedSession(host, port);
+  if (entry != NULL) {
+    return entry;
+  }
+
+  entry = &sessionCache[0];
+  for (uint8_t i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (!sessionCache[i].valid) {
+      entry = &sessionCache[i];
+      break;
+    }
+    if (sessionCache[i].lastUsed < entry->lastUsed) {
+      entry = &sessionCache[i];
+    }
+  }
+
+  if (entry->valid) {
+    mbedtls_ssl_session_free(&entry->session);
+    entry->valid = false;
+  }
+  strncpy(entry->host, host, sizeof(entry->host) - 1);
+  entry->host[sizeof(entry->host) - 1] = '\0';
+  entry->port = port;
+  return entry;
+}
+
+TlsClient::TlsClient() {
+  mbedtls_net_init(&net);
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&random);
+}
+
+TlsClient::~TlsClient() {
+  stop();
+  mbedtls_ctr_drbg_free(&random);
+  mbedtls_entropy_free(&entropy);
+}
+
+/**
+ * Sets host name of the server for connections made by IP address
+ *
+ * @param host server host, empty to use the IP address
+ */
+void TlsClient::setServerName(const char *host) {
+  strncpy(serverName, host, sizeof(serverName) - 1);
+  serverName[sizeof(serverName) - 1] = '\0';
+}
+
+/**
+ * Sets observer that sees every byte read from the connection exactly once, in order
+ *
+ * @param observer observer or NULL
+ */
+void TlsClient::setReceiveObserver(TlsReceiveObserver observer) {
+  receiveObserver = observer;
+}
+
+/**
+ * Connects to server by IP address. Host name set with setServerName is used for SNI and session cache
+ *
+ * @param ip server IP address
+ * @param port server port
+ * @return 1 on success, 0 on failure
+ */
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+  String address = ip.toString();
+  return connect(address.c_str(), serverName[0] != '\0' ? serverName : address.c_str(), port);
+}
+
+/**
+ * Connects to server by host name
+ *
+ * @param host server host
+ * @param port server port
+ * @return 1 on success, 0 on failure
+ */
+int TlsClient::connect(const char *host, uint16_t port) {
+  return connect(host, host, port);
+}
+
+/**
+ * Connects to server and performs TLS handshake, resuming cached session of the server if available
+ *
+ * @param address server host name or IP address to connect to
+ * @param host server host name for SNI and session cache
+ * @param port server port
+ * @return 1 on success, 0 on failure
+ */
+int TlsClient::connect(const char *address, const char *host, uint16_t port) {
+  stop();
+
+  if (!randomSeeded) {
+    if (mbedtls_ctr_drbg_seed(&random, mbedtls_entropy_func, &entropy, NULL, 0) != 0) {
+      return 0;
+    }
+    randomSeeded = true;
+  }
+
+  char portString[6];
+  snprintf(portString, sizeof(portString), "%u", port);
+  if (mbedtls_net_connect(&net, address, portString, MBEDTLS_NET_PROTO_TCP) != 0) {
+    // Failed connect closes the socket but leaves its number in the context, forget it so that
+    // stop does not close a descriptor another task has been given since
+    mbedtls_net_init(&net);
+    return 0;
+  }
+
+  mbedtls_ssl_init(&ssl);
+  mbedtls_ssl_config_init(&config);
+  if (mbedtls_ssl_config_defaults(&config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    stop();
+    return 0;
+  }
+  mbedtls_ssl_conf_authmode(&config, MBEDTLS_SSL_VERIFY_NONE);
+  mbedtls_ssl_conf_rng(&config, mbedtls_ctr_drbg_random, &random);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+  if (mbedtls_ssl_setup(&ssl, &config) != 0 || mbedtls_ssl_set_hostname(&ssl, host) != 0) {
+    stop();
+    return 0;
+  }
+  mbedtls_net_set_nonblock(&net);
+  mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+  TlsSessionCacheEntry *cached = findCachedSession(host, port);
+  if (cached != NULL) {
+    mbedtls_ssl_set_session(&ssl, &cached->session);
+  }
+
+  unsigned long started = millis();
+  if (!handshake()) {
+    if (cached != NULL) {
+      // Stale session may be the reason, next connection does a full handshake
+      mbedtls_ssl_session_free(&cached->session);
+      cached->valid = false;
+    }
+    stop();
+    return 0;
+  }
+
+  // Resumed session keeps the master secret of the cached one, full handshake derives a new one
+  bool resumed = cached != NULL && memcmp(ssl.session->master, cached->session.master, sizeof(cached->session.master)) == 0;
+
+  stats.lastHandshakeMs = millis() - started;
+  stats.lastResumed = resumed;
+  if (resumed) {
+    stats.resumedHandshakes++;
+  } else {
+    stats.fullHandshakes++;
+  }
+
+  TlsSessionCacheEntry *entry = getSessionCacheEntry(host, port);
+  if (entry->valid) {
+    mbedtls_ssl_session_free(&entry->session);
+  }
+  mbedtls_ssl_session_init(&entry->session);
+  entry->valid = mbedtls_ssl_get_session(&ssl, &entry->session) == 0;
+  entry->lastUsed = millis();
+
+  sslConnected = true;
+  return 1;
+}
+
+/**
+ * Performs TLS handshake on non-blocking socket
+ *
+ * @return whether handshake succeeded
+ */
+bool TlsClient::handshake() {
+  unsigned long started = millis();
+  int result;
+  while ((result = mbedtls_ssl_handshake(&ssl)) != 0) {
+    if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      LOG_WARNING("TLS handshake failed: -0x%X", -result);
+      return false;
+    }
+    if (millis() - started > TLS_HANDSHAKE_TIMEOUT_MS) {
+      LOG_WARNING("TLS handshake timed out");
+      return false;
+    }
+    delay(1);
+  }
+  return true;
+}
+
+size_t TlsClient::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buffer, size_t size) {
+  if (!sslConnected) {
+    return 0;
+  }
+
+  size_t written = 0;
+  unsigned long started = millis();
+  while (written < size) {
+    int result = mbedtls_ssl_write(&ssl, buffer + written, size - written);
+    if (result > 0) {
+      written += result;
+    } else if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      stop();
+      break;
+    } else if (millis() - started > TLS_HANDSHAKE_TIMEOUT_MS) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  return written;
+}
+
+int TlsClient::available() {
+  if (!sslConnected) {
+    return 0;
+  }
+
+  // Zero length read processes pending records without blocking
+  int result = mbedtls_ssl_read(&ssl, NULL, 0);
+  if (result < 0 && result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    stop();
+    return 0;
+  }
+  return mbedtls_ssl_get_bytes_avail(&ssl) + (peekValue >= 0 ? 1 : 0);
+}
+
+int TlsClient::read() {
+  uint8_t value;
+  return read(&value, 1) == 1 ? value : -1;
+}
+
+int TlsClient::read(uint8_t *buffer, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  int offset = 0;
+  if (peekValue >= 0) {
+    buffer[0] = peekValue;
+    peekValue = -1;
+    offset = 1;
+  }
+  if (!sslConnected || offset == (int) size) {
+    return offset > 0 ? offset : -1;
+  }
+
+  int result = mbedtls_ssl_read(&ssl, buffer + offset, size - offset);
+  if (result > 0) {
+    if (receiveObserver != NULL) {
+      receiveObserver(buffer + offset, result);
+    }
+    return offset + result;
+  }
+  if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    stop();
+  }
+  return offset > 0 ? offset : -1;
+}
+
+int TlsClient::peek() {
+  if (peekValue < 0) {
+    uint8_t value;
+    if (read(&value, 1) == 1) {
+      peekValue = value;
+    }
+  }
+  return peekValue;
+}
+
+void TlsClient::flush() {
+}
+
+void TlsClient::stop() {
+  if (sslConnected) {
+    mbedtls_ssl_close_notify(&ssl);
+  }
+  if (net.fd >= 0) {
+    mbedtls_net_free(&net);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&config);
+  }
+  sslConnected = false;
+  peekValue = -1;
+}
+
+uint8_t TlsClient::connected() {
+  if (sslConnected) {
+    available();
+  }
+  return sslConnected;
+}
+
+TlsClient::operator bool() {
+  return connected();
+}
+
+/**
+ * Returns handshake statistics
+ *
+ * @param result handshake statistics
+ */
+void TlsClient::getHandshakeStats(TlsHandshakeStats *result) {
+  *result = stats;
+}
@@ -0,0 +1,80 @@
+#ifndef TLS_CLIENT_H
+#define TLS_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+
+#ifndef TLS_SESSION_CACHE_SIZE
+#define TLS_SESSION_CACHE_SIZE 4
+#endif
+
+#define TLS_HANDSHAKE_TIMEOUT_MS 15000
+
+/**
+ * Struct for TLS handshake statistics
+ */
+struct TlsHandshakeStats {
+  uint32_t fullHandshakes;
+  uint32_t resumedHandshakes;
+  uint32_t lastHandshakeMs;
+  bool lastResumed;
+};
+
+typedef void (*TlsReceiveObserver)(const uint8_t *data, size_t length);
+
+/**
+ * TLS client that resumes sessions on reconnect.
+ *
+ * Session of the last successful handshake with each broker (host and port) is kept in a
+ * RAM cache and offered on the next connection, either as a session ticket or a session ID.
+ * Resumed handshake skips key exchange, which takes seconds of CPU on the ESP32. Server
+ * certificates are not verified, as with WiFiClientSecure::setInsecure.
+ */
+class TlsClient : public Client {
+
+  public:
+
+    TlsClient();
+    ~TlsClient();
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+    size_t write(uint8_t value);
+    size_t write(const uint8_t *buffer, size_t size);
+    int available();
+    int read();
+    int read(uint8_t *buffer, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+
+    void setServerName(const char *host);
+    void setReceiveObserver(TlsReceiveObserver observer);
+    void getHandshakeStats(TlsHandshakeStats *stats);
+
+  private:
+
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config config;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context random;
+    bool randomSeeded = false;
+    bool sslConnected = false;
+    int peekValue = -1;
+    TlsHandshakeStats stats = {};
+    // Host name used for SNI and session cache when connecting by IP address
+    char serverName[100] = "";
+    TlsReceiveObserver receiveObserver = NULL;
+
+    int connect(const char *address, const char *host, uint16_t port);
+    bool handshake();
+};
+
+#endif // TLS_CLIENT_H
@@ -1,9 +1,16 @@
+#ifndef CONTINUE_INVENTORY_RESPONSE_H
+#define CONTINUE_INVENTORY_RESPONSE_H
+
+#include <stdint.h>
+#include "./tag-id.h"
 
 /**
  * Struct for incentory messages
  */
 struct ContinueInventoryMessage {
-  std::string epc;
+  TagId id;
   int16_t antenna;
   double strength;
-};
\ No newline at end of file
+};
+
+#endif // CONTINUE_INVENTORY_RESPONSE_H
@@ -0,0 +1,25 @@
+#ifndef MQTT_SERVER_H
+#define MQTT_SERVER_H
+
+#include <stdint.h>
+
+/**
+ * Struct for MQTT server and its connection health
+ */
+struct MqttServer {
+  char host[100];
+  char protocol[10];
+  uint16_t port;
+  // Smoothed connect time in milliseconds, 0 until first successful connection
+  uint32_t latencyMs;
+  uint8_t consecutiveFailures;
+  uint32_t totalFailures;
+  bool succeeded;
+  unsigned long lastSuccess;
+  unsigned long lastFailure;
+  // Cached DNS result as IPv4 address in network byte order, 0 when not resolved
+  uint32_t address;
+  unsigned long addressResolved;
+};
+
+#endif // MQTT_SERVER_H
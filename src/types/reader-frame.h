@@ -0,0 +1,30 @@
+#ifndef READER_FRAME_H
+#define READER_FRAME_H
+
+#include <stdint.h>
+
+#define READER_FRAME_MAX_LENGTH 256
+
+// Antennas of each reader are numbered from reader id times the offset, so reader 0 keeps antennas 1-16
+#define READER_ANTENNA_OFFSET 100
+
+/**
+ * Struct for complete frames received from a reader
+ */
+struct ReaderFrame {
+  uint8_t reader;
+  uint16_t length;
+  uint8_t data[READER_FRAME_MAX_LENGTH];
+};
+
+/**
+ * Returns antenna number of reader antenna in the antenna namespace shared by all readers
+ *
+ * @param reader reader id
+ * @param antenna antenna number reported by the reader
+ */
+inline int16_t getReaderAntenna(uint8_t reader, int16_t antenna) {
+  return reader * READER_ANTENNA_OFFSET + antenna;
+}
+
+#endif // READER_FRAME_H
@@ -0,0 +1,21 @@
+#ifndef READER_STATE_H
+#define READER_STATE_H
+
+#include <stdint.h>
+
+/**
+ * Struct for initialization and health state of single reader. Reader is initialized again when
+ * it has not started, stops sending messages or has not confirmed the inventory filter
+ */
+struct ReaderState {
+  bool startSuccessfull;
+  bool stopSuccessfull;
+  bool filterConfirmed;
+  uint8_t filterAttempts;
+  unsigned long lastContinueAttempt;
+  unsigned long lastMessageReceived;
+  unsigned long lastFilterAttempt;
+  uint32_t lastOverflowCount;
+};
+
+#endif // READER_STATE_H
@@ -0,0 +1,83 @@
+#ifndef TAG_ID_H
+#define TAG_ID_H
+
+#include <stdint.h>
+#include <string.h>
+
+// PC word declares EPC length with 5 bits in 16-bit words, so EPC is at most 31 words (496 bits)
+#define TAG_EPC_MAX_BYTES 62
+// Reader reads fixed length TID in EPC and TID mode, 96-bit TIDs are the most common
+#ifndef TAG_TID_MAX_BYTES
+#define TAG_TID_MAX_BYTES 16
+#endif
+
+#define TAG_EPC_HEX_SIZE (TAG_EPC_MAX_BYTES * 2 + 1)
+#define TAG_TID_HEX_SIZE (TAG_TID_MAX_BYTES * 2 + 1)
+
+/**
+ * Struct for tag identity. EPC and TID are stored inline so that messages and registry items
+ * can be copied without allocations. TID is empty unless reader reports it with the EPC.
+ * Tags are equal when both EPC and TID are equal
+ */
+struct TagId {
+  uint8_t epcLength;
+  uint8_t tidLength;
+  uint8_t epc[TAG_EPC_MAX_BYTES];
+  uint8_t tid[TAG_TID_MAX_BYTES];
+
+  /**
+   * Returns whether tag id has no EPC
+   */
+  bool empty() const {
+    return epcLength == 0;
+  }
+
+  bool operator==(const TagId &other) const {
+    return (
+      epcLength == other.epcLength &&
+      tidLength == other.tidLength &&
+      memcmp(epc, other.epc, epcLength) == 0 &&
+      memcmp(tid, other.tid, tidLength) == 0
+    );
+  }
+
+  bool operator!=(const TagId &other) const {
+    return !(*this == other);
+  }
+
+  /**
+   * Writes bytes as lowercase hex string
+   *
+   * @param bytes bytes to write
+   * @param length number of bytes
+   * @param buffer target buffer of at least length * 2 + 1 bytes
+   */
+  static void toHex(const uint8_t *bytes, uint8_t length, char *buffer) {
+    static const char digits[] = "0123456789abcdef";
+    for (uint8_t i = 0; i < length; i++) {
+      buffer[i * 2] = digits[bytes[i] >> 4];
+      buffer[i * 2 + 1] = digits[bytes[i] & 0x0F];
+    }
+    buffer[length * 2] = '\0';
+  }
+
+  /**
+   * Writes EPC as lowercase hex string
+   *
+   * @param buffer target buffer of TAG_EPC_HEX_SIZE bytes
+   */
+  void epcToHex(char *buffer) const {
+    toHex(epc, epcLength, buffer);
+  }
+
+  /**
+   * Writes TID as lowercase hex string
+   *
+   * @param buffer target buffer of TAG_TID_HEX_SIZE bytes
+   */
+  void tidToHex(char *buffer) const {
+    toHex(tid, tidLength, buffer);
+  }
+};
+
+#endif // TAG_ID_H
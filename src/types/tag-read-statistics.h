@@ -0,0 +1,19 @@
+#ifndef TAG_READ_STATISTICS_H
+#define TAG_READ_STATISTICS_H
+
+#include <stdint.h>
+
+/**
+ * Struct for statistics of tag reads coalesced into single strength update. Timestamps are
+ * milliseconds since device start
+ */
+struct TagReadStatistics {
+  uint32_t count;
+  float minStrength;
+  float maxStrength;
+  float meanStrength;
+  unsigned long firstSeen;
+  unsigned long lastSeen;
+};
+
+#endif // TAG_READ_STATISTICS_H
@@ -0,0 +1,42 @@
+#ifndef TAG_REGISTRY_ITEM_H
+#define TAG_REGISTRY_ITEM_H
+
+#include <stdint.h>
+#include "./tag-id.h"
+
+#ifndef ZONE_MAX_ANTENNAS
+#define ZONE_MAX_ANTENNAS 8
+#endif
+
+/**
+ * Struct for smoothed tag strength seen by single antenna
+ */
+struct TagReading {
+  int16_t antenna;
+  float strength;
+  unsigned long lastSeen;
+};
+
+/**
+ * Struct for tag registry items. In zone mode antenna is the zone antenna of the tag
+ * and readings hold the tag strength for each antenna that currently sees it. Strength is
+ * the smoothed strength on the item antenna and snapshot strength the value last encoded
+ * to presence snapshot. Interval mean and variance are smoothed over the time between sampled
+ * reads of the item, and timeout is the adaptive timeout derived from them
+ */
+struct TagRegistryItem {
+  TagId id;
+  unsigned long lastSeen;
+  int16_t antenna;
+  TagReading readings[ZONE_MAX_ANTENNAS];
+  uint8_t readingCount;
+  float strength;
+  uint8_t snapshotStrength;
+  float intervalMean;
+  float intervalVariance;
+  uint8_t intervalCount;
+  uint32_t timeoutMs;
+  unsigned long lastSampled;
+};
+
+#endif // TAG_REGISTRY_ITEM_H
@@ -0,0 +1,87 @@
+#ifndef WARM_RESTART_STATE_CPP
+#define WARM_RESTART_STATE_CPP
+
+#include <stdint.h>
+#include <string.h>
+
+#define WARM_RESTART_STATE_MAGIC 0x57524D31
+// Fits the registry with 96-bit EPCs and leaves most of the 8 kB RTC slow memory free
+#ifndef WARM_RESTART_STATE_SIZE
+#define WARM_RESTART_STATE_SIZE 3072
+#endif
+
+/**
+ * Struct for state kept in memory that survives software restart. Memory is not initialized at boot,
+ * so data is used only when magic and checksum match
+ */
+struct WarmRestartState {
+  uint32_t magic;
+  uint32_t length;
+  uint32_t checksum;
+  uint8_t data[WARM_RESTART_STATE_SIZE];
+};
+
+/**
+ * Updates CRC-32 with given bytes
+ *
+ * @param crc current CRC, inverted
+ * @param bytes bytes to add
+ * @param length number of bytes
+ * @return updated CRC, inverted
+ */
+static inline uint32_t updateWarmRestartCrc(uint32_t crc, const uint8_t *bytes, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return crc;
+}
+
+/**
+ * Calculates CRC-32 of state length and data
+ *
+ * @param state warm restart state
+ * @return checksum
+ */
+static inline uint32_t calculateWarmRestartChecksum(const WarmRestartState &state) {
+  uint32_t crc = updateWarmRestartCrc(0xFFFFFFFF, (const uint8_t *) &state.length, sizeof(state.length));
+  return ~updateWarmRestartCrc(crc, state.data, state.length);
+}
+
+/**
+ * Marks data written to state valid
+ *
+ * @param state warm restart state
+ * @param length length of data, at most WARM_RESTART_STATE_SIZE
+ */
+static inline void sealWarmRestartState(WarmRestartState *state, uint32_t length) {
+  state->length = length;
+  state->checksum = calculateWarmRestartChecksum(*state);
+  state->magic = WARM_RESTART_STATE_MAGIC;
+}
+
+/**
+ * Checks whether state holds data sealed before restart
+ *
+ * @param state warm restart state
+ */
+static inline bool isWarmRestartStateValid(const WarmRestartState &state) {
+  return (
+    state.magic == WARM_RESTART_STATE_MAGIC &&
+    state.length <= WARM_RESTART_STATE_SIZE &&
+    state.checksum == calculateWarmRestartChecksum(state)
+  );
+}
+
+/**
+ * Invalidates state so that it is not used again after the next restart
+ *
+ * @param state warm restart state
+ */
+static inline void clearWarmRestartState(WarmRestartState *state) {
+  state->magic = 0;
+}
+
+#endif // WARM_RESTART_STATE_CPP
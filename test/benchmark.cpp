@@ -0,0 +1,96 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include "../src/epc-filter.cpp"
+
+/**
+ * Host benchmarks for on-device data structures.
+ *
+ * Run with:
+ * g++ -O2 test/benchmark.cpp -o benchmark && ./benchmark
+ * from project root
+ */
+
+/**
+ * Generates pseudo random 96-bit EPC as hex string
+ */
+std::string generateEpc(uint64_t &state) {
+  char buffer[25];
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  uint64_t high = state;
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  snprintf(buffer, sizeof(buffer), "e2%014llx%08x", (unsigned long long) (high >> 8), (unsigned int) (state >> 32));
+  return std::string(buffer);
+}
+
+/**
+ * Benchmarks EPC filter with given number of listed EPCs
+ */
+void benchmarkEpcFilter(uint32_t epcCount) {
+  const uint32_t lookups = 1000000;
+  uint64_t state = 42;
+  std::vector<std::string> listed;
+  std::vector<std::string> unlisted;
+  for (uint32_t i = 0; i < epcCount; i++) {
+    listed.push_back(generateEpc(state));
+  }
+  for (uint32_t i = 0; i < epcCount; i++) {
+    unlisted.push_back(generateEpc(state));
+  }
+
+  EpcFilter filter;
+  filter.setMode(EPC_FILTER_DENY);
+  auto started = std::chrono::steady_clock::now();
+  filter.update(listed, {});
+  auto ended = std::chrono::steady_clock::now();
+  double buildMicros = std::chrono::duration<double, std::micro>(ended - started).count();
+
+  uint32_t missingMembers = 0;
+  for (const std::string &epc : listed) {
+    if (filter.accepts(epc)) {
+      missingMembers++;
+    }
+  }
+
+  uint32_t falseMembers = 0;
+  for (const std::string &epc : unlisted) {
+    if (!filter.accepts(epc)) {
+      falseMembers++;
+    }
+  }
+
+  uint32_t accepted = 0;
+  started = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < lookups; i++) {
+    accepted += filter.accepts(unlisted[i % epcCount]);
+  }
+  ended = std::chrono::steady_clock::now();
+  double unlistedNanos = std::chrono::duration<double, std::nano>(ended - started).count() / lookups;
+
+  started = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < lookups; i++) {
+    accepted += filter.accepts(listed[i % epcCount]);
+  }
+  ended = std::chrono::steady_clock::now();
+  double listedNanos = std::chrono::duration<double, std::nano>(ended - started).count() / lookups;
+
+  printf(
+    "EPC filter with %u EPCs: %zu bytes, build %.0f us, lookup %.1f ns unlisted / %.1f ns listed, %u missing members, %u false members%s\n",
+    epcCount,
+    filter.memoryUsage(),
+    buildMicros,
+    unlistedNanos,
+    listedNanos,
+    missingMembers,
+    falseMembers,
+    accepted == 0 ? " (unexpected)" : ""
+  );
+}
+
+int main() {
+  benchmarkEpcFilter(1000);
+  benchmarkEpcFilter(10000);
+  return 0;
+}
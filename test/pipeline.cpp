@@ -0,0 +1,162 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../src/publish-window.cpp"
+
+/**
+ * Publish pipeline test against the local broker stand-in. Publishes messages through the publish window
+ * with different window sizes, drops the connection in the middle and checks that every message is
+ * acknowledged after messages in flight are sent again.
+ *
+ * Run with:
+ * python3 tools/mqtt-test-broker/broker.py --plain --port 1883 --ack-delay 20 &
+ * g++ -O2 test/pipeline.cpp -o pipeline && ./pipeline 1883
+ * from project root
+ */
+
+const uint32_t messageCount = 200;
+
+/**
+ * Returns milliseconds since start of the test
+ */
+unsigned long millis() {
+  static auto started = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+/**
+ * Opens MQTT connection to the broker
+ *
+ * @param port broker port on localhost
+ * @return socket or -1 on failure
+ */
+int connectToBroker(uint16_t port) {
+  int connection = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(connection, (sockaddr *) &address, sizeof(address)) != 0) {
+    close(connection);
+    return -1;
+  }
+  int noDelay = 1;
+  setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  const uint8_t connectPacket[] = { 0x10, 0x12, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x0A, 0x00, 0x06, 'd', 'e', 'v', 'i', 'c', 'e' };
+  uint8_t connack[4];
+  if (write(connection, connectPacket, sizeof(connectPacket)) != sizeof(connectPacket) || recv(connection, connack, 4, MSG_WAITALL) != 4 || connack[0] != 0x20) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+/**
+ * Reads acknowledgements that have arrived
+ *
+ * @param connection broker socket
+ * @param scanner PUBACK scanner
+ * @param window publish window
+ * @param waitMs time to wait for data
+ */
+void receiveAcks(int connection, PubackScanner &scanner, PublishWindow &window, int waitMs) {
+  pollfd descriptor = { connection, POLLIN, 0 };
+  while (poll(&descriptor, 1, waitMs) > 0) {
+    uint8_t buffer[512];
+    ssize_t received = read(connection, buffer, sizeof(buffer));
+    if (received <= 0) {
+      return;
+    }
+    scanner.feed(buffer, received, [&window](uint16_t packetId) {
+      window.acknowledge(packetId, millis());
+    });
+    waitMs = 0;
+  }
+}
+
+/**
+ * Publishes messages with given window size and reconnects half way through
+ *
+ * @param port broker port
+ * @param windowSize publish window size
+ * @return whether every message was acknowledged
+ */
+bool runPipeline(uint16_t port, uint8_t windowSize) {
+  PublishWindow *window = new PublishWindow();
+  PubackScanner scanner;
+  window->setWindowSize(windowSize);
+
+  int connection = connectToBroker(port);
+  if (connection < 0) {
+    std::cout << "Could not connect to broker stand-in on port " << port << "!!\n";
+    delete window;
+    return false;
+  }
+  auto write = [&connection](const uint8_t *packet, size_t length) {
+    return send(connection, packet, length, MSG_NOSIGNAL) == (ssize_t) length;
+  };
+
+  unsigned long started = millis();
+  uint32_t published = 0;
+  bool reconnected = false;
+  while (published < messageCount) {
+    if (published == messageCount / 2 && !reconnected) {
+      reconnected = true;
+      // Connection drops with messages in flight
+      close(connection);
+      connection = connectToBroker(port);
+      scanner.reset();
+      window->retransmit(millis(), write);
+    }
+
+    std::string payload = "{\"tag\":\"e20034120000000000" + std::to_string(published) + "\",\"strength\":55.2}";
+    if (window->publish("prefix/topic/device/1", payload.c_str(), payload.size(), millis(), write)) {
+      published++;
+    } else {
+      receiveAcks(connection, scanner, *window, 100);
+    }
+  }
+  while (window->getInFlight() > 0 && millis() - started < 10000) {
+    receiveAcks(connection, scanner, *window, 100);
+  }
+  unsigned long duration = millis() - started;
+  close(connection);
+
+  printf(
+    "  window %2u: %6.0f messages/s, %4u ms average latency, %4u ms max latency, %2u sent again, %u acknowledged\n",
+    windowSize,
+    messageCount * 1000.0 / (duration > 0 ? duration : 1),
+    window->getLatencyMs(),
+    window->getMaxLatencyMs(),
+    window->getRetransmitCount(),
+    window->getAcknowledgedCount()
+  );
+
+  bool correct = window->getInFlight() == 0 && window->getAcknowledgedCount() == messageCount;
+  delete window;
+  return correct;
+}
+
+int main(int argc, char *argv[]) {
+  uint16_t port = argc > 1 ? atoi(argv[1]) : 1883;
+  bool correct = true;
+
+  printf("Publishing %u QoS 1 messages to broker stand-in on port %u\n", messageCount, port);
+  const uint8_t windowSizes[] = { 1, 4, 16, 32 };
+  for (uint8_t windowSize : windowSizes) {
+    correct = runPipeline(port, windowSize) && correct;
+  }
+
+  std::cout << (correct ? "Every pipelined message was acknowledged\n" : "Pipelined messages were lost!!\n");
+  return correct ? 0 : 1;
+}
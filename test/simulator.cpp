@@ -0,0 +1,731 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <string.h>
+#include "../src/message-parser.cpp"
+#include "../src/tag-registry.cpp"
+#include "../src/flush-scheduler.cpp"
+#include "../src/reader-frame-decoder.cpp"
+
+/**
+ * Reader traffic simulator. Generates the frames a reader would send for a set of tags
+ * and runs them through the message parser to compare inventory modes, and replays tag
+ * reads through the tag registry to compare flush scheduling over a slow link,
+ * antenna and zone report modes, and fixed and adaptive disappeared timeouts. Byte streams
+ * of two readers are decoded at once to compare one and two readers covering the same antennas.
+ *
+ * Run with:
+ * g++ -O2 test/simulator.cpp -o simulator && ./simulator [trace.csv ...]
+ * from project root
+ *
+ * Recorded read traces given as arguments are replayed with both timeouts. Trace has a read
+ * per line as time in milliseconds, EPC as hex, antenna and strength separated by commas, and
+ * lines starting with # are skipped
+ */
+
+// UART is 115200 baud with 8N1 framing
+const double uartBytesPerSecond = 115200 / 10.0;
+
+/**
+ * Struct for simulation scenario
+ */
+struct Scenario {
+  const char *name;
+  uint32_t tagCount;
+  uint32_t antennaCount;
+  // Total tag reads per second the reader module performs
+  uint32_t readsPerSecond;
+  uint32_t timeFrameMs;
+  uint32_t durationMs;
+};
+
+/**
+ * Struct for simulation results
+ */
+struct Result {
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t tagReports;
+  double parseMicros;
+};
+
+MessageParser parser;
+
+/**
+ * Constructs tag report frame for given tag and antenna
+ */
+uint32_t constructTagFrame(uint32_t type, uint32_t tag, uint32_t antenna, uint32_t frame[]) {
+  uint32_t payload[21] = {
+    0x30, 0x00,
+    0xE2, 0x00, 0x34, 0x11, 0xB8, 0x02, 0x01, 0x13, 0x00, 0x00, (tag >> 8) & 0xFF, tag & 0xFF,
+    0xFD, 0x6F,
+    antenna,
+    0x0D, 0xF7, 0x32,
+    0x2D
+  };
+  return parser.constructCommand(type, payload, 21, frame);
+}
+
+/**
+ * Constructs 96-bit tag id for given tag
+ */
+TagId constructTagId(uint32_t tag) {
+  TagId id = {};
+  const uint8_t epc[12] = { 0xE2, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, (uint8_t) (tag >> 8), (uint8_t) tag };
+  memcpy(id.epc, epc, sizeof(epc));
+  id.epcLength = sizeof(epc);
+  return id;
+}
+
+/**
+ * Runs frame through the same checks and parsing as the firmware
+ */
+bool parseFrame(uint32_t frame[], uint32_t length) {
+  if (!parser.checkMessageStart(frame) || !parser.checkMessageEnd(frame, length) || !parser.checkCRC(frame)) {
+    return false;
+  }
+
+  switch (frame[4]) {
+  case CONTINUE_INVENTORY_RESPONSE:
+    return !parser.parseContinueInventoryResponse(frame).id.empty();
+  case GET_TIME_FRAME_INVENTORY_RESULT:
+    return parser.isTimeFrameInventoryResultTag(frame) && !parser.parseTimeFrameInventoryResult(frame).id.empty();
+  default:
+    return false;
+  }
+}
+
+/**
+ * Collects generated frame into results
+ */
+void collectFrame(std::vector<std::vector<uint32_t>> &frames, uint32_t frame[], uint32_t length, Result &result) {
+  frames.push_back(std::vector<uint32_t>(frame, frame + length));
+  result.frames++;
+  result.bytes += length;
+}
+
+/**
+ * Measures parse time of generated frames
+ */
+void parseFrames(std::vector<std::vector<uint32_t>> &frames, Result &result) {
+  auto started = std::chrono::steady_clock::now();
+  for (auto &frame : frames) {
+    if (parseFrame(frame.data(), frame.size())) {
+      result.tagReports++;
+    }
+  }
+  auto ended = std::chrono::steady_clock::now();
+  result.parseMicros = std::chrono::duration<double, std::micro>(ended - started).count();
+}
+
+/**
+ * Simulates continuous inventory where every read is streamed as its own frame
+ */
+Result simulateContinuous(const Scenario &scenario) {
+  Result result = {};
+  std::vector<std::vector<uint32_t>> frames;
+  uint32_t frame[64];
+  uint64_t reads = (uint64_t) scenario.readsPerSecond * scenario.durationMs / 1000;
+
+  for (uint64_t i = 0; i < reads; i++) {
+    uint32_t tag = i % scenario.tagCount;
+    uint32_t antenna = 1 + (i / scenario.tagCount) % scenario.antennaCount;
+    uint32_t length = constructTagFrame(CONTINUE_INVENTORY_RESPONSE, tag, antenna, frame);
+    collectFrame(frames, frame, length, result);
+  }
+
+  parseFrames(frames, result);
+  return result;
+}
+
+/**
+ * Simulates time frame inventory where reader deduplicates reads within the time frame
+ */
+Result simulateTimeFrame(const Scenario &scenario) {
+  Result result = {};
+  std::vector<std::vector<uint32_t>> frames;
+  uint32_t frame[64];
+  uint32_t timeFrames = scenario.durationMs / scenario.timeFrameMs;
+  uint64_t readsPerFrame = (uint64_t) scenario.readsPerSecond * scenario.timeFrameMs / 1000;
+  uint64_t pairs = (uint64_t) scenario.tagCount * scenario.antennaCount;
+  // Expected number of distinct tag and antenna pairs when reads hit pairs uniformly
+  uint64_t uniquePerFrame = llround(pairs * (1 - pow(1 - 1.0 / pairs, (double) readsPerFrame)));
+  const uint32_t status[1] = { 0x01 };
+
+  for (uint32_t f = 0; f < timeFrames; f++) {
+    uint32_t length = parser.constructCommand(TIME_FRAME_INVENTORY_RESPONSE, status, 1, frame);
+    collectFrame(frames, frame, length, result);
+
+    for (uint64_t i = 0; i < uniquePerFrame; i++) {
+      uint32_t tag = i % scenario.tagCount;
+      uint32_t antenna = 1 + (i / scenario.tagCount) % scenario.antennaCount;
+      length = constructTagFrame(GET_TIME_FRAME_INVENTORY_RESULT, tag, antenna, frame);
+      collectFrame(frames, frame, length, result);
+    }
+
+    length = parser.constructCommand(GET_TIME_FRAME_INVENTORY_RESULT, status, 1, frame);
+    collectFrame(frames, frame, length, result);
+  }
+
+  parseFrames(frames, result);
+  return result;
+}
+
+/**
+ * Prints simulation result
+ */
+void printResult(const char *mode, const Scenario &scenario, const Result &result) {
+  double seconds = scenario.durationMs / 1000.0;
+  double bytesPerSecond = result.bytes / seconds;
+  printf(
+    "  %-12s %8.0f frames/s %9.0f bytes/s %6.1f%% UART%s %8.0f tag reports/s %8.2f us parse per second\n",
+    mode,
+    result.frames / seconds,
+    bytesPerSecond,
+    100 * bytesPerSecond / uartBytesPerSecond,
+    bytesPerSecond > uartBytesPerSecond ? " (saturated)" : "",
+    result.tagReports / seconds,
+    result.parseMicros / seconds
+  );
+}
+
+// Reader frame queue between UART task and main loop
+const uint32_t frameQueueCapacity = 32;
+const uint32_t baseFlushIntervalMs = 100;
+const uint32_t disappearedTimeoutMs = 1500;
+
+/**
+ * Struct for flush simulation scenario
+ */
+struct LinkScenario {
+  const char *name;
+  uint32_t tagCount;
+  uint32_t antennaCount;
+  uint32_t readsPerSecond;
+  // Publish cost per message normally and while the link is congested
+  uint32_t publishMs;
+  uint32_t congestedPublishMs;
+  uint32_t congestedFromMs;
+  uint32_t congestedToMs;
+  uint32_t durationMs;
+};
+
+/**
+ * Struct for flush simulation results
+ */
+struct LinkResult {
+  uint64_t flushes;
+  uint64_t publishes;
+  uint64_t frameDrops;
+  uint64_t shed;
+  uint64_t presenceOverflows;
+};
+
+/**
+ * Simulated reader producing reads of tags that come and go
+ */
+class ReadGenerator {
+
+  private:
+
+    const LinkScenario &scenario;
+    uint64_t random = 12345;
+    double pendingReads = 0;
+
+  public:
+
+    ReadGenerator(const LinkScenario &scenario) : scenario(scenario) {}
+
+    /**
+     * Generates reads for one millisecond into the frame queue
+     */
+    void tick(unsigned long now, std::vector<ContinueInventoryMessage> &frames, LinkResult &result) {
+      pendingReads += scenario.readsPerSecond / 1000.0;
+      while (pendingReads >= 1) {
+        pendingReads -= 1;
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t tag = (random >> 33) % scenario.tagCount;
+        // Each tag is present for 14 s out of every 20 s, staggered between tags
+        if ((now / 1000 + tag * 7) % 20 >= 14) {
+          continue;
+        }
+
+        if (frames.size() >= frameQueueCapacity) {
+          result.frameDrops++;
+          continue;
+        }
+
+        ContinueInventoryMessage message;
+        message.id = constructTagId(tag);
+        message.antenna = 1 + tag % scenario.antennaCount;
+        message.strength = 50 + (random >> 60);
+        frames.push_back(message);
+      }
+    }
+};
+
+/**
+ * Simulates main loop with either fixed or adaptive flush interval
+ */
+LinkResult simulateFlushing(const LinkScenario &scenario, bool adaptive) {
+  LinkResult result = {};
+  TagRegistry *registry = new TagRegistry();
+  registry->setDisappearedTimeout(disappearedTimeoutMs);
+  FlushScheduler scheduler;
+  ReadGenerator generator(scenario);
+  std::vector<ContinueInventoryMessage> frames;
+  unsigned long lastFlush = 0;
+  unsigned long now = 0;
+
+  while (now < scenario.durationMs) {
+    for (const ContinueInventoryMessage &frame : frames) {
+      registry->add(frame, now);
+    }
+    frames.clear();
+
+    bool flush;
+    if (adaptive) {
+      bool expiryDue = registry->expiryDue(now);
+      flush = scheduler.shouldFlush(now, baseFlushIntervalMs, registry->getQueueLength(), TagRegistry::queueBufferSize, expiryDue);
+    } else {
+      flush = now - lastFlush > baseFlushIntervalMs;
+    }
+
+    if (!flush) {
+      generator.tick(now, frames, result);
+      now++;
+      continue;
+    }
+
+    // Publishing blocks the main loop, reads keep arriving to the frame queue meanwhile
+    uint64_t published = 0;
+    uint16_t budget = adaptive ? scheduler.getPublishBudget() : 0xFFFF;
+    registry->flush(now, budget, [&published](const TagId &, double, uint16_t, const TagReadStatistics *) {
+      published++;
+      return true;
+    });
+
+    bool congested = now >= scenario.congestedFromMs && now < scenario.congestedToMs;
+    unsigned long duration = published * (congested ? scenario.congestedPublishMs : scenario.publishMs);
+    for (unsigned long i = 0; i < duration; i++) {
+      generator.tick(now + i, frames, result);
+    }
+
+    lastFlush = now;
+    now += duration > 0 ? duration : 1;
+    scheduler.flushed(now, baseFlushIntervalMs, duration, published, false);
+    result.flushes++;
+    result.publishes += published;
+  }
+
+  result.shed = registry->getShedCount();
+  result.presenceOverflows = registry->getPresenceOverflowCount();
+  delete registry;
+  return result;
+}
+
+/**
+ * Prints flush simulation result
+ */
+void printLinkResult(const char *mode, const LinkResult &result) {
+  printf(
+    "  %-12s %8llu flushes %8llu publishes %8llu frame drops %8llu shed %8llu presence overflows\n",
+    mode,
+    (unsigned long long) result.flushes,
+    (unsigned long long) result.publishes,
+    (unsigned long long) result.frameDrops,
+    (unsigned long long) result.shed,
+    (unsigned long long) result.presenceOverflows
+  );
+}
+
+/**
+ * Struct for zone simulation results
+ */
+struct ZoneResult {
+  uint64_t publishes;
+  uint64_t transitions;
+};
+
+/**
+ * Simulates tags walking back and forth between two antennas. Both antennas read every tag, the nearer
+ * one stronger, and read strength varies by up to 5 from read to read
+ */
+ZoneResult simulateZones(bool zoneMode, float hysteresis) {
+  const uint32_t tagCount = 20;
+  const uint32_t readsPerSecond = 400;
+  const uint32_t walkPeriodMs = 20000;
+  const uint32_t durationMs = 60000;
+
+  ZoneResult result = {};
+  TagRegistry *registry = new TagRegistry();
+  registry->setDisappearedTimeout(disappearedTimeoutMs);
+  registry->setZoneMode(zoneMode, hysteresis);
+  uint64_t random = 12345;
+  double pendingReads = 0;
+
+  for (unsigned long now = 0; now < durationMs; now++) {
+    pendingReads += readsPerSecond / 1000.0;
+    while (pendingReads >= 1) {
+      pendingReads -= 1;
+      random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+      uint32_t tag = (random >> 33) % tagCount;
+      uint32_t antenna = 1 + (random >> 40) % 2;
+
+      // Position goes from antenna 1 (0) to antenna 2 (1) and back
+      double phase = (double) ((now + tag * 1000) % walkPeriodMs) / walkPeriodMs;
+      double position = phase < 0.5 ? phase * 2 : 2 - phase * 2;
+      double distance = antenna == 1 ? position : 1 - position;
+
+      ContinueInventoryMessage message;
+      message.id = constructTagId(tag);
+      message.antenna = antenna;
+      message.strength = 60 - 30 * distance + (double) ((random >> 50) % 11) - 5;
+      registry->add(message, now);
+    }
+
+    if (now % baseFlushIntervalMs == 0) {
+      registry->flush(now, 0xFFFF, [&result](const TagId &, double, uint16_t, const TagReadStatistics *) {
+        result.publishes++;
+        return true;
+      });
+    }
+  }
+
+  result.transitions = registry->getZoneTransitionCount();
+  delete registry;
+  return result;
+}
+
+/**
+ * Prints zone simulation result
+ */
+void printZoneResult(const char *mode, const ZoneResult &result) {
+  printf("  %-18s %8llu publishes %8llu zone transitions\n", mode, (unsigned long long) result.publishes, (unsigned long long) result.transitions);
+}
+
+/**
+ * Struct for multi-reader simulation results
+ */
+struct ReaderResult {
+  uint64_t framesSent;
+  uint64_t framesDecoded;
+  uint32_t antennas;
+  uint64_t minAntennaReads;
+  uint16_t pairs;
+  double decodeMicros;
+};
+
+/**
+ * Simulates readers covering the antennas together, each streaming continuous inventory frames on its own
+ * UART as fast as the module reads or the UART carries them. Byte streams of the ports arrive at the same
+ * time in FIFO threshold sized chunks and are decoded with a decoder per port, and reads go to a shared
+ * registry with antennas in the namespace of their reader
+ */
+ReaderResult simulateReaders(uint32_t readerCount, uint32_t antennaCount, uint32_t durationMs) {
+  const uint32_t tagCount = 10;
+  const uint32_t readsPerSecond = 600;
+  const size_t chunkSize = 32;
+
+  ReaderResult result = {};
+  std::vector<uint8_t> streams[2];
+  uint32_t frame[64];
+  uint32_t antennasPerReader = antennaCount / readerCount;
+  for (uint32_t reader = 0; reader < readerCount; reader++) {
+    uint32_t frameLength = constructTagFrame(CONTINUE_INVENTORY_RESPONSE, 0, 1, frame);
+    double framesPerSecond = std::min((double) readsPerSecond, uartBytesPerSecond / frameLength);
+    uint64_t frames = (uint64_t) (framesPerSecond * durationMs / 1000);
+    for (uint64_t i = 0; i < frames; i++) {
+      uint32_t length = constructTagFrame(CONTINUE_INVENTORY_RESPONSE, i % tagCount, 1 + (i / tagCount) % antennasPerReader, frame);
+      streams[reader].insert(streams[reader].end(), frame, frame + length);
+      result.framesSent++;
+    }
+  }
+
+  TagRegistry *registry = new TagRegistry();
+  registry->setDisappearedTimeout(disappearedTimeoutMs);
+  ReaderFrameDecoder decoders[2] = { ReaderFrameDecoder(0), ReaderFrameDecoder(1) };
+  std::map<int16_t, uint64_t> antennaReads;
+  unsigned long now = 0;
+  auto complete = [&](const ReaderFrame &frame) {
+    uint32_t message[READER_FRAME_MAX_LENGTH];
+    for (uint16_t i = 0; i < frame.length; i++) {
+      message[i] = frame.data[i];
+    }
+    if (!parseFrame(message, frame.length)) {
+      return;
+    }
+    ContinueInventoryMessage parsed = parser.parseContinueInventoryResponse(message);
+    parsed.antenna = getReaderAntenna(frame.reader, parsed.antenna);
+    registry->add(parsed, now);
+    antennaReads[parsed.antenna]++;
+    result.framesDecoded++;
+  };
+
+  auto started = std::chrono::steady_clock::now();
+  for (size_t position = 0; position < streams[0].size() || position < streams[1].size(); position += chunkSize) {
+    now = (unsigned long) (position * 1000 / uartBytesPerSecond);
+    for (uint32_t reader = 0; reader < readerCount; reader++) {
+      for (size_t i = position; i < position + chunkSize && i < streams[reader].size(); i++) {
+        decoders[reader].decode(streams[reader][i], complete);
+      }
+    }
+  }
+  auto ended = std::chrono::steady_clock::now();
+
+  result.decodeMicros = std::chrono::duration<double, std::micro>(ended - started).count();
+  result.antennas = antennaReads.size();
+  result.minAntennaReads = antennaReads.empty() ? 0 : UINT64_MAX;
+  for (auto &reads : antennaReads) {
+    result.minAntennaReads = std::min(result.minAntennaReads, reads.second);
+  }
+  result.pairs = registry->getRegistryLength();
+  delete registry;
+  return result;
+}
+
+/**
+ * Prints multi-reader simulation result
+ */
+void printReaderResult(const char *mode, uint32_t durationMs, const ReaderResult &result) {
+  double seconds = durationMs / 1000.0;
+  printf(
+    "  %-18s %6.0f frames/s decoded of %6.0f sent %4u antennas %6.1f reads/s on slowest antenna %4u tag and antenna pairs %8.2f us decode per second\n",
+    mode,
+    result.framesDecoded / seconds,
+    result.framesSent / seconds,
+    result.antennas,
+    result.minAntennaReads / seconds,
+    result.pairs,
+    result.decodeMicros / seconds
+  );
+}
+
+/**
+ * Struct for single read of a trace
+ */
+struct TraceRead {
+  unsigned long timeMs;
+  TagId id;
+  int16_t antenna;
+  double strength;
+};
+
+/**
+ * Struct for trace replay results
+ */
+struct TraceResult {
+  uint64_t appearances;
+  uint64_t flaps;
+  uint64_t leaves;
+  uint64_t leaveLatencyTotalMs;
+  uint64_t maxLeaveLatencyMs;
+};
+
+/**
+ * Replays read trace through the tag registry. Disappearance followed by reappearance of the same tag on
+ * the same antenna is a flap, and the last disappearance of a tag on an antenna is its leave. Leave latency
+ * is the time from the last read to the published disappearance
+ */
+TraceResult replayTrace(const std::vector<TraceRead> &trace, bool adaptive) {
+  TraceResult result = {};
+  TagRegistry *registry = new TagRegistry();
+  registry->setDisappearedTimeout(disappearedTimeoutMs);
+  registry->setAdaptiveTimeout(adaptive, 300, 5000);
+
+  std::map<std::string, unsigned long> lastRead;
+  std::map<std::string, unsigned long> leaveLatency;
+  auto getKey = [](const TagId &id, uint16_t antenna) {
+    char epc[TAG_EPC_HEX_SIZE];
+    id.epcToHex(epc);
+    return std::string(epc) + "/" + std::to_string(antenna);
+  };
+
+  size_t next = 0;
+  unsigned long end = trace.empty() ? 0 : trace.back().timeMs + 6000;
+  for (unsigned long now = 0; now < end; now++) {
+    for (; next < trace.size() && trace[next].timeMs <= now; next++) {
+      ContinueInventoryMessage message = { trace[next].id, trace[next].antenna, trace[next].strength };
+      registry->add(message, now);
+      lastRead[getKey(message.id, message.antenna)] = now;
+    }
+
+    if (now % baseFlushIntervalMs != 0 && !registry->expiryDue(now)) {
+      continue;
+    }
+    registry->flush(now, 0xFFFF, [&](const TagId &id, double strength, uint16_t antenna, const TagReadStatistics *statistics) {
+      if (statistics != NULL) {
+        return true;
+      }
+      std::string key = getKey(id, antenna);
+      if (strength > 0) {
+        result.appearances++;
+        if (leaveLatency.erase(key) > 0) {
+          result.flaps++;
+        }
+      } else {
+        leaveLatency[key] = now - lastRead[key];
+      }
+      return true;
+    });
+  }
+
+  for (auto &leave : leaveLatency) {
+    result.leaves++;
+    result.leaveLatencyTotalMs += leave.second;
+    result.maxLeaveLatencyMs = std::max<uint64_t>(result.maxLeaveLatencyMs, leave.second);
+  }
+  delete registry;
+  return result;
+}
+
+/**
+ * Generates trace of tags that are read steadily and leave one after another
+ */
+std::vector<TraceRead> generatePassingTrace() {
+  std::vector<TraceRead> trace;
+  uint64_t random = 4242;
+  for (uint32_t tag = 0; tag < 20; tag++) {
+    unsigned long enter = tag * 500;
+    unsigned long leave = enter + 5000 + tag * 400;
+    for (unsigned long time = enter; time < leave; time += 20 + (random >> 59)) {
+      random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+      // Some reads are missed
+      if ((random >> 33) % 20 != 0) {
+        trace.push_back({ time, constructTagId(tag), 1, 50.0 + (random >> 61) });
+      }
+    }
+  }
+  std::sort(trace.begin(), trace.end(), [](const TraceRead &a, const TraceRead &b) { return a.timeMs < b.timeMs; });
+  return trace;
+}
+
+/**
+ * Generates trace of tags at the edge of the antenna field that are read in short bursts with long gaps
+ */
+std::vector<TraceRead> generateEdgeTrace() {
+  std::vector<TraceRead> trace;
+  uint64_t random = 777;
+  for (uint32_t tag = 0; tag < 10; tag++) {
+    unsigned long time = tag * 100;
+    while (time < 60000) {
+      random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+      uint32_t burst = 2 + (random >> 33) % 4;
+      for (uint32_t i = 0; i < burst; i++) {
+        trace.push_back({ time + i * 30, constructTagId(tag), 2, 22.0 + (random >> 61) });
+      }
+      time += burst * 30 + 300 + (random >> 40) % 2200;
+    }
+  }
+  std::sort(trace.begin(), trace.end(), [](const TraceRead &a, const TraceRead &b) { return a.timeMs < b.timeMs; });
+  return trace;
+}
+
+/**
+ * Loads recorded read trace
+ *
+ * @return reads sorted by time, or empty trace if file could not be read
+ */
+std::vector<TraceRead> loadTrace(const char *path) {
+  std::vector<TraceRead> trace;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::stringstream stream(line);
+    std::string time, epc, antenna, strength;
+    if (!std::getline(stream, time, ',') || !std::getline(stream, epc, ',') || !std::getline(stream, antenna, ',') || !std::getline(stream, strength, ',')) {
+      continue;
+    }
+
+    TraceRead read = {};
+    read.timeMs = std::stoul(time);
+    for (size_t i = 0; i + 1 < epc.size() && read.id.epcLength < TAG_EPC_MAX_BYTES; i += 2) {
+      read.id.epc[read.id.epcLength++] = std::stoul(epc.substr(i, 2), NULL, 16);
+    }
+    read.antenna = std::stoi(antenna);
+    read.strength = std::stod(strength);
+    trace.push_back(read);
+  }
+  std::stable_sort(trace.begin(), trace.end(), [](const TraceRead &a, const TraceRead &b) { return a.timeMs < b.timeMs; });
+  return trace;
+}
+
+/**
+ * Prints trace replay result
+ */
+void printTraceResult(const char *mode, const TraceResult &result) {
+  printf(
+    "  %-18s %6llu appearances %6llu flaps %6llu leaves %6.0f ms average leave latency %6llu ms max\n",
+    mode,
+    (unsigned long long) result.appearances,
+    (unsigned long long) result.flaps,
+    (unsigned long long) result.leaves,
+    result.leaves > 0 ? (double) result.leaveLatencyTotalMs / result.leaves : 0.0,
+    (unsigned long long) result.maxLeaveLatencyMs
+  );
+}
+
+/**
+ * Replays trace with fixed and adaptive disappeared timeout
+ */
+void compareTimeouts(const char *name, const std::vector<TraceRead> &trace) {
+  printf("%s: %zu reads\n", name, trace.size());
+  printTraceResult("fixed timeout", replayTrace(trace, false));
+  printTraceResult("adaptive timeout", replayTrace(trace, true));
+}
+
+int main(int argc, char *argv[]) {
+  const Scenario scenarios[] = {
+    { "Quiet gallery", 5, 4, 200, 500, 10000 },
+    { "Busy exhibit", 40, 4, 400, 500, 10000 },
+    { "Crowded entrance", 120, 4, 600, 1000, 10000 },
+  };
+
+  for (const Scenario &scenario : scenarios) {
+    printf("%s: %u tags, %u antennas, %u reads/s, %u ms time frame\n", scenario.name, scenario.tagCount, scenario.antennaCount, scenario.readsPerSecond, scenario.timeFrameMs);
+    printResult("continuous", scenario, simulateContinuous(scenario));
+    printResult("time frame", scenario, simulateTimeFrame(scenario));
+  }
+
+  const LinkScenario linkScenarios[] = {
+    { "Empty gallery", 3, 4, 0, 2, 2, 0, 0, 60000 },
+    { "Quiet gallery", 3, 4, 100, 2, 2, 0, 0, 60000 },
+    { "Busy exhibit on healthy link", 60, 4, 400, 2, 2, 0, 0, 60000 },
+    { "Busy exhibit on congested link", 60, 4, 400, 2, 20, 20000, 40000, 60000 },
+    { "Crowded entrance on congested link", 90, 4, 600, 2, 20, 20000, 40000, 60000 },
+  };
+
+  for (const LinkScenario &scenario : linkScenarios) {
+    printf("%s: %u tags, %u reads/s, %u ms per publish (%u ms congested)\n", scenario.name, scenario.tagCount, scenario.readsPerSecond, scenario.publishMs, scenario.congestedPublishMs);
+    printLinkResult("fixed", simulateFlushing(scenario, false));
+    printLinkResult("adaptive", simulateFlushing(scenario, true));
+  }
+
+  printf("Tags walking between two antennas: 20 tags, 400 reads/s, 20 s walk period\n");
+  printZoneResult("antenna", simulateZones(false, 0));
+  printZoneResult("zone", simulateZones(true, 0));
+  printZoneResult("zone, hysteresis 6", simulateZones(true, 6));
+
+  const uint32_t readerDurationMs = 10000;
+  printf("Readers covering 8 antennas: 10 tags, 600 reads/s per reader module\n");
+  printReaderResult("one reader", readerDurationMs, simulateReaders(1, 8, readerDurationMs));
+  printReaderResult("two readers", readerDurationMs, simulateReaders(2, 8, readerDurationMs));
+
+  compareTimeouts("Tags read steadily passing by", generatePassingTrace());
+  compareTimeouts("Tags at the edge of antenna field", generateEdgeTrace());
+  for (int i = 1; i < argc; i++) {
+    compareTimeouts(argv[i], loadTrace(argv[i]));
+  }
+
+  return 0;
+}
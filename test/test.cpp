@@ -5,7 +5,20 @@
 #include <string.h>
 #include <iomanip>
 #include <sstream>
+#include <vector>
 #include "../src/message-parser.cpp"
+#include "../src/delta-patch.cpp"
+#include "../src/broker-table.cpp"
+#include "../src/publish-window.cpp"
+#include "../src/epc-filter.cpp"
+#include "../src/tag-registry.cpp"
+#include "../src/tag-interner.cpp"
+#include "../src/warm-restart-state.cpp"
+#include "../src/reader-frame-decoder.cpp"
+#include "../src/event-stream.cpp"
+#include "../src/log-buffer.cpp"
+#include "../src/ota-schedule.cpp"
+#include <map>
 
 uint32_t antennaStoppedMessageLength = 9;
 uint32_t antennaStoppedMessage[9] = { 0xA5, 0x5A, 0x00, 0x09, 0x8D, 0x01, 0x85, 0x0D, 0x0A };
@@ -36,8 +49,1077 @@ uint32_t continueInventoryMessage[29] = {
   0x0D, 0x0A
 };
 
+uint32_t timeFrameResultEndMessageLength = 9;
+uint32_t timeFrameResultEndMessage[9] = { 0xA5, 0x5A, 0x00, 0x09, 0x92, 0x01, 0x9A, 0x0D, 0x0A };
+
 void handleResponse(ContinueInventoryMessage message) {
-  message.printValues();
+  char epc[TAG_EPC_HEX_SIZE];
+  message.id.epcToHex(epc);
+  std::cout << "EPC: " << epc << ", antenna: " << message.antenna << ", strength: " << message.strength << "\n";
+}
+
+/**
+ * Check that constructed command matches the hard coded start antenna command
+ */
+void testConstructCommand() {
+  const uint32_t startAntennaCommand[10] = { 0xA5, 0x5A, 0x00, 0x0A, 0x82, 0x27, 0x10, 0xBF, 0x0D, 0x0A };
+  const uint32_t payload[2] = { 0x27, 0x10 };
+  uint32_t command[10];
+  MessageParser parser;
+  uint32_t length = parser.constructCommand(CONTINUE_INVENTORY, payload, 2, command);
+
+  bool matches = length == 10;
+  for (uint32_t i = 0; matches && i < length; i++) {
+    matches = command[i] == startAntennaCommand[i];
+  }
+
+  std::cout << (matches ? "Constructed command was correct\n" : "Constructed command was incorrect!!\n");
+}
+
+/**
+ * Constructs continue inventory response with given PC word, EPC and TID
+ *
+ * @return parsed tag report
+ */
+ContinueInventoryMessage parseConstructedTagReport(uint32_t pc, uint32_t epcLength, uint32_t tidLength) {
+  uint32_t payload[128];
+  uint32_t length = 0;
+  payload[length++] = pc >> 8;
+  payload[length++] = pc & 0xFF;
+  for (uint32_t i = 0; i < epcLength; i++) {
+    payload[length++] = (uint8_t) (0xE0 + i);
+  }
+  for (uint32_t i = 0; i < tidLength; i++) {
+    payload[length++] = 0x10 + i;
+  }
+  const uint32_t trailer[7] = { 0xFD, 0x6F, 0x03, 0x0D, 0xF7, 0x32, 0x2D };
+  for (uint32_t value : trailer) {
+    payload[length++] = value;
+  }
+
+  MessageParser parser;
+  uint32_t message[160];
+  parser.constructCommand(CONTINUE_INVENTORY_RESPONSE, payload, length, message);
+  return parser.parseContinueInventoryResponse(message);
+}
+
+/**
+ * Checks that EPC and TID of parsed tag report have expected lengths and bytes, and that
+ * the fields after them were found
+ */
+bool checkTagReport(const ContinueInventoryMessage &message, uint32_t epcLength, uint32_t tidLength) {
+  bool correct = message.id.epcLength == epcLength && message.id.tidLength == tidLength;
+  for (uint32_t i = 0; correct && i < epcLength; i++) {
+    correct = message.id.epc[i] == (uint8_t) (0xE0 + i);
+  }
+  for (uint32_t i = 0; correct && i < tidLength; i++) {
+    correct = message.id.tid[i] == 0x10 + i;
+  }
+  return correct && message.antenna == 3 && message.strength > 28.5 && message.strength < 28.7;
+}
+
+/**
+ * Appends continue inventory response frame bytes to reader byte stream
+ *
+ * @param stream reader byte stream
+ * @param tag last byte of EPC, EPC also contains frame start markers
+ * @param antenna antenna number
+ */
+void appendTagFrame(std::vector<uint8_t> &stream, uint8_t tag, uint8_t antenna) {
+  const uint32_t payload[21] = {
+    0x30, 0x00,
+    0xE2, 0x00, 0xA5, 0x5A, 0x00, 0x08, 0x01, 0x13, 0x0D, 0x0A, 0x00, tag,
+    0xFD, 0x6F,
+    antenna,
+    0x0D, 0xF7, 0x32,
+    0x2D
+  };
+  MessageParser parser;
+  uint32_t frame[64];
+  uint32_t length = parser.constructCommand(CONTINUE_INVENTORY_RESPONSE, payload, 21, frame);
+  stream.insert(stream.end(), frame, frame + length);
+}
+
+/**
+ * Check that decoders of two reader ports fed in interleaved chunks decode the frames of their own
+ * reader, and that antennas are moved to the antenna namespace of the reader
+ */
+void testReaderFrameDecoders() {
+  std::vector<uint8_t> streams[2];
+  // Header with invalid length and stray bytes before the first frame
+  const uint8_t garbage[] = { 0x00, 0xA5, 0x5A, 0x00, 0x02, 0x13, 0xA5 };
+  streams[0].insert(streams[0].end(), garbage, garbage + sizeof(garbage));
+  for (uint8_t tag = 0; tag < 20; tag++) {
+    appendTagFrame(streams[0], tag, 1 + tag % 4);
+    appendTagFrame(streams[1], tag, 3);
+  }
+
+  ReaderFrameDecoder decoders[2] = { ReaderFrameDecoder(0), ReaderFrameDecoder(1) };
+  std::vector<ContinueInventoryMessage> messages[2];
+  bool correct = true;
+  auto complete = [&messages, &correct](const ReaderFrame &frame) {
+    MessageParser parser;
+    uint32_t message[READER_FRAME_MAX_LENGTH];
+    for (uint16_t i = 0; i < frame.length; i++) {
+      message[i] = frame.data[i];
+    }
+    correct = correct && parser.checkMessageStart(message) && parser.checkMessageEnd(message, frame.length) && parser.checkCRC(message);
+    ContinueInventoryMessage parsed = parser.parseContinueInventoryResponse(message);
+    parsed.antenna = getReaderAntenna(frame.reader, parsed.antenna);
+    messages[frame.reader].push_back(parsed);
+  };
+
+  size_t positions[2] = { 0, 0 };
+  for (size_t round = 0; positions[0] < streams[0].size() || positions[1] < streams[1].size(); round++) {
+    for (uint8_t reader = 0; reader < 2; reader++) {
+      size_t chunk = 1 + (round * 5 + reader * 3) % 7;
+      for (; chunk > 0 && positions[reader] < streams[reader].size(); chunk--) {
+        decoders[reader].decode(streams[reader][positions[reader]++], complete);
+      }
+    }
+  }
+
+  correct = correct && messages[0].size() == 20 && messages[1].size() == 20;
+  correct = correct && decoders[0].getInvalidLengthCount() == 1 && decoders[1].getInvalidLengthCount() == 0;
+  for (uint8_t tag = 0; correct && tag < 20; tag++) {
+    correct = messages[0][tag].id.epc[11] == tag && messages[0][tag].antenna == 1 + tag % 4;
+    correct = correct && messages[1][tag].id.epc[11] == tag && messages[1][tag].antenna == 103;
+    correct = correct && messages[0][tag].id == messages[1][tag].id;
+  }
+
+  std::cout << (correct ? "Reader frame decoders were correct\n" : "Reader frame decoders were incorrect!!\n");
+}
+
+/**
+ * Check that EPC length is taken from the PC word and TID from the rest of the tag report
+ */
+void testTagReportLengths() {
+  // PC length bits hold EPC length in words
+  const uint32_t epcBits[4] = { 64, 96, 128, 256 };
+  bool correct = true;
+  for (uint32_t bits : epcBits) {
+    uint32_t words = bits / 16;
+    correct = correct && checkTagReport(parseConstructedTagReport((words << 11) | 0x0100, words * 2, 0), words * 2, 0);
+  }
+
+  // EPC and TID mode with 96-bit TID
+  correct = correct && checkTagReport(parseConstructedTagReport(0x3000, 12, 12), 12, 12);
+
+  // Largest EPC the PC word can declare
+  ContinueInventoryMessage largest = parseConstructedTagReport(0xF800, 62, 0);
+  correct = correct && checkTagReport(largest, 62, 0);
+  char hex[TAG_EPC_HEX_SIZE];
+  largest.id.epcToHex(hex);
+  correct = correct && strlen(hex) == 124 && strncmp(hex, "e0e1e2", 6) == 0;
+
+  // PC declares longer EPC than the report has, or TID does not fit
+  correct = correct && parseConstructedTagReport(0x4000, 12, 0).id.empty();
+  correct = correct && parseConstructedTagReport(0x3000, 12, TAG_TID_MAX_BYTES + 2).id.empty();
+
+  // Same EPC with different TID is a different tag
+  ContinueInventoryMessage first = parseConstructedTagReport(0x3000, 12, 12);
+  ContinueInventoryMessage second = first;
+  second.id.tid[11] ^= 0xFF;
+  correct = correct && first.id == parseConstructedTagReport(0x3000, 12, 12).id && first.id != second.id;
+
+  std::cout << (correct ? "Tag report lengths were correct\n" : "Tag report lengths were incorrect!!\n");
+}
+
+/**
+ * Check that EPC filter matches parsed tags against EPCs listed as hex strings and that
+ * replacing update drops the previous EPCs
+ */
+void testEpcFilterTagId() {
+  EpcFilter filter;
+  filter.setMode(EPC_FILTER_ALLOW);
+  filter.update({ "E0E1E2E3E4E5E6E7E8E9EAEB", "e0e1e2e3e4e5e6e7" }, {});
+
+  bool correct = (
+    filter.accepts(parseConstructedTagReport(0x3000, 12, 0).id) &&
+    filter.accepts(parseConstructedTagReport(0x3000, 12, 12).id) &&
+    filter.accepts(parseConstructedTagReport(0x2000, 8, 0).id) &&
+    !filter.accepts(parseConstructedTagReport(0x4000, 16, 0).id)
+  );
+  // Update that replaces the set keeps only its own additions
+  correct = correct && filter.update({ "E2003411B802011383258566" }, {}, true) && filter.size() == 1;
+  correct = correct && filter.contains("e2003411b802011383258566") && !filter.accepts(parseConstructedTagReport(0x3000, 12, 0).id);
+
+  std::cout << (correct ? "EPC filter matched tag ids correctly\n" : "EPC filter matched tag ids incorrectly!!\n");
+}
+
+/**
+ * Check that EPC filter is restored from its encoded form and that invalid encodings are rejected
+ */
+void testEpcFilterEncoding() {
+  EpcFilter filter;
+  filter.setMode(EPC_FILTER_DENY);
+  filter.update({ "E0E1E2E3E4E5E6E7E8E9EAEB", "E2003411B802011383258566", "0001" }, { "0001" });
+  std::vector<uint8_t> encoded;
+  filter.encode(encoded);
+
+  EpcFilter restored;
+  bool correct = encoded.size() == EpcFilter::encodedHeaderLength + 2 * EpcFilter::entryLength;
+  correct = correct && restored.decode(encoded.data(), encoded.size()) && restored.getMode() == EPC_FILTER_DENY && restored.size() == 2;
+  correct = correct && restored.contains("e2003411b802011383258566") && !restored.contains("0001");
+  correct = correct && !restored.accepts(parseConstructedTagReport(0x3000, 12, 0).id);
+  correct = correct && !restored.decode(encoded.data(), encoded.size() - 1) && restored.size() == 2;
+  encoded[0] = 7;
+  correct = correct && !restored.decode(encoded.data(), encoded.size()) && restored.getMode() == EPC_FILTER_DENY;
+
+  restored.clear();
+  correct = correct && restored.size() == 0 && restored.accepts("e2003411b802011383258566");
+  std::cout << (correct ? "EPC filter encoding was correct\n" : "EPC filter encoding was incorrect!!\n");
+}
+
+/**
+ * Check that reads coalesced into one strength update are summarized in its statistics
+ */
+void testReadStatistics() {
+  TagRegistry *registry = new TagRegistry();
+  ContinueInventoryMessage message = parseConstructedTagReport(0x3000, 12, 0);
+  const double strengths[5] = { 40, 50, 30, 60, 45 };
+
+  // First read is the appearance, the rest coalesce into one strength update
+  registry->add(message, 1000);
+  for (uint32_t i = 0; i < 5; i++) {
+    message.strength = strengths[i];
+    registry->add(message, 1010 + i * 10);
+  }
+
+  uint32_t presences = 0;
+  uint32_t updates = 0;
+  bool correct = true;
+  registry->flush(1100, 10, [&](const TagId &, double strength, uint16_t, const TagReadStatistics *statistics) {
+    if (statistics == NULL) {
+      presences++;
+      return true;
+    }
+    updates++;
+    correct = correct && strength == 45 && statistics->count == 5;
+    correct = correct && statistics->minStrength == 30 && statistics->maxStrength == 60;
+    correct = correct && statistics->meanStrength > 44.99 && statistics->meanStrength < 45.01;
+    correct = correct && statistics->firstSeen == 1010 && statistics->lastSeen == 1050;
+    return true;
+  });
+
+  // Statistics start over after publishing
+  message.strength = 70;
+  registry->add(message, 1200);
+  registry->flush(1210, 10, [&](const TagId &, double, uint16_t, const TagReadStatistics *statistics) {
+    updates++;
+    correct = correct && statistics != NULL && statistics->count == 1 && statistics->minStrength == 70 && statistics->firstSeen == 1200;
+    return true;
+  });
+  delete registry;
+
+  correct = correct && presences == 1 && updates == 2;
+  std::cout << (correct ? "Read statistics were correct\n" : "Read statistics were incorrect!!\n");
+}
+
+/**
+ * Replays read times of a tag through registry and counts published presence transitions
+ *
+ * @param reads read times in milliseconds
+ * @param adaptive whether adaptive timeout is enabled
+ * @param lastDisappearance time of the last published disappearance
+ * @return number of disappearances
+ */
+uint32_t replayReadTimes(const std::vector<unsigned long> &reads, bool adaptive, unsigned long *lastDisappearance) {
+  TagRegistry *registry = new TagRegistry();
+  registry->setDisappearedTimeout(1500);
+  registry->setAdaptiveTimeout(adaptive, 300, 5000);
+  ContinueInventoryMessage message = parseConstructedTagReport(0x3000, 12, 0);
+  uint32_t disappearances = 0;
+
+  size_t next = 0;
+  for (unsigned long now = 0; now < reads.back() + 6000; now++) {
+    for (; next < reads.size() && reads[next] <= now; next++) {
+      registry->add(message, now);
+    }
+    if (now % 100 == 0 || registry->expiryDue(now)) {
+      registry->flush(now, 100, [&](const TagId &, double strength, uint16_t, const TagReadStatistics *statistics) {
+        if (statistics == NULL && strength == 0) {
+          disappearances++;
+          *lastDisappearance = now;
+        }
+        return true;
+      });
+    }
+  }
+  delete registry;
+  return disappearances;
+}
+
+/**
+ * Check that adaptive timeout detects steadily read tag leaving sooner, and keeps tag read in bursts
+ * through the gaps between bursts after it has seen a few of them
+ */
+void testAdaptiveTimeout() {
+  std::vector<unsigned long> steady;
+  for (unsigned long time = 0; time < 3000; time += 25) {
+    steady.push_back(time);
+  }
+  unsigned long fixedLeave = 0;
+  unsigned long adaptiveLeave = 0;
+  bool correct = replayReadTimes(steady, false, &fixedLeave) == 1 && replayReadTimes(steady, true, &adaptiveLeave) == 1;
+  correct = correct && fixedLeave > 2975 + 1500 && fixedLeave <= 2975 + 1600;
+  correct = correct && adaptiveLeave > 2975 + 300 && adaptiveLeave <= 2975 + 400;
+
+  // Bursts of three reads with gaps longer than the disappeared timeout
+  const unsigned long gaps[] = { 1800, 600, 2000, 1700, 900, 2200, 1600, 1900, 800, 2100, 1700, 2000, 1200, 1800, 2300, 1600 };
+  std::vector<unsigned long> bursts;
+  unsigned long time = 0;
+  for (int round = 0; round < 3; round++) {
+    for (unsigned long gap : gaps) {
+      for (int i = 0; i < 3; i++) {
+        bursts.push_back(time + i * 30);
+      }
+      time += 60 + gap;
+    }
+  }
+  uint32_t fixedFlaps = replayReadTimes(bursts, false, &fixedLeave) - 1;
+  uint32_t adaptiveFlaps = replayReadTimes(bursts, true, &adaptiveLeave) - 1;
+  correct = correct && fixedFlaps > 25 && adaptiveFlaps < 5;
+
+  std::cout << (correct ? "Adaptive timeout was correct\n" : "Adaptive timeout was incorrect!!\n");
+}
+
+/**
+ * Check that event stream completes WebSocket and plain TCP handshakes, sends events in the format
+ * each client asked for, and drops clients that do not keep up or do not complete their request
+ */
+void testEventStream() {
+  EventStream *stream = new EventStream();
+  std::map<int, std::string> written;
+  std::vector<int> closed;
+  auto write = [&written](int connection, const uint8_t *data, size_t length) {
+    if (connection == 3) {
+      // Slow client that never reads
+      return 0;
+    }
+    written[connection].append((const char *) data, length);
+    return (int) length;
+  };
+  auto close = [&closed](int connection) {
+    closed.push_back(connection);
+  };
+  auto receive = [&stream](int8_t index, const char *data) {
+    stream->receive(index, (const uint8_t *) data, strlen(data));
+  };
+
+  receive(stream->accept(1, 0), "json\n");
+  int8_t webSocket = stream->accept(2, 0);
+  receive(webSocket, "GET /events/binary HTTP/1.1\r\nHost: reader\r\nUpgrade: websocket\r\n");
+  receive(webSocket, "Connection: Upgrade\r\nsec-websocket-key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n");
+  receive(stream->accept(3, 0), "binary\r\n");
+  receive(stream->accept(4, 0), "hello\n");
+  bool correct = stream->accept(5, 0) == -1 && stream->getClientCount() == 3;
+
+  ContinueInventoryMessage message = parseConstructedTagReport(0x3000, 12, 0);
+  stream->publish(message.id, 55.25, 3);
+  stream->poll(100, write, close);
+  correct = correct && closed.size() == 1 && closed[0] == 4;
+  correct = correct && written[1] == "{\"antenna\":3,\"tag\":\"e0e1e2e3e4e5e6e7e8e9eaeb\",\"strength\":55.25}\n";
+
+  std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n";
+  response += "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n";
+  std::string frame = { (char) 0x82, 17, 12 };
+  frame.append((const char *) message.id.epc, 12);
+  frame += { 0, 0, 3, 55 };
+  correct = correct && written[2] == response + frame;
+
+  // Slow client is dropped when its queue is full, the others keep up
+  for (uint16_t i = 0; i < 200; i++) {
+    stream->publish(message.id, i % 2 == 0 ? 0 : 40, 3);
+    stream->poll(200, write, close);
+  }
+  correct = correct && closed.size() == 2 && closed[1] == 3 && stream->getDroppedCount() == 1;
+  correct = correct && stream->getClientCount() == 2 && written[2].size() == response.size() + frame.size() * 201;
+
+  // Client that does not complete its request in time is closed
+  stream->accept(6, 1000);
+  stream->poll(1000 + EventStream::handshakeTimeoutMs + 1, write, close);
+  correct = correct && closed.size() == 3 && closed[2] == 6;
+  delete stream;
+
+  std::cout << (correct ? "Event stream was correct\n" : "Event stream was incorrect!!\n");
+}
+
+static uint32_t listenedEvents = 0;
+static uint32_t listenedDisappearances = 0;
+
+/**
+ * Counts events given to registry event listener
+ */
+void countListenedEvent(const TagId &, double strength, uint16_t) {
+  listenedEvents++;
+  if (strength == 0) {
+    listenedDisappearances++;
+  }
+}
+
+/**
+ * Check that event listener gets every event as it is queued, strength updates also while presence
+ * transitions are stuck on a failing link and disappearances without flushing
+ */
+void testEventListener() {
+  TagRegistry *registry = new TagRegistry();
+  registry->setEventListener(countListenedEvent);
+  ContinueInventoryMessage message = parseConstructedTagReport(0x3000, 12, 0);
+  auto failingPublisher = [](const TagId &, double, uint16_t, const TagReadStatistics *) {
+    return false;
+  };
+
+  registry->add(message, 0);
+  bool correct = listenedEvents == 1;
+  registry->flush(10, 100, failingPublisher);
+  registry->add(message, 20);
+  registry->add(message, 30);
+  registry->flush(40, 100, failingPublisher);
+  // Coalesced strength updates are each given to the listener once
+  correct = correct && listenedEvents == 3 && registry->getQueueLength() == 2;
+
+  registry->expire(2000);
+  correct = correct && listenedEvents == 4 && listenedDisappearances == 1;
+  registry->flush(2010, 100, failingPublisher);
+  correct = correct && listenedEvents == 4;
+  delete registry;
+
+  std::cout << (correct ? "Event listener was correct\n" : "Event listener was incorrect!!\n");
+}
+
+/**
+ * Check that presence transitions count against the flush budget, and that strength update refused by a
+ * full publish window stays queued instead of being shed
+ */
+void testFlushBackpressure() {
+  TagRegistry *registry = new TagRegistry();
+  ContinueInventoryMessage message = parseConstructedTagReport(0x3000, 12, 0);
+  uint16_t room = 0;
+  uint32_t published = 0;
+  auto windowPublisher = [&room, &published](const TagId &, double, uint16_t, const TagReadStatistics *) {
+    if (room == 0) {
+      return false;
+    }
+    room--;
+    published++;
+    return true;
+  };
+
+  // Two appearances, then a strength update of each tag
+  for (uint16_t antenna = 1; antenna <= 2; antenna++) {
+    message.antenna = antenna;
+    registry->add(message, 0);
+  }
+  for (uint16_t antenna = 1; antenna <= 2; antenna++) {
+    message.antenna = antenna;
+    registry->add(message, 10);
+  }
+
+  room = 10;
+  registry->flush(20, 3, windowPublisher);
+  bool correct = published == 3 && registry->getQueueLength() == 1;
+
+  room = 0;
+  registry->flush(30, 3, windowPublisher);
+  correct = correct && published == 3 && registry->getQueueLength() == 1 && registry->getShedCount() == 0;
+
+  room = 10;
+  registry->flush(40, 3, windowPublisher);
+  correct = correct && published == 4 && registry->getQueueLength() == 0 && registry->getShedCount() == 0;
+  delete registry;
+
+  std::cout << (correct ? "Flush backpressure was correct\n" : "Flush backpressure was incorrect!!\n");
+}
+
+/**
+ * Check that zone mode counts and drops tags that do not fit the registry instead of queueing strength updates
+ */
+void testZoneOverflow() {
+  TagRegistry *registry = new TagRegistry();
+  registry->setZoneMode(true, 6);
+  ContinueInventoryMessage message = parseConstructedTagReport(0x3000, 12, 0);
+  for (uint16_t i = 0; i <= TagRegistry::registryBufferSize; i++) {
+    message.id.epc[0] = i & 0xFF;
+    message.id.epc[1] = i >> 8;
+    registry->add(message, 0);
+  }
+  // Only appearances of the tracked tags are queued
+  bool correct = registry->getRegistryOverflowCount() == 1 && registry->getQueueLength() == TagRegistry::registryBufferSize;
+  delete registry;
+
+  std::cout << (correct ? "Zone overflow was correct\n" : "Zone overflow was incorrect!!\n");
+}
+
+/**
+ * Check that log buffer keeps messages in order, counts repeats of the same source instead of buffering
+ * them, reports the count with the latest text when the repeat interval ends and drops messages when full
+ */
+void testLogBuffer() {
+  LogBuffer *buffer = new LogBuffer();
+  const char *crcSource = "Message CRC was incorrect";
+  const char *overflowSource = "UART overflow of reader %u";
+  LogEntry entry;
+
+  bool added = buffer->add(LOG_LEVEL_WARNING, crcSource, "crc 1", 0);
+  added = added && !buffer->add(LOG_LEVEL_WARNING, crcSource, "crc 2", 10);
+  added = added && !buffer->add(LOG_LEVEL_WARNING, crcSource, "crc 3", 20);
+  added = added && buffer->add(LOG_LEVEL_INFO, overflowSource, "overflow", 30);
+  bool correct = added && buffer->getLength() == 2 && buffer->getSuppressedCount() == 2;
+  correct = correct && buffer->take(&entry) && strcmp(entry.text, "crc 1") == 0 && entry.repeated == 0;
+  correct = correct && buffer->take(&entry) && strcmp(entry.text, "overflow") == 0 && entry.level == LOG_LEVEL_INFO;
+  correct = correct && !buffer->take(&entry);
+
+  buffer->expire(LogBuffer::repeatIntervalMs - 1);
+  correct = correct && buffer->getLength() == 0;
+  buffer->expire(LogBuffer::repeatIntervalMs);
+  correct = correct && buffer->take(&entry) && strcmp(entry.text, "crc 3") == 0 && entry.repeated == 2;
+  correct = correct && !buffer->add(LOG_LEVEL_WARNING, crcSource, "crc 4", LogBuffer::repeatIntervalMs + 10);
+  correct = correct && buffer->add(LOG_LEVEL_WARNING, crcSource, "crc 5", LogBuffer::repeatIntervalMs * 2 + 10);
+  correct = correct && buffer->take(&entry) && strcmp(entry.text, "crc 4") == 0 && entry.repeated == 1;
+  correct = correct && buffer->take(&entry) && strcmp(entry.text, "crc 5") == 0 && entry.repeated == 0;
+  std::cout << (correct ? "Log repeats were counted correctly\n" : "Log repeats were counted incorrectly!!\n");
+
+  // Every message has its own source, so only the buffer size limits them
+  char sources[LogBuffer::size + 2];
+  for (uint8_t i = 0; i < LogBuffer::size + 2; i++) {
+    buffer->add(LOG_LEVEL_DEBUG, &sources[i], "message", 100000);
+  }
+  bool dropped = buffer->getLength() == LogBuffer::size && buffer->getDroppedCount() == 2;
+  std::cout << (dropped ? "Full log buffer dropped messages correctly\n" : "Full log buffer did not drop messages correctly!!\n");
+  delete buffer;
+}
+
+/**
+ * Struct for tag decoded from presence snapshot
+ */
+struct SnapshotTag {
+  std::string epc;
+  uint8_t antenna;
+  uint8_t strength;
+};
+
+/**
+ * Decodes presence snapshot as consumer would
+ *
+ * @return decoded tags or empty list if snapshot is malformed
+ */
+std::vector<SnapshotTag> decodeSnapshot(const uint8_t *snapshot, size_t length, bool *truncated) {
+  std::vector<SnapshotTag> tags;
+  if (length < 4 || snapshot[0] != 1) {
+    return tags;
+  }
+  uint16_t count = (snapshot[1] << 8) | snapshot[2];
+  *truncated = snapshot[3] & 0x01;
+  size_t position = 4;
+  for (uint16_t i = 0; i < count && position < length; i++) {
+    char epc[TAG_EPC_HEX_SIZE];
+    uint8_t epcLength = snapshot[position++];
+    TagId::toHex(snapshot + position, epcLength, epc);
+    position += epcLength;
+    position += 1 + snapshot[position];
+    tags.push_back({ epc, snapshot[position], snapshot[position + 1] });
+    position += 2;
+  }
+  return position == length ? tags : std::vector<SnapshotTag>();
+}
+
+/**
+ * Check that presence snapshot lists tracked tags and becomes stale only when presence or strength changes
+ */
+void testPresenceSnapshot() {
+  TagRegistry *registry = new TagRegistry();
+  uint8_t snapshot[1024];
+  bool truncated = false;
+
+  ContinueInventoryMessage first = parseConstructedTagReport(0x3000, 12, 0);
+  ContinueInventoryMessage second = parseConstructedTagReport(0x2000, 8, 0);
+  second.antenna = 1;
+  registry->add(first, 0);
+  registry->add(second, 0);
+  bool correct = registry->isSnapshotStale();
+
+  std::vector<SnapshotTag> tags = decodeSnapshot(snapshot, registry->encodeSnapshot(snapshot, sizeof(snapshot)), &truncated);
+  correct = correct && !registry->isSnapshotStale() && tags.size() == 2 && !truncated;
+  correct = correct && tags[0].epc == "e0e1e2e3e4e5e6e7e8e9eaeb" && tags[0].antenna == 3 && tags[0].strength == 29;
+  correct = correct && tags[1].epc == "e0e1e2e3e4e5e6e7" && tags[1].antenna == 1;
+
+  // Static tags with small strength changes do not make the snapshot stale
+  for (unsigned long now = 10; now < 1000; now += 10) {
+    first.strength = 28.6 + (now % 20 == 0 ? 2 : -2);
+    registry->add(first, now);
+    registry->add(second, now);
+  }
+  registry->flush(1000, 100, [](const TagId &, double, uint16_t, const TagReadStatistics *) {
+    return true;
+  });
+  correct = correct && !registry->isSnapshotStale();
+
+  // Strength change and disappearance do
+  first.strength = 60;
+  for (unsigned long now = 1000; now < 1100; now += 10) {
+    registry->add(first, now);
+  }
+  correct = correct && registry->isSnapshotStale();
+  tags = decodeSnapshot(snapshot, registry->encodeSnapshot(snapshot, sizeof(snapshot)), &truncated);
+  correct = correct && tags.size() == 2 && tags[0].strength > 50;
+
+  registry->flush(2550, 100, [](const TagId &, double, uint16_t, const TagReadStatistics *) {
+    return true;
+  });
+  correct = correct && registry->isSnapshotStale();
+  tags = decodeSnapshot(snapshot, registry->encodeSnapshot(snapshot, sizeof(snapshot)), &truncated);
+  correct = correct && tags.size() == 1 && tags[0].antenna == 3;
+
+  // Tags that do not fit are left out
+  tags = decodeSnapshot(snapshot, registry->encodeSnapshot(snapshot, 10), &truncated);
+  correct = correct && tags.size() == 0 && truncated;
+  delete registry;
+
+  std::cout << (correct ? "Presence snapshot was correct\n" : "Presence snapshot was incorrect!!\n");
+}
+
+/**
+ * Check that registry saved before restart is restored without announcing tags again, and that tags
+ * missing after restart are declared gone
+ */
+void testWarmRestart() {
+  TagRegistry *registry = new TagRegistry();
+  WarmRestartState *state = new WarmRestartState();
+  // Presence transitions
+  std::vector<std::string> published;
+  auto publisher = [&published](const TagId &id, double strength, uint16_t antenna, const TagReadStatistics *statistics) {
+    char epc[TAG_EPC_HEX_SIZE];
+    id.epcToHex(epc);
+    if (statistics != NULL) {
+      return true;
+    }
+    published.push_back(std::string(epc) + "/" + std::to_string(antenna) + (strength == 0 ? " gone" : " seen"));
+    return true;
+  };
+
+  ContinueInventoryMessage first = parseConstructedTagReport(0x3000, 12, 0);
+  ContinueInventoryMessage second = parseConstructedTagReport(0x2000, 8, 0);
+  ContinueInventoryMessage third = parseConstructedTagReport(0x2000, 8, 0);
+  second.antenna = 1;
+  third.antenna = 2;
+  registry->add(first, 0);
+  registry->add(second, 0);
+  registry->flush(0, 100, publisher);
+  // Appearance of third tag is still waiting in presence queue
+  registry->add(third, 100);
+  sealWarmRestartState(state, registry->saveState(state->data, WARM_RESTART_STATE_SIZE));
+  delete registry;
+
+  bool correct = isWarmRestartStateValid(*state);
+  state->data[6] ^= 0x01;
+  correct = correct && !isWarmRestartStateValid(*state);
+  state->data[6] ^= 0x01;
+  correct = correct && isWarmRestartStateValid(*state);
+  clearWarmRestartState(state);
+  correct = correct && !isWarmRestartStateValid(*state);
+
+  registry = new TagRegistry();
+  correct = correct && !registry->restoreState(state->data, state->length - 1, 50) && registry->getRegistryLength() == 0;
+  correct = correct && registry->restoreState(state->data, state->length, 50) && registry->getRegistryLength() == 3;
+
+  published.clear();
+  registry->flush(60, 100, publisher);
+  correct = correct && published.size() == 1 && published[0] == "e0e1e2e3e4e5e6e7/2 seen";
+
+  // First tag is still there, the others left during restart
+  published.clear();
+  for (unsigned long now = 100; now <= 2000; now += 100) {
+    registry->add(first, now);
+    registry->flush(now, 100, publisher);
+  }
+  correct = correct && published.size() == 2;
+  correct = correct && published[0] == "e0e1e2e3e4e5e6e7/1 gone" && published[1] == "e0e1e2e3e4e5e6e7/2 gone";
+  correct = correct && registry->getRegistryLength() == 1;
+  delete registry;
+  delete state;
+
+  std::cout << (correct ? "Warm restart was correct\n" : "Warm restart was incorrect!!\n");
+}
+
+/**
+ * Consumer side decoder for interned tag events. Keeps the retained mappings it has received
+ */
+struct TagIdDecoder {
+  std::map<uint16_t, std::string> mappings;
+
+  void receiveMapping(uint16_t sessionId, const std::string &epc) {
+    mappings[sessionId] = epc;
+  }
+
+  std::string decode(uint16_t sessionId) {
+    auto found = mappings.find(sessionId);
+    return found == mappings.end() ? "" : found->second;
+  }
+};
+
+/**
+ * Check that interned tag events decode back to their EPCs, also when the table runs full and
+ * ids are given to other tags
+ */
+void testTagInterner() {
+  TagInterner *interner = new TagInterner();
+  TagIdDecoder decoder;
+  bool correct = true;
+  uint32_t events = 0;
+  uint32_t mappingsPublished = 0;
+
+  // Mappings are published in the same stream before the events that use them, event is not published
+  // when its mapping fails to go out
+  auto publishEvent = [&](uint32_t tag, unsigned long now, bool mappingFails) {
+    TagId id = {};
+    id.epcLength = 12;
+    id.epc[0] = 0xE2;
+    id.epc[10] = tag >> 8;
+    id.epc[11] = tag & 0xFF;
+    char epc[TAG_EPC_HEX_SIZE];
+    id.epcToHex(epc);
+
+    bool mappingPending;
+    uint16_t sessionId = interner->intern(id, now, &mappingPending);
+    if (mappingPending) {
+      if (mappingFails) {
+        return false;
+      }
+      char mapping[TAG_EPC_HEX_SIZE];
+      interner->getTag(sessionId).epcToHex(mapping);
+      decoder.receiveMapping(sessionId, mapping);
+      interner->setMappingPublished(sessionId);
+      mappingsPublished++;
+    }
+    correct = correct && sessionId < TagInterner::capacity && decoder.decode(sessionId) == epc;
+    events++;
+    return true;
+  };
+
+  // Same few hundred tags all day, with a new batch of tags every hour
+  unsigned long now = 0;
+  for (uint32_t hour = 0; hour < 4; hour++) {
+    for (uint32_t round = 0; round < 20; round++) {
+      for (uint32_t tag = 0; tag < 200; tag++) {
+        publishEvent(hour * 100 + tag, now, false);
+        now += 7;
+      }
+    }
+  }
+  correct = correct && interner->getCount() == TagInterner::capacity && interner->getEvictionCount() > 0;
+  correct = correct && mappingsPublished == TagInterner::capacity + interner->getEvictionCount();
+  // Each hour adds 100 new tags, the first hour 200
+  correct = correct && mappingsPublished == 500;
+
+  // Consumer that connects later gets the retained mappings republished on reconnect
+  decoder.mappings.clear();
+  for (uint16_t i = 0; i < interner->getCount(); i++) {
+    char epc[TAG_EPC_HEX_SIZE];
+    interner->getTag(i).epcToHex(epc);
+    decoder.receiveMapping(i, epc);
+  }
+  for (uint32_t tag = 300; tag < 500; tag++) {
+    publishEvent(tag, now++, false);
+  }
+
+  // New tag whose mapping fails keeps its id, and the mapping is published when the event is retried
+  correct = correct && !publishEvent(1000, now++, true) && !publishEvent(1000, now++, true);
+  correct = correct && publishEvent(1000, now++, false) && mappingsPublished == 501;
+  correct = correct && publishEvent(1000, now++, false) && mappingsPublished == 501;
+
+  // Mappings lost on reconnect are published again on their next use
+  interner->invalidateMappings();
+  correct = correct && !publishEvent(1000, now++, true) && publishEvent(1000, now++, false) && mappingsPublished == 502;
+  delete interner;
+
+  // Id of a message waiting for PUBACK is not given to another tag, so the message still decodes to its tag
+  // when it is sent again after reconnect together with the republished mapping
+  interner = new TagInterner();
+  PublishWindow *window = new PublishWindow();
+  std::vector<std::string> written;
+  auto write = [&written](const uint8_t *data, size_t size) {
+    written.push_back(std::string((const char *) data + size - 1, 1));
+    return true;
+  };
+  auto isPinned = [window](uint16_t sessionId) {
+    return window->isReferenced(sessionId);
+  };
+  auto makeTag = [](uint32_t tag) {
+    TagId id = {};
+    id.epcLength = 12;
+    id.epc[10] = tag >> 8;
+    id.epc[11] = tag & 0xFF;
+    return id;
+  };
+  bool mappingPending;
+  for (uint32_t tag = 0; tag < TagInterner::capacity; tag++) {
+    interner->intern(makeTag(tag), tag, &mappingPending, isPinned);
+  }
+  TagId pinnedTag = makeTag(0);
+  window->publish("t", "0", 1, 300, write, 0);
+  correct = correct && interner->intern(makeTag(1000), 301, &mappingPending, isPinned) == 1 && mappingPending;
+
+  decoder.mappings.clear();
+  interner->invalidateMappings();
+  for (uint16_t i = 0; i < interner->getCount(); i++) {
+    if (window->isReferenced(i)) {
+      char epc[TAG_EPC_HEX_SIZE];
+      interner->getTag(i).epcToHex(epc);
+      decoder.receiveMapping(i, epc);
+      interner->setMappingPublished(i);
+    }
+  }
+  written.clear();
+  char pinnedEpc[TAG_EPC_HEX_SIZE];
+  pinnedTag.epcToHex(pinnedEpc);
+  correct = correct && window->retransmit(400, write) == 1 && written.size() == 1;
+  correct = correct && decoder.decode(std::stoi(written[0])) == pinnedEpc && decoder.mappings.size() == 1;
+
+  // Acknowledged id can be given away, and no id is given while every id is pinned
+  window->acknowledge(0x8000, 500);
+  correct = correct && interner->intern(makeTag(1001), 501, &mappingPending, isPinned) == 0;
+  auto allPinned = [](uint16_t) {
+    return true;
+  };
+  correct = correct && interner->intern(makeTag(1002), 502, &mappingPending, allPinned) == TagInterner::noSessionId && !mappingPending;
+  delete window;
+  delete interner;
+
+  correct = correct && events == 16203;
+  std::cout << (correct ? "Interned tag ids were decoded correctly\n" : "Interned tag ids were decoded incorrectly!!\n");
+}
+
+/**
+ * Appends little endian 32-bit integer to patch
+ */
+void appendUint32(std::vector<uint8_t> &patch, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    patch.push_back((value >> (i * 8)) & 0xFF);
+  }
+}
+
+/**
+ * Appends COPY operation to patch
+ */
+void appendCopy(std::vector<uint8_t> &patch, uint32_t offset, uint32_t length) {
+  patch.push_back(DELTA_PATCH_COPY);
+  appendUint32(patch, offset);
+  appendUint32(patch, length);
+}
+
+/**
+ * Appends ADD operation with given bytes to patch
+ */
+void appendAdd(std::vector<uint8_t> &patch, const std::vector<uint8_t> &data) {
+  patch.push_back(DELTA_PATCH_ADD);
+  appendUint32(patch, data.size());
+  patch.insert(patch.end(), data.begin(), data.end());
+}
+
+/**
+ * Applies patch to source image feeding it in chunks of given size
+ *
+ * @return applied target image or empty image if patch failed
+ */
+std::vector<uint8_t> applyPatch(const std::vector<uint8_t> &source, const std::vector<uint8_t> &patch, size_t chunkSize) {
+  DeltaPatchApplier applier;
+  std::vector<uint8_t> target;
+  auto readSource = [&source](uint32_t offset, uint8_t *buffer, size_t length) {
+    if (offset + length > source.size()) {
+      return false;
+    }
+    memcpy(buffer, source.data() + offset, length);
+    return true;
+  };
+  auto writeTarget = [&target](const uint8_t *buffer, size_t length) {
+    target.insert(target.end(), buffer, buffer + length);
+    return true;
+  };
+
+  for (size_t i = 0; i < patch.size(); i += chunkSize) {
+    size_t length = patch.size() - i < chunkSize ? patch.size() - i : chunkSize;
+    if (!applier.feed(patch.data() + i, length, readSource, writeTarget)) {
+      return std::vector<uint8_t>();
+    }
+  }
+  return applier.isFinished() ? target : std::vector<uint8_t>();
+}
+
+/**
+ * Check that delta patches rebuild the target image from sample source image with any chunk size,
+ * and that invalid and truncated patches are rejected
+ */
+void testDeltaPatch() {
+  std::vector<uint8_t> source;
+  uint32_t random = 1;
+  for (int i = 0; i < 4096; i++) {
+    random = random * 1103515245 + 12345;
+    source.push_back(random >> 16);
+  }
+
+  // Target has changed bytes in the middle, inserted bytes and a moved block
+  std::vector<uint8_t> inserted = { 0xDE, 0xAD, 0xBE, 0xEF, 0x01, 0x02 };
+  std::vector<uint8_t> target(source.begin(), source.begin() + 1000);
+  target.insert(target.end(), inserted.begin(), inserted.end());
+  target.insert(target.end(), source.begin() + 1000, source.begin() + 3000);
+  target.insert(target.end(), source.begin(), source.begin() + 512);
+  target.insert(target.end(), source.begin() + 3000, source.end());
+
+  std::vector<uint8_t> patch = { 'M', 'D', 'P', '1' };
+  appendUint32(patch, source.size());
+  appendUint32(patch, target.size());
+  appendCopy(patch, 0, 1000);
+  appendAdd(patch, inserted);
+  appendCopy(patch, 1000, 2000);
+  appendCopy(patch, 0, 512);
+  appendCopy(patch, 3000, 1096);
+  patch.push_back(DELTA_PATCH_END);
+
+  bool matches = true;
+  const size_t chunkSizes[] = { 1, 7, 256, patch.size() };
+  for (size_t chunkSize : chunkSizes) {
+    matches = matches && applyPatch(source, patch, chunkSize) == target;
+  }
+  std::cout << (matches ? "Applied delta patch was correct\n" : "Applied delta patch was incorrect!!\n");
+
+  std::vector<uint8_t> invalidPatch(patch.begin(), patch.begin() + 12);
+  appendCopy(invalidPatch, 4000, 1000);
+  invalidPatch.push_back(DELTA_PATCH_END);
+  std::vector<uint8_t> truncatedPatch(patch.begin(), patch.end() - 10);
+  bool rejected = applyPatch(source, invalidPatch, 16).empty() && applyPatch(source, truncatedPatch, 16).empty();
+  std::cout << (rejected ? "Invalid delta patches were rejected\n" : "Invalid delta patch was accepted!!\n");
+}
+
+/**
+ * Check that broker urls are parsed once into the table, that selection prefers healthy brokers and fails
+ * over from failing ones, and that cached DNS results expire and are dropped on failure
+ */
+void testBrokerTable() {
+  BrokerTable table;
+  uint8_t count = table.parse("mqtts://a.example.com:8884, mqtts://b.example.com,invalid,mqtt://c.example.com:1884,mqtts://d:1", 4);
+  bool parsed = count == 3 &&
+    strcmp(table.getServer(0).host, "a.example.com") == 0 && table.getServer(0).port == 8884 &&
+    strcmp(table.getServer(1).protocol, "mqtts") == 0 && table.getServer(1).port == 8883 &&
+    strcmp(table.getServer(2).host, "c.example.com") == 0 && table.getServer(2).port == 1884;
+  std::cout << (parsed ? "Parsed broker table was correct\n" : "Parsed broker table was incorrect!!\n");
+
+  unsigned long now = 1000;
+  bool selected = table.select(now) == 0;
+  table.recordSuccess(0, now, 300);
+  selected = selected && table.select(now) == 0;
+
+  // Failing broker is backed off and the next brokers are tried in turn
+  table.recordFailure(0, now);
+  selected = selected && table.select(now) == 1;
+  table.recordFailure(1, now + 100);
+  selected = selected && table.select(now + 100) == 2;
+  table.recordSuccess(2, now + 200, 800);
+  selected = selected && table.select(now + 200) == 2;
+
+  // When every broker is backed off, the one whose backoff ends first is taken
+  table.recordFailure(2, now + 300);
+  selected = selected && table.select(now + 300) == 0;
+
+  // Recovered broker with lowest latency is preferred again
+  table.recordSuccess(0, now + 400, 300);
+  selected = selected && table.select(now + 400) == 0;
+  std::cout << (selected ? "Broker selection was correct\n" : "Broker selection was incorrect!!\n");
+
+  uint32_t address = 0;
+  table.setCachedAddress(0, now, 0x0100007F);
+  bool cached = table.getCachedAddress(0, now + 1000, &address) && address == 0x0100007F;
+  cached = cached && !table.getCachedAddress(0, now + BrokerTable::dnsTtlMs, &address);
+  table.setCachedAddress(0, now, 0x0100007F);
+  table.recordFailure(0, now + 1000);
+  cached = cached && !table.getCachedAddress(0, now + 1000, &address);
+  std::cout << (cached ? "Broker address cache was correct\n" : "Broker address cache was incorrect!!\n");
+}
+
+/**
+ * Check that publish window encodes QoS 1 packets, matches PUBACKs found from received byte stream,
+ * limits messages in flight and sends unacknowledged messages again with DUP flag
+ */
+void testPublishWindow() {
+  uint8_t packet[64];
+  uint16_t length = PublishWindow::encodePublish("a/b", "hi", 2, 0x8001, packet, sizeof(packet));
+  const uint8_t expected[] = { 0x32, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x80, 0x01, 'h', 'i' };
+  bool encoded = length == sizeof(expected) && memcmp(packet, expected, length) == 0;
+  encoded = encoded && PublishWindow::encodePublish("a/b", "hi", 2, 1, packet, 10) == 0;
+  std::cout << (encoded ? "Encoded publish packet was correct\n" : "Encoded publish packet was incorrect!!\n");
+
+  PublishWindow window;
+  window.setWindowSize(3);
+  std::vector<std::vector<uint8_t>> written;
+  auto write = [&written](const uint8_t *data, size_t size) {
+    written.push_back(std::vector<uint8_t>(data, data + size));
+    return true;
+  };
+  bool limited = window.publish("t", "1", 1, 0, write) && window.publish("t", "2", 1, 0, write) && window.publish("t", "3", 1, 0, write);
+  limited = limited && !window.publish("t", "4", 1, 0, write) && window.getInFlight() == 3 && window.getFree() == 0;
+  std::cout << (limited ? "Publish window was limited correctly\n" : "Publish window was not limited correctly!!\n");
+
+  // PUBACK of the second message is split between reads and follows a PUBLISH whose payload looks like PUBACK
+  const uint8_t received[] = { 0x30, 0x07, 0x00, 0x01, 't', 0x40, 0x02, 0x80, 0x01, 0x40, 0x02, 0x80, 0x01 };
+  PubackScanner scanner;
+  std::vector<uint16_t> acknowledged;
+  auto onPuback = [&window, &acknowledged](uint16_t packetId) {
+    acknowledged.push_back(packetId);
+    window.acknowledge(packetId, 40);
+  };
+  scanner.feed(received, 11, onPuback);
+  scanner.feed(received + 11, sizeof(received) - 11, onPuback);
+  bool matched = acknowledged.size() == 1 && acknowledged[0] == 0x8001 && window.getInFlight() == 2;
+  matched = matched && window.getAcknowledgedCount() == 1 && window.getLatencyMs() == 40;
+  std::cout << (matched ? "PUBACK was matched correctly\n" : "PUBACK was not matched correctly!!\n");
+
+  written.clear();
+  bool retransmitted = window.retransmit(100, write) == 2 && written.size() == 2;
+  retransmitted = retransmitted && written[0][0] == (MQTT_PUBLISH_PACKET | MQTT_DUP_FLAG | MQTT_QOS1_FLAG) && written[0].back() == '1';
+  retransmitted = retransmitted && written[1].back() == '3' && window.getOldestAge(150) == 50;
+  std::cout << (retransmitted ? "Messages in flight were sent again correctly\n" : "Messages in flight were not sent again correctly!!\n");
+}
+
+/**
+ * Check that OTA checks back off after failures, that the same announcement delivered again keeps the backoff,
+ * and that conditional version queries and resumed downloads are interpreted correctly
+ */
+void testOtaSchedule() {
+  OtaSchedule schedule;
+  bool polled = schedule.getNextDelay(0) == OTA_CHECK_INTERVAL_MS && schedule.getNextDelay(OTA_CHECK_JITTER_MS) == OTA_CHECK_INTERVAL_MS + OTA_CHECK_JITTER_MS;
+  polled = polled && schedule.getNextDelay(OTA_CHECK_JITTER_MS + 1) == OTA_CHECK_INTERVAL_MS;
+  polled = polled && OtaSchedule::getFirstDelay(OTA_CHECK_INTERVAL_MS + 5) == 5 && OtaSchedule::getAnnouncementDelay(OTA_ANNOUNCEMENT_JITTER_MS + 1) == 0;
+  std::cout << (polled ? "OTA check delay was correct\n" : "OTA check delay was incorrect!!\n");
+
+  schedule.announce("1.2.3", "abc");
+  schedule.recordResult(false);
+  bool backedOff = schedule.isAnnounced() && strcmp(schedule.getVersion(), "1.2.3") == 0 && strcmp(schedule.getHash(), "abc") == 0;
+  backedOff = backedOff && schedule.getNextDelay(0) == OTA_ANNOUNCEMENT_RETRY_INTERVAL_MS * 2;
+  backedOff = backedOff && !schedule.announce("1.2.3", "abc") && schedule.getFailureCount() == 1;
+  for (uint8_t i = 0; i < 40; i++) {
+    schedule.recordResult(false);
+  }
+  backedOff = backedOff && schedule.getFailureCount() == OTA_MAX_FAILURE_COUNT && schedule.getNextDelay(0) == OTA_MAX_BACKOFF_MS;
+  backedOff = backedOff && schedule.announce("1.2.4", "abc") && schedule.getFailureCount() == 0;
+  schedule.recordResult(false);
+  backedOff = backedOff && schedule.announce("1.2.4", "def") && schedule.getFailureCount() == 0;
+  schedule.recordResult(true);
+  backedOff = backedOff && !schedule.isAnnounced() && schedule.getFailureCount() == 0 && schedule.getNextDelay(0) == OTA_CHECK_INTERVAL_MS;
+  schedule.recordResult(false);
+  backedOff = backedOff && schedule.getNextDelay(0) == OTA_CHECK_INTERVAL_MS;
+  std::cout << (backedOff ? "OTA retry backoff was correct\n" : "OTA retry backoff was incorrect!!\n");
+
+  bool conditional = shouldSendVersionValidator("1.2.3", "\"etag\"") && !shouldSendVersionValidator("", "\"etag\"") && !shouldSendVersionValidator("1.2.3", "");
+  conditional = conditional && getVersionQueryResult(304, true) == OTA_VERSION_CACHED && getVersionQueryResult(304, false) == OTA_VERSION_FAILED;
+  conditional = conditional && getVersionQueryResult(200, true) == OTA_VERSION_LOADED && getVersionQueryResult(404, true) == OTA_VERSION_FAILED;
+  std::cout << (conditional ? "OTA version query was handled correctly\n" : "OTA version query was not handled correctly!!\n");
+
+  bool resumed = isResumableFirmwareResponse(200, "", 0, 0) && !isResumableFirmwareResponse(206, "bytes 0-99/100", 0, 0);
+  resumed = resumed && isResumableFirmwareResponse(206, "bytes 40-99/100", 40, 100) && !isResumableFirmwareResponse(200, "", 40, 100);
+  resumed = resumed && !isResumableFirmwareResponse(206, "bytes 0-99/100", 40, 100) && !isResumableFirmwareResponse(206, "bytes 40-99/120", 40, 100);
+  resumed = resumed && !isResumableFirmwareResponse(206, "bytes */100", 40, 100);
+  resumed = resumed && getResumeDelay(1) == OTA_RESUME_DELAY_MS && getResumeDelay(3) == OTA_RESUME_DELAY_MS * 4;
+  std::cout << (resumed ? "OTA download was resumed correctly\n" : "OTA download was not resumed correctly!!\n");
 }
 
 /**
@@ -58,6 +1140,14 @@ void parseMessageWithType(uint32_t type, uint32_t message[], MessageParser parse
     std::cout << "Message type was stop continue inventory response\n";
     parser.parseStopContinueInventoryResponse(message);
     break;
+  case GET_TIME_FRAME_INVENTORY_RESULT:
+    if (parser.isTimeFrameInventoryResultTag(message)) {
+      std::cout << "Message type was time frame inventory result\n";
+      handleResponse(parser.parseTimeFrameInventoryResult(message));
+    } else {
+      std::cout << "Message type was end of time frame inventory results\n";
+    }
+    break;
   default:
     break;
   }
@@ -94,5 +1184,25 @@ void parseMessage(uint32_t message[], uint32_t messageLength) {
 int main() {
   parseMessage(continueInventoryMessage, continueInventoryMessageLength);
   parseMessage(antennaStoppedMessage, antennaStoppedMessageLength);
+  parseMessage(timeFrameResultEndMessage, timeFrameResultEndMessageLength);
+  testConstructCommand();
+  testTagReportLengths();
+  testReaderFrameDecoders();
+  testEpcFilterTagId();
+  testEpcFilterEncoding();
+  testReadStatistics();
+  testTagInterner();
+  testPresenceSnapshot();
+  testWarmRestart();
+  testEventStream();
+  testEventListener();
+  testFlushBackpressure();
+  testZoneOverflow();
+  testLogBuffer();
+  testAdaptiveTimeout();
+  testDeltaPatch();
+  testBrokerTable();
+  testPublishWindow();
+  testOtaSchedule();
   return 0;
 }
\ No newline at end of file
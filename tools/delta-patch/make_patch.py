@@ -0,0 +1,129 @@
+import argparse
+import os
+import struct
+import sys
+
+#
+# Generates delta patches between firmware images for delta OTA updates.
+#
+# Patch format (integers little endian):
+#   "MDP1", source length (u32), target length (u32)
+#   0x01 COPY: source offset (u32), length (u32)   copy bytes from the running image
+#   0x02 ADD: length (u32), bytes                  bytes taken from the patch
+#   0x00 END
+#
+# Matches are found by indexing source blocks at every 4-byte aligned offset and
+# extending matching blocks in both directions. The patch is applied back to the
+# source image and compared with the target before it is written.
+#
+# Usage:
+#   python3 make_patch.py --source old/firmware.bin --target new/firmware.bin --output patch
+#
+
+MAGIC = b"MDP1"
+OPERATION_END = 0x00
+OPERATION_COPY = 0x01
+OPERATION_ADD = 0x02
+
+BLOCK_SIZE = 32
+BLOCK_ALIGNMENT = 4
+
+
+def create_patch(source: bytes, target: bytes) -> bytes:
+    index = {}
+    for offset in range(0, len(source) - BLOCK_SIZE + 1, BLOCK_ALIGNMENT):
+        index.setdefault(source[offset:offset + BLOCK_SIZE], offset)
+
+    patch = bytearray(MAGIC + struct.pack("<II", len(source), len(target)))
+
+    def add(start: int, end: int):
+        if end > start:
+            patch.extend(struct.pack("<BI", OPERATION_ADD, end - start))
+            patch.extend(target[start:end])
+
+    literal_start = 0
+    position = 0
+    while position <= len(target) - BLOCK_SIZE:
+        source_offset = index.get(target[position:position + BLOCK_SIZE])
+        if source_offset is None:
+            position += 1
+            continue
+
+        length = BLOCK_SIZE
+        while position + length < len(target) and source_offset + length < len(source) and target[position + length] == source[source_offset + length]:
+            length += 1
+
+        backwards = 0
+        while position - backwards > literal_start and source_offset - backwards > 0 and target[position - backwards - 1] == source[source_offset - backwards - 1]:
+            backwards += 1
+
+        add(literal_start, position - backwards)
+        patch.extend(struct.pack("<BII", OPERATION_COPY, source_offset - backwards, length + backwards))
+        position += length
+        literal_start = position
+
+    add(literal_start, len(target))
+    patch.append(OPERATION_END)
+    return bytes(patch)
+
+
+def apply_patch(source: bytes, patch: bytes) -> bytes:
+    if patch[:4] != MAGIC:
+        raise ValueError("Invalid patch header")
+    source_length, target_length = struct.unpack_from("<II", patch, 4)
+    if source_length != len(source):
+        raise ValueError("Patch is for a different source image")
+
+    target = bytearray()
+    position = 12
+    while True:
+        operation = patch[position]
+        position += 1
+        if operation == OPERATION_END:
+            break
+        if operation == OPERATION_COPY:
+            offset, length = struct.unpack_from("<II", patch, position)
+            position += 8
+            target.extend(source[offset:offset + length])
+        elif operation == OPERATION_ADD:
+            (length,) = struct.unpack_from("<I", patch, position)
+            position += 4
+            target.extend(patch[position:position + length])
+            position += length
+        else:
+            raise ValueError("Unknown patch operation")
+
+    if len(target) != target_length:
+        raise ValueError("Patch produced image of wrong length")
+    return bytes(target)
+
+
+def is_file(value):
+    if not os.path.isfile(value):
+        raise argparse.ArgumentTypeError(f"{value} is not a valid file path")
+    return value
+
+
+if __name__ == "__main__":
+    argument_parser = argparse.ArgumentParser(description="Generate delta patch between firmware images.")
+
+    argument_parser.add_argument("--source", type=is_file, required=True, help="Path to the currently installed firmware image.")
+    argument_parser.add_argument("--target", type=is_file, required=True, help="Path to the new firmware image.")
+    argument_parser.add_argument("--output", type=str, required=True, help="Path to the patch file.")
+
+    args = argument_parser.parse_args()
+
+    with open(args.source, "rb") as file:
+        source = file.read()
+    with open(args.target, "rb") as file:
+        target = file.read()
+
+    patch = create_patch(source, target)
+    if apply_patch(source, patch) != target:
+        sys.stderr.write("Generated patch does not reproduce the target image\n")
+        sys.exit(1)
+
+    with open(args.output, "wb") as file:
+        file.write(patch)
+
+    print("Patch {0}: {1} bytes ({2:.1f}% of target image)".format(args.output, len(patch), len(patch) * 100 / len(target)))
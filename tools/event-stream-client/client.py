@@ -0,0 +1,300 @@
+import argparse
+import base64
+import json
+import os
+import socket
+import ssl
+import statistics
+import struct
+import threading
+import time
+from urllib.parse import urlparse
+
+#
+# Local event stream test client.
+#
+# Subscribes to tag events of a device both from its local event stream and from the MQTT
+# broker, matches the events of the two paths and prints how much later each event arrived
+# over MQTT than over the local stream. Device must have localStreamPort set in its
+# configuration, and tags must not be interned (internTags false) for MQTT events to match.
+#
+# Usage:
+#   python3 client.py --device 192.168.1.50 --port 8080 --websocket --format binary \
+#     --mqtt-url mqtts://broker.example.com:8883 --mqtt-user user --mqtt-password secret \
+#     --topic prefix/topic/AA:BB:CC:DD:EE:FF --duration 60
+#
+# Leave --mqtt-url out to only print events of the local stream.
+#
+
+PACKET_CONNECT = 1
+PACKET_PUBLISH = 3
+PACKET_SUBSCRIBE = 8
+PACKET_PINGREQ = 12
+
+# Events of the two paths further apart than this are not matched
+MATCH_WINDOW_SECONDS = 10
+
+
+def read_exactly(connection, length: int) -> bytes:
+    data = b""
+    while len(data) < length:
+        chunk = connection.recv(length - len(data))
+        if not chunk:
+            raise ConnectionError("Connection closed")
+        data += chunk
+    return data
+
+
+def read_line(connection) -> bytes:
+    line = b""
+    while not line.endswith(b"\n"):
+        line += read_exactly(connection, 1)
+    return line
+
+
+def open_local_stream(host: str, port: int, websocket: bool, binary: bool):
+    connection = socket.create_connection((host, port), timeout=10)
+    connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    if not websocket:
+        connection.sendall(b"binary\n" if binary else b"json\n")
+        return connection
+
+    key = base64.b64encode(os.urandom(16)).decode()
+    path = "/events/binary" if binary else "/events"
+    request = "GET {0} HTTP/1.1\r\nHost: {1}\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: {2}\r\nSec-WebSocket-Version: 13\r\n\r\n"
+    connection.sendall(request.format(path, host, key).encode())
+    status = read_line(connection)
+    if b" 101 " not in status:
+        raise ConnectionError("WebSocket upgrade failed: {0}".format(status.decode(errors="replace").strip()))
+    while read_line(connection) not in (b"\r\n", b"\n"):
+        pass
+    return connection
+
+
+def read_websocket_message(connection) -> bytes:
+    header = read_exactly(connection, 2)
+    length = header[1] & 0x7F
+    if length == 126:
+        (length,) = struct.unpack(">H", read_exactly(connection, 2))
+    elif length == 127:
+        (length,) = struct.unpack(">Q", read_exactly(connection, 8))
+    if header[0] & 0x0F == 0x08:
+        raise ConnectionError("WebSocket closed")
+    return read_exactly(connection, length)
+
+
+def decode_binary_event(data: bytes, offset: int = 0):
+    epc_length = data[offset]
+    epc = data[offset + 1:offset + 1 + epc_length].hex()
+    offset += 1 + epc_length
+    tid_length = data[offset]
+    tid = data[offset + 1:offset + 1 + tid_length].hex()
+    offset += 1 + tid_length
+    (antenna,) = struct.unpack_from(">H", data, offset)
+    strength = data[offset + 2]
+    event = {"antenna": antenna, "tag": epc, "strength": strength}
+    if tid_length > 0:
+        event["tid"] = tid
+    return event, offset + 3
+
+
+def read_binary_event(connection):
+    epc_length = read_exactly(connection, 1)
+    epc = read_exactly(connection, epc_length[0])
+    tid_length = read_exactly(connection, 1)
+    rest = read_exactly(connection, tid_length[0] + 3)
+    return decode_binary_event(epc_length + epc + tid_length + rest)[0]
+
+
+def read_local_events(connection, websocket: bool, binary: bool):
+    while True:
+        if websocket:
+            message = read_websocket_message(connection)
+            yield decode_binary_event(message)[0] if binary else json.loads(message)
+        elif binary:
+            yield read_binary_event(connection)
+        else:
+            yield json.loads(read_line(connection))
+
+
+def encode_length(length: int) -> bytes:
+    encoded = b""
+    while True:
+        byte = length % 128
+        length //= 128
+        encoded += bytes([byte | (0x80 if length > 0 else 0)])
+        if length == 0:
+            return encoded
+
+
+def encode_string(value: str) -> bytes:
+    data = value.encode()
+    return struct.pack(">H", len(data)) + data
+
+
+def encode_connect(client_id: str, user: str, password: str) -> bytes:
+    flags = 0x02
+    payload = encode_string(client_id)
+    if user:
+        flags |= 0x80
+        payload += encode_string(user)
+    if password:
+        flags |= 0x40
+        payload += encode_string(password)
+    body = encode_string("MQTT") + bytes([0x04, flags, 0x00, 0x3C]) + payload
+    return bytes([PACKET_CONNECT << 4]) + encode_length(len(body)) + body
+
+
+def encode_subscribe(topic: str) -> bytes:
+    body = struct.pack(">H", 1) + encode_string(topic) + b"\x00"
+    return bytes([PACKET_SUBSCRIBE << 4 | 0x02]) + encode_length(len(body)) + body
+
+
+def read_mqtt_packet(connection):
+    header = read_exactly(connection, 1)[0]
+    length = 0
+    multiplier = 1
+    while True:
+        byte = read_exactly(connection, 1)[0]
+        length += (byte & 0x7F) * multiplier
+        multiplier *= 128
+        if byte & 0x80 == 0:
+            break
+    return header >> 4, header & 0x0F, read_exactly(connection, length)
+
+
+def decode_mqtt_event(topic: str, payload: bytes):
+    suffix = topic.rsplit("/", 1)[-1]
+    if not suffix.isdigit():
+        return None
+    event = json.loads(payload)
+    if "tag" not in event:
+        return None
+    event["antenna"] = int(suffix)
+    return event
+
+
+def open_mqtt(url: str, user: str, password: str, topic: str):
+    parsed = urlparse(url)
+    secure = parsed.scheme == "mqtts"
+    connection = socket.create_connection((parsed.hostname, parsed.port or (8883 if secure else 1883)), timeout=10)
+    if secure:
+        context = ssl.create_default_context()
+        context.check_hostname = False
+        context.verify_mode = ssl.CERT_NONE
+        connection = context.wrap_socket(connection, server_hostname=parsed.hostname)
+    connection.sendall(encode_connect("event-stream-client-{0}".format(os.getpid()), user, password))
+    read_mqtt_packet(connection)
+    connection.sendall(encode_subscribe(topic + "/+"))
+    return connection
+
+
+def read_mqtt_events(connection):
+    last_ping = time.monotonic()
+    while True:
+        if time.monotonic() - last_ping > 30:
+            connection.sendall(bytes([PACKET_PINGREQ << 4, 0]))
+            last_ping = time.monotonic()
+        packet_type, flags, body = read_mqtt_packet(connection)
+        if packet_type != PACKET_PUBLISH:
+            continue
+        (topic_length,) = struct.unpack_from(">H", body, 0)
+        topic = body[2:2 + topic_length].decode()
+        payload = body[2 + topic_length + (2 if (flags >> 1) & 0x03 else 0):]
+        event = decode_mqtt_event(topic, payload)
+        if event is not None:
+            yield event
+
+
+def get_event_key(event):
+    return event["tag"], event.get("tid", ""), event["antenna"], event["strength"] == 0
+
+
+def match_events(local, remote):
+    """Matches events of the two paths in arrival order and returns delays of remote events in milliseconds"""
+    pending = {}
+    for arrived, event in local:
+        pending.setdefault(get_event_key(event), []).append(arrived)
+
+    delays = []
+    unmatched = 0
+    for arrived, event in remote:
+        arrivals = pending.get(get_event_key(event), [])
+        while arrivals and arrived - arrivals[0] > MATCH_WINDOW_SECONDS:
+            arrivals.pop(0)
+        if arrivals and arrivals[0] <= arrived + MATCH_WINDOW_SECONDS:
+            delays.append((arrived - arrivals.pop(0)) * 1000)
+        else:
+            unmatched += 1
+    return delays, unmatched
+
+
+def collect(events, received, lock, stop, verbose: bool, label: str):
+    try:
+        for event in events:
+            with lock:
+                received.append((time.monotonic(), event))
+            if verbose:
+                print("{0}: {1}".format(label, json.dumps(event)))
+            if stop.is_set():
+                return
+    except (ConnectionError, OSError, ValueError) as error:
+        if not stop.is_set():
+            print("{0} stream ended: {1}".format(label, error))
+
+
+def print_delays(delays, unmatched: int, local_count: int):
+    print("{0} local events, {1} matched over MQTT, {2} MQTT events without local event".format(local_count, len(delays), unmatched))
+    if len(delays) == 0:
+        return
+    delays = sorted(delays)
+    print("MQTT arrived later than local stream by {0:.1f} ms median, {1:.1f} ms 95th percentile, {2:.1f} ms max".format(
+        statistics.median(delays),
+        delays[min(len(delays) - 1, int(len(delays) * 0.95))],
+        delays[-1]
+    ))
+
+
+if __name__ == "__main__":
+    argument_parser = argparse.ArgumentParser(description="Local event stream test client.")
+
+    argument_parser.add_argument("--device", required=True, help="Device address.")
+    argument_parser.add_argument("--port", type=int, default=8080, help="Local event stream port.")
+    argument_parser.add_argument("--websocket", action="store_true", help="Connect with WebSocket instead of plain TCP.")
+    argument_parser.add_argument("--format", choices=["json", "binary"], default="json", help="Event format.")
+    argument_parser.add_argument("--mqtt-url", help="Broker URL, mqtt:// or mqtts://.")
+    argument_parser.add_argument("--mqtt-user", default="", help="Broker user.")
+    argument_parser.add_argument("--mqtt-password", default="", help="Broker password.")
+    argument_parser.add_argument("--topic", help="Device topic, for example prefix/topic/<device id>.")
+    argument_parser.add_argument("--duration", type=float, default=60, help="Seconds to collect events.")
+    argument_parser.add_argument("--verbose", action="store_true", help="Print every event.")
+
+    args = argument_parser.parse_args()
+    if args.mqtt_url and not args.topic:
+        argument_parser.error("--topic is required with --mqtt-url")
+
+    binary = args.format == "binary"
+    lock = threading.Lock()
+    stop = threading.Event()
+    local_events = []
+    remote_events = []
+
+    local_connection = open_local_stream(args.device, args.port, args.websocket, binary)
+    local_connection.settimeout(None)
+    threads = [threading.Thread(target=collect, args=(read_local_events(local_connection, args.websocket, binary), local_events, lock, stop, args.verbose, "local"), daemon=True)]
+    if args.mqtt_url:
+        mqtt_connection = open_mqtt(args.mqtt_url, args.mqtt_user, args.mqtt_password, args.topic)
+        mqtt_connection.settimeout(None)
+        threads.append(threading.Thread(target=collect, args=(read_mqtt_events(mqtt_connection), remote_events, lock, stop, args.verbose, "mqtt"), daemon=True))
+
+    for thread in threads:
+        thread.start()
+    try:
+        time.sleep(args.duration)
+    except KeyboardInterrupt:
+        pass
+    stop.set()
+
+    with lock:
+        delays, unmatched = match_events(list(local_events), list(remote_events))
+        print_delays(delays, unmatched, len(local_events))
@@ -0,0 +1,78 @@
+import json
+import socket
+import threading
+import unittest
+
+from client import decode_binary_event, decode_mqtt_event, match_events, open_local_stream, read_local_events
+
+#
+# Tests for the local event stream test client. Events must decode the same from every
+# protocol and format, and events of the local and MQTT paths must be matched in order.
+#
+# Run with:
+#   cd tools/event-stream-client && python3 -m unittest test_client
+#
+
+EPC = bytes.fromhex("e2003411b802011383258566")
+BINARY_EVENT = bytes([len(EPC)]) + EPC + bytes([0, 0, 101, 55])
+JSON_EVENT = b'{"antenna":101,"tag":"e2003411b802011383258566","strength":55.25}'
+
+
+def serve_once(response: bytes):
+    """Starts server that sends response to the first client after its request and returns the port"""
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server_socket.bind(("127.0.0.1", 0))
+    server_socket.listen()
+
+    def serve():
+        connection, _ = server_socket.accept()
+        connection.recv(1024)
+        connection.sendall(response)
+        connection.close()
+        server_socket.close()
+
+    threading.Thread(target=serve, daemon=True).start()
+    return server_socket.getsockname()[1]
+
+
+class ClientTest(unittest.TestCase):
+
+    def test_binary_event(self):
+        event, offset = decode_binary_event(BINARY_EVENT)
+        self.assertEqual(event, {"antenna": 101, "tag": EPC.hex(), "strength": 55})
+        self.assertEqual(offset, len(BINARY_EVENT))
+
+    def test_websocket_binary_stream(self):
+        handshake = b"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n\r\n"
+        frame = bytes([0x82, len(BINARY_EVENT)]) + BINARY_EVENT
+        port = serve_once(handshake + frame + frame)
+        connection = open_local_stream("127.0.0.1", port, True, True)
+        events = read_local_events(connection, True, True)
+        self.assertEqual(next(events)["antenna"], 101)
+        self.assertEqual(next(events)["tag"], EPC.hex())
+        connection.close()
+
+    def test_plain_json_stream(self):
+        port = serve_once(JSON_EVENT + b"\n")
+        connection = open_local_stream("127.0.0.1", port, False, False)
+        self.assertEqual(next(read_local_events(connection, False, False)), json.loads(JSON_EVENT))
+        connection.close()
+
+    def test_mqtt_event(self):
+        payload = b'{"tag":"e2003411b802011383258566","strength":55.25}'
+        self.assertEqual(decode_mqtt_event("prefix/topic/device/101", payload), json.loads(JSON_EVENT))
+        self.assertIsNone(decode_mqtt_event("prefix/topic/device/status", b"{}"))
+        self.assertIsNone(decode_mqtt_event("prefix/topic/device/1", b'{"id":3,"strength":55.25}'))
+
+    def test_match_events(self):
+        seen = {"antenna": 1, "tag": "aa", "strength": 40}
+        gone = {"antenna": 1, "tag": "aa", "strength": 0}
+        local = [(1.0, seen), (2.0, gone), (3.0, seen)]
+        remote = [(1.05, seen), (2.08, gone), (3.02, seen), (4.0, {"antenna": 2, "tag": "aa", "strength": 40})]
+        delays, unmatched = match_events(local, remote)
+        self.assertEqual([round(delay) for delay in delays], [50, 80, 20])
+        self.assertEqual(unmatched, 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
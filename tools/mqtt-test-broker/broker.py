@@ -0,0 +1,248 @@
+import argparse
+import json
+import os
+import queue
+import socket
+import ssl
+import struct
+import threading
+import time
+
+#
+# Local TLS MQTT broker stand-in.
+#
+# Accepts MQTT 3.1.1 connections over TLS 1.2 (the highest version the device supports),
+# acknowledges CONNECT, SUBSCRIBE, QoS 1 PUBLISH and PINGREQ, and records for every
+# connection whether the TLS session was resumed and how long the handshake took.
+# Messages are not routed between clients.
+#
+# Usage:
+#   openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj "/CN=localhost" -keyout key.pem -out cert.pem
+#   python3 broker.py --cert cert.pem --key key.pem --port 8883
+#   PIO_MQTT_URLS=mqtts://<host>:8883 PIO_MQTT_URL_COUNT=1 pio run -e debug -t upload
+#
+# Use --drop-after to close every connection after given number of seconds and verify
+# that reconnects resume the TLS session, and --ack-delay to delay PUBACKs like a distant
+# broker would. --plain accepts MQTT without TLS for host side tests, for example:
+#   python3 broker.py --plain --port 1883 --ack-delay 20
+#   g++ -O2 test/pipeline.cpp -o pipeline && ./pipeline 1883
+# Statistics are printed on exit.
+#
+
+PACKET_CONNECT = 1
+PACKET_CONNACK = 2
+PACKET_PUBLISH = 3
+PACKET_PUBACK = 4
+PACKET_SUBSCRIBE = 8
+PACKET_SUBACK = 9
+PACKET_PINGREQ = 12
+PACKET_PINGRESP = 13
+PACKET_DISCONNECT = 14
+
+stats_lock = threading.Lock()
+stats = {"connections": 0, "resumed": 0, "full": 0, "handshakeMs": [], "publishes": 0, "duplicates": 0}
+
+
+def record_handshake(resumed: bool, duration_ms: float):
+    with stats_lock:
+        stats["connections"] += 1
+        stats["resumed" if resumed else "full"] += 1
+        stats["handshakeMs"].append(round(duration_ms, 1))
+
+
+def record_publish(duplicate: bool):
+    with stats_lock:
+        stats["publishes"] += 1
+        if duplicate:
+            stats["duplicates"] += 1
+
+
+def get_summary():
+    with stats_lock:
+        return json.loads(json.dumps(stats))
+
+
+def read_exactly(connection, length: int) -> bytes:
+    data = b""
+    while len(data) < length:
+        chunk = connection.recv(length - len(data))
+        if not chunk:
+            raise ConnectionError("Connection closed")
+        data += chunk
+    return data
+
+
+def read_packet(connection):
+    header = read_exactly(connection, 1)[0]
+    length = 0
+    multiplier = 1
+    while True:
+        byte = read_exactly(connection, 1)[0]
+        length += (byte & 0x7F) * multiplier
+        multiplier *= 128
+        if byte & 0x80 == 0:
+            break
+    return header >> 4, header & 0x0F, read_exactly(connection, length)
+
+
+class AckSender(threading.Thread):
+    """Sends PUBACKs in order after a fixed delay without blocking reading of the connection"""
+
+    def __init__(self, connection, send_lock, delay: float):
+        super().__init__(daemon=True)
+        self.connection = connection
+        self.send_lock = send_lock
+        self.delay = delay
+        self.acks = queue.Queue()
+
+    def send(self, data: bytes):
+        self.acks.put((time.monotonic() + self.delay, data))
+
+    def run(self):
+        while True:
+            deadline, data = self.acks.get()
+            if data is None:
+                return
+            time.sleep(max(0, deadline - time.monotonic()))
+            try:
+                with self.send_lock:
+                    self.connection.sendall(data)
+            except OSError:
+                return
+
+    def stop(self):
+        self.acks.put((0, None))
+
+
+def handle_packet(send, packet_type: int, flags: int, body: bytes, send_ack) -> bool:
+    if packet_type == PACKET_CONNECT:
+        send(bytes([PACKET_CONNACK << 4, 2, 0, 0]))
+    elif packet_type == PACKET_PUBLISH:
+        record_publish(flags & 0x08 != 0)
+        qos = (flags >> 1) & 0x03
+        if qos > 0:
+            (topic_length,) = struct.unpack_from(">H", body, 0)
+            packet_id = body[2 + topic_length:4 + topic_length]
+            send_ack(bytes([PACKET_PUBACK << 4, 2]) + packet_id)
+    elif packet_type == PACKET_SUBSCRIBE:
+        packet_id = body[0:2]
+        position = 2
+        granted = b""
+        while position < len(body):
+            (topic_length,) = struct.unpack_from(">H", body, position)
+            position += 2 + topic_length + 1
+            granted += b"\x00"
+        send(bytes([PACKET_SUBACK << 4 | 0, 2 + len(granted)]) + packet_id + granted)
+    elif packet_type == PACKET_PINGREQ:
+        send(bytes([PACKET_PINGRESP << 4, 0]))
+    elif packet_type == PACKET_DISCONNECT:
+        return False
+    return True
+
+
+def handle_connection(raw_connection, address, context, drop_after: float, ack_delay: float = 0):
+    started = time.monotonic()
+    if context is None:
+        connection = raw_connection
+    else:
+        try:
+            connection = context.wrap_socket(raw_connection, server_side=True)
+        except (ssl.SSLError, OSError) as error:
+            print("{0} - TLS handshake failed: {1}".format(address[0], error))
+            raw_connection.close()
+            return
+
+        duration_ms = (time.monotonic() - started) * 1000
+        resumed = connection.session_reused
+        record_handshake(resumed, duration_ms)
+        print("{0} - TLS handshake {1:.1f} ms, session {2}".format(address[0], duration_ms, "resumed" if resumed else "new"))
+
+    send_lock = threading.Lock()
+    ack_sender = None
+    if ack_delay > 0:
+        ack_sender = AckSender(connection, send_lock, ack_delay)
+        ack_sender.start()
+
+    def send(data: bytes):
+        with send_lock:
+            connection.sendall(data)
+
+    def send_ack(data: bytes):
+        if ack_sender is not None:
+            ack_sender.send(data)
+        else:
+            send(data)
+
+    if drop_after > 0:
+        connection.settimeout(max(0.1, drop_after - (time.monotonic() - started)))
+    try:
+        while True:
+            packet_type, flags, body = read_packet(connection)
+            if not handle_packet(send, packet_type, flags, body, send_ack):
+                break
+            if drop_after > 0:
+                remaining = drop_after - (time.monotonic() - started)
+                if remaining <= 0:
+                    break
+                connection.settimeout(remaining)
+    except (ConnectionError, socket.timeout, ssl.SSLError, OSError):
+        pass
+    finally:
+        if ack_sender is not None:
+            ack_sender.stop()
+        connection.close()
+
+
+def create_context(cert: str, key: str) -> ssl.SSLContext:
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(cert, key)
+    return context
+
+
+def serve(server_socket, context, drop_after: float = 0, ack_delay: float = 0):
+    while True:
+        try:
+            raw_connection, address = server_socket.accept()
+        except OSError:
+            return
+        threading.Thread(target=handle_connection, args=(raw_connection, address, context, drop_after, ack_delay), daemon=True).start()
+
+
+def create_server_socket(port: int):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server_socket.bind(("", port))
+    server_socket.listen()
+    return server_socket
+
+
+def is_file(value):
+    if not os.path.isfile(value):
+        raise argparse.ArgumentTypeError(f"{value} is not a valid file path")
+    return value
+
+
+if __name__ == "__main__":
+    argument_parser = argparse.ArgumentParser(description="Local TLS MQTT broker stand-in.")
+
+    argument_parser.add_argument("--cert", type=is_file, help="Path to the server certificate.")
+    argument_parser.add_argument("--key", type=is_file, help="Path to the server private key.")
+    argument_parser.add_argument("--plain", action="store_true", help="Accept MQTT without TLS.")
+    argument_parser.add_argument("--port", type=int, default=8883, help="Port to listen on.")
+    argument_parser.add_argument("--drop-after", type=float, default=0, help="Close connections after this many seconds.")
+    argument_parser.add_argument("--ack-delay", type=float, default=0, help="Delay of PUBACKs in milliseconds.")
+
+    args = argument_parser.parse_args()
+    if not args.plain and (args.cert is None or args.key is None):
+        argument_parser.error("--cert and --key are required unless --plain is given")
+
+    server_socket = create_server_socket(args.port)
+    print("Listening on port {0}".format(args.port))
+    try:
+        context = None if args.plain else create_context(args.cert, args.key)
+        serve(server_socket, context, args.drop_after, args.ack_delay / 1000)
+    except KeyboardInterrupt:
+        pass
+
+    print(json.dumps(get_summary(), indent=2))
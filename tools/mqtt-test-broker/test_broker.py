@@ -0,0 +1,125 @@
+import os
+import shutil
+import socket
+import ssl
+import subprocess
+import tempfile
+import threading
+import time
+import unittest
+
+from broker import create_context, create_server_socket, get_summary, read_exactly, serve, stats
+
+#
+# Tests for the broker stand-in. A TLS 1.2 client that keeps its session between
+# connections, like the device does, must be reported as resumed on reconnect, and
+# pipelined QoS 1 publishes must be acknowledged in order.
+#
+# Run with:
+#   cd tools/mqtt-test-broker && python3 -m unittest test_broker
+#
+
+CONNECT_PACKET = bytes([0x10, 0x12, 0x00, 0x04]) + b"MQTT" + bytes([0x04, 0x02, 0x00, 0x0A, 0x00, 0x06]) + b"device"
+PUBLISH_QOS1_PACKET = bytes([0x32, 0x0A, 0x00, 0x04]) + b"test" + bytes([0x00, 0x01]) + b"hi"
+
+
+@unittest.skipIf(shutil.which("openssl") is None, "openssl is required to generate a test certificate")
+class BrokerTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.directory = tempfile.TemporaryDirectory()
+        cls.cert = os.path.join(cls.directory.name, "cert.pem")
+        cls.key = os.path.join(cls.directory.name, "key.pem")
+        subprocess.run(
+            ["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1", "-subj", "/CN=localhost", "-keyout", cls.key, "-out", cls.cert],
+            check=True,
+            capture_output=True
+        )
+
+        cls.server_socket = create_server_socket(0)
+        cls.port = cls.server_socket.getsockname()[1]
+        threading.Thread(target=serve, args=(cls.server_socket, create_context(cls.cert, cls.key)), daemon=True).start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server_socket.close()
+        cls.directory.cleanup()
+
+    def setUp(self):
+        stats.update({"connections": 0, "resumed": 0, "full": 0, "handshakeMs": [], "publishes": 0, "duplicates": 0})
+        self.context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        self.context.check_hostname = False
+        self.context.verify_mode = ssl.CERT_NONE
+
+    def connect(self, session=None):
+        connection = self.context.wrap_socket(socket.create_connection(("localhost", self.port)), session=session)
+        connection.sendall(CONNECT_PACKET)
+        self.assertEqual(connection.recv(4), bytes([0x20, 0x02, 0x00, 0x00]))
+        return connection
+
+    def test_session_resumption(self):
+        connection = self.connect()
+        session = connection.session
+        self.assertFalse(connection.session_reused)
+        connection.close()
+
+        for i in range(3):
+            connection = self.connect(session)
+            self.assertTrue(connection.session_reused)
+            connection.close()
+
+        summary = get_summary()
+        self.assertEqual(summary["full"], 1)
+        self.assertEqual(summary["resumed"], 3)
+
+    def test_qos1_publish_is_acknowledged(self):
+        connection = self.connect()
+        connection.sendall(PUBLISH_QOS1_PACKET)
+        self.assertEqual(connection.recv(4), bytes([0x40, 0x02, 0x00, 0x01]))
+        connection.close()
+        self.assertEqual(get_summary()["publishes"], 1)
+
+
+
+class PlainBrokerTest(unittest.TestCase):
+    ACK_DELAY = 0.2
+
+    @classmethod
+    def setUpClass(cls):
+        cls.server_socket = create_server_socket(0)
+        cls.port = cls.server_socket.getsockname()[1]
+        threading.Thread(target=serve, args=(cls.server_socket, None, 0, cls.ACK_DELAY), daemon=True).start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server_socket.close()
+
+    def setUp(self):
+        stats.update({"connections": 0, "resumed": 0, "full": 0, "handshakeMs": [], "publishes": 0, "duplicates": 0})
+
+    def test_pipelined_publishes_are_acknowledged_in_order(self):
+        connection = socket.create_connection(("localhost", self.port))
+        connection.sendall(CONNECT_PACKET)
+        self.assertEqual(read_exactly(connection, 4), bytes([0x20, 0x02, 0x00, 0x00]))
+
+        started = time.monotonic()
+        for packet_id in range(0x8000, 0x8010):
+            flags = 0x3A if packet_id == 0x8000 else 0x32
+            connection.sendall(bytes([flags, 0x0A, 0x00, 0x04]) + b"test" + packet_id.to_bytes(2, "big") + b"hi")
+
+        acks = read_exactly(connection, 16 * 4)
+        duration = time.monotonic() - started
+        connection.close()
+
+        expected = b"".join(bytes([0x40, 0x02]) + packet_id.to_bytes(2, "big") for packet_id in range(0x8000, 0x8010))
+        self.assertEqual(acks, expected)
+        # Acknowledgements are delayed once for the whole window, not once per message
+        self.assertGreaterEqual(duration, self.ACK_DELAY)
+        self.assertLess(duration, self.ACK_DELAY * 4)
+        self.assertEqual(get_summary()["publishes"], 16)
+        self.assertEqual(get_summary()["duplicates"], 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,191 @@
+import argparse
+import email.utils
+import hashlib
+import json
+import os
+import random
+import re
+import shutil
+import threading
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+#
+# Local stand-in for the firmware update server.
+#
+# Serves the same layout as the update bucket (version.txt and <version>/firmware.bin)
+# from a local directory, answers conditional requests like S3 does and counts requests
+# per client so that polling behaviour of a device or a fleet can be verified.
+#
+# Usage:
+#   python3 server.py --root update --port 8000
+#   PIO_UPDATES_URL=http://<host>:8000 pio run -e debug -t upload
+#   curl http://<host>:8000/stats
+#
+# Statistics are printed on exit and available as JSON from /stats. Use --fail-rate to
+# return 503 for a share of requests and verify that devices back off. Use --drop-after to
+# close every firmware response after given number of body bytes and verify that devices
+# resume the download with Range requests.
+#
+
+stats_lock = threading.Lock()
+stats = {}
+
+
+def count_request(client: str, path: str, status: int):
+    with stats_lock:
+        client_stats = stats.setdefault(client, {"requests": 0, "statuses": {}, "paths": {}})
+        client_stats["requests"] += 1
+        client_stats["statuses"][str(status)] = client_stats["statuses"].get(str(status), 0) + 1
+        client_stats["paths"][path] = client_stats["paths"].get(path, 0) + 1
+
+
+def get_summary():
+    with stats_lock:
+        total = sum(client["requests"] for client in stats.values())
+        return {"clients": len(stats), "requests": total, "perClient": stats}
+
+
+class UpdateRequestHandler(SimpleHTTPRequestHandler):
+
+    fail_rate = 0.0
+    drop_after = 0
+    body_length = 0
+
+    def log_message(self, format, *args):
+        print("%s - %s" % (self.client_address[0], format % args))
+
+    def send_response(self, code, message=None):
+        if self.path != "/stats":
+            count_request(self.client_address[0], self.path.split("?")[0], code)
+        super().send_response(code, message)
+
+    def guess_type(self, path):
+        if path.endswith(".bin"):
+            return "application/octet-stream"
+        return super().guess_type(path)
+
+    def get_etag(self, path: str) -> str:
+        with open(path, "rb") as file:
+            return '"' + hashlib.md5(file.read()).hexdigest() + '"'
+
+    def send_head(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            return super().send_head()
+
+        etag = self.get_etag(path)
+        modified = os.stat(path).st_mtime
+        if_none_match = self.headers.get("If-None-Match")
+        if_modified_since = self.headers.get("If-Modified-Since")
+
+        not_modified = False
+        if if_none_match is not None:
+            not_modified = etag in [tag.strip() for tag in if_none_match.split(",")]
+        elif if_modified_since is not None:
+            try:
+                since = email.utils.parsedate_to_datetime(if_modified_since).timestamp()
+                not_modified = int(modified) <= since
+            except (TypeError, ValueError):
+                pass
+
+        if not_modified:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.send_header("Last-Modified", self.date_time_string(modified))
+            self.end_headers()
+            return None
+
+        file = open(path, "rb")
+        size = os.fstat(file.fileno()).st_size
+        range_match = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+        if range_match is not None:
+            start = int(range_match.group(1))
+            end = int(range_match.group(2)) if range_match.group(2) else size - 1
+            if start >= size or end < start:
+                file.close()
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */{0}".format(size))
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return None
+            end = min(end, size - 1)
+            file.seek(start)
+            self.body_length = end - start + 1
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes {0}-{1}/{2}".format(start, end, size))
+        else:
+            self.body_length = size
+            self.send_response(200)
+
+        self.send_header("Content-Type", self.guess_type(path))
+        self.send_header("Content-Length", str(self.body_length))
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("ETag", etag)
+        self.send_header("Last-Modified", self.date_time_string(modified))
+        self.end_headers()
+        return file
+
+    def copyfile(self, source, outputfile):
+        length = self.body_length
+        if self.drop_after > 0 and self.path.endswith(".bin") and length > self.drop_after:
+            # Send only part of the promised body and close the connection
+            outputfile.write(source.read(self.drop_after))
+            self.close_connection = True
+            return
+        shutil.copyfileobj(source, outputfile)
+
+    def do_GET(self):
+        if self.path == "/stats":
+            body = json.dumps(get_summary(), indent=2).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+
+        if random.random() < self.fail_rate:
+            self.send_error(503)
+            return
+
+        super().do_GET()
+
+
+def create_server(root: str, port: int, fail_rate: float = 0.0, drop_after: int = 0) -> ThreadingHTTPServer:
+    UpdateRequestHandler.fail_rate = fail_rate
+    UpdateRequestHandler.drop_after = drop_after
+    return ThreadingHTTPServer(("", port), lambda *handler_args: UpdateRequestHandler(*handler_args, directory=root))
+
+
+def is_directory(value):
+    if not os.path.isdir(value):
+        raise argparse.ArgumentTypeError(f"{value} is not a valid directory")
+    return value
+
+
+def is_rate(value):
+    rate = float(value)
+    if rate < 0 or rate > 1:
+        raise argparse.ArgumentTypeError(f"{value} must be between 0 and 1")
+    return rate
+
+
+if __name__ == "__main__":
+    argument_parser = argparse.ArgumentParser(description="Local stand-in for the firmware update server.")
+
+    argument_parser.add_argument("--root", type=is_directory, required=True, help="Directory containing version.txt and firmware folders.")
+    argument_parser.add_argument("--port", type=int, default=8000, help="Port to listen on.")
+    argument_parser.add_argument("--fail-rate", type=is_rate, default=0.0, help="Share of requests answered with 503.")
+    argument_parser.add_argument("--drop-after", type=int, default=0, help="Close firmware responses after this many body bytes.")
+
+    args = argument_parser.parse_args()
+
+    server = create_server(args.root, args.port, args.fail_rate, args.drop_after)
+
+    print("Serving {0} on port {1}".format(args.root, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+    print(json.dumps(get_summary(), indent=2))
@@ -0,0 +1,105 @@
+import hashlib
+import http.client
+import os
+import tempfile
+import threading
+import unittest
+
+from server import create_server, get_summary, stats
+
+#
+# Tests for the update server stand-in. The download test follows the device OTA flow:
+# hash file first, then firmware resumed with Range requests after every dropped
+# connection and verified against the published SHA-256.
+#
+# Run with:
+#   cd tools/ota-test-server && python3 -m unittest test_server
+#
+
+FIRMWARE_LENGTH = 100000
+DROP_AFTER = 16384
+
+
+class UpdateServerTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.root = tempfile.TemporaryDirectory()
+        cls.firmware = os.urandom(FIRMWARE_LENGTH)
+        os.makedirs(os.path.join(cls.root.name, "1.0.1"))
+        with open(os.path.join(cls.root.name, "version.txt"), "w") as file:
+            file.write("1.0.1\n")
+        with open(os.path.join(cls.root.name, "1.0.1", "firmware.bin"), "wb") as file:
+            file.write(cls.firmware)
+        with open(os.path.join(cls.root.name, "1.0.1", "firmware.bin.sha256"), "w") as file:
+            file.write(hashlib.sha256(cls.firmware).hexdigest() + "  firmware.bin\n")
+
+        cls.server = create_server(cls.root.name, 0, drop_after=DROP_AFTER)
+        cls.port = cls.server.server_address[1]
+        threading.Thread(target=cls.server.serve_forever, daemon=True).start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server.shutdown()
+        cls.server.server_close()
+        cls.root.cleanup()
+
+    def setUp(self):
+        stats.clear()
+
+    def get(self, path, headers={}):
+        connection = http.client.HTTPConnection("localhost", self.port)
+        connection.request("GET", path, headers=headers)
+        response = connection.getresponse()
+        try:
+            body = response.read()
+        except http.client.IncompleteRead as error:
+            body = error.partial
+        connection.close()
+        return response, body
+
+    def test_conditional_version_request(self):
+        response, body = self.get("/version.txt")
+        self.assertEqual(response.status, 200)
+        self.assertEqual(body.strip(), b"1.0.1")
+
+        response, body = self.get("/version.txt", {"If-None-Match": response.getheader("ETag")})
+        self.assertEqual(response.status, 304)
+        self.assertEqual(body, b"")
+
+        response, body = self.get("/version.txt", {"If-Modified-Since": response.getheader("Last-Modified")})
+        self.assertEqual(response.status, 304)
+
+        self.assertEqual(get_summary()["requests"], 3)
+
+    def test_resumed_download(self):
+        response, body = self.get("/1.0.1/firmware.bin.sha256")
+        expected_hash = body.decode()[:64]
+
+        hash = hashlib.sha256()
+        written = 0
+        total = None
+        while total is None or written < total:
+            headers = {"Range": "bytes={0}-".format(written)} if written > 0 else {}
+            response, body = self.get("/1.0.1/firmware.bin", headers)
+            if written == 0:
+                self.assertEqual(response.status, 200)
+                total = int(response.getheader("Content-Length"))
+            else:
+                self.assertEqual(response.status, 206)
+                self.assertEqual(response.getheader("Content-Range"), "bytes {0}-{1}/{2}".format(written, total - 1, total))
+            self.assertEqual(response.getheader("Content-Type"), "application/octet-stream")
+            hash.update(body)
+            written += len(body)
+
+        self.assertEqual(written, FIRMWARE_LENGTH)
+        self.assertEqual(hash.hexdigest(), expected_hash)
+        self.assertEqual(get_summary()["requests"], 1 + (FIRMWARE_LENGTH + DROP_AFTER - 1) // DROP_AFTER)
+
+    def test_range_past_end(self):
+        response, body = self.get("/1.0.1/firmware.bin", {"Range": "bytes={0}-".format(FIRMWARE_LENGTH)})
+        self.assertEqual(response.status, 416)
+
+
+if __name__ == "__main__":
+    unittest.main()